@@ -0,0 +1,93 @@
+"""
+PlatformIO post-build step: report Teensy 4.1 memory region usage and
+where the HOTPATH functions ended up.
+
+RAM1 (512K) is shared by ITCM code and DTCM data in 32K banks; RAM2 (512K)
+holds DMAMEM buffers and the heap. The stack is whatever DTCM is left over;
+the run-time high-water mark is reported by the $mem command.
+"""
+
+Import("env")
+
+import subprocess
+
+HOT_FUNCTIONS = [
+    "checkAndHomeOnLowPower",
+    "setValvePosition",
+    "turnValve",
+    "isIntervalTime",
+    "handleLanderByte",
+    "pollCommands",
+    "timebaseEdge",
+    "dispatchEvents",
+    "eventTick",
+    "onTick",
+    "onPowerAlert",
+    "sampleTick",
+    "blockStageProcess",
+    "timebaseNow",
+    "clockSyncUpdate",
+    "syncedNow",
+    "ledTick",
+]
+
+RAM1_SIZE = 512 * 1024
+RAM2_SIZE = 512 * 1024
+FLASH_SIZE = 7936 * 1024
+ITCM_BANK = 32 * 1024
+
+
+def section_sizes(elf):
+    out = subprocess.check_output([env.subst("$SIZETOOL"), "-A", elf], text=True)
+    sizes = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 3 and fields[0].startswith("."):
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def hot_function_sections(elf):
+    nm = env.subst("$CC").replace("gcc", "nm")
+    out = subprocess.check_output([nm, "-C", "--defined-only", elf], text=True)
+    addresses = {}
+    for line in out.splitlines():
+        fields = line.split(maxsplit=2)
+        if len(fields) == 3:
+            name = fields[2].split("(")[0]
+            if name in HOT_FUNCTIONS:
+                addresses[name] = int(fields[0], 16)
+    return addresses
+
+
+def region(address):
+    if address < 0x00080000:
+        return "ITCM"
+    if 0x60000000 <= address < 0x70000000:
+        return "FLASH"
+    return "?"
+
+
+def report(source, target, env):
+    elf = str(target[0])
+    s = section_sizes(elf)
+    itcm = s.get(".text.itcm", 0)
+    itcm_banks = (itcm + ITCM_BANK - 1) // ITCM_BANK * ITCM_BANK
+    dtcm = s.get(".data", 0) + s.get(".bss", 0)
+    ram2 = s.get(".bss.dma", 0)
+    flash = s.get(".text.headers", 0) + s.get(".text.code", 0) + s.get(".text.progmem", 0) + itcm + s.get(".data", 0)
+
+    print("Memory map (%s)" % elf)
+    print("  FLASH  %7d / %7d  code, progmem and initialisers" % (flash, FLASH_SIZE))
+    print("  ITCM   %7d (%d in 32K banks)" % (itcm, itcm_banks))
+    print("  DTCM   %7d  data + bss" % dtcm)
+    print("  stack  %7d  RAM1 left for the stack" % (RAM1_SIZE - itcm_banks - dtcm))
+    print("  RAM2   %7d / %7d  DMAMEM buffers; rest is heap" % (ram2, RAM2_SIZE))
+
+    placed = hot_function_sections(elf)
+    for name in HOT_FUNCTIONS:
+        if name in placed:
+            print("  %-24s %s" % (name, region(placed[name])))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", report)
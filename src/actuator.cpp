@@ -0,0 +1,159 @@
+#include "actuator.h"
+#include "blockstats.h"
+#include "commands.h"
+#include "config.h"
+#include "energy.h"
+#include "logging.h"
+#include "sysinfo.h"
+#include <Servo.h>
+
+static Servo servo;
+static uint8_t servoPin = 0;
+static int position = 0;
+static bool attached = false;
+
+// Move in progress in detach mode
+static bool settling = false;
+static uint32_t moveStart = 0;
+static uint32_t quietSince = 0;
+static int windowMa = ACTUATOR_SETTLE_MA;
+static uint32_t lastSettleMs = 0;
+static uint32_t settleTimeouts = 0;
+
+// Bus current while the servo isn't moving: block mean and peak-to-peak
+static float idleMa = 0;
+static float rippleMa = 0;
+static uint32_t idleBlocks = 0;
+
+// Charge and time per mode, indexed by servo_detach
+static double modeMas[2] = {};
+static double modeSeconds[2] = {};
+static int32_t reportedMode = -1;
+static unsigned long lastReport = 0;
+
+static void attach() {
+  // attach() starts the channel at the default 1500 us; set the target
+  // before the first pulse goes out so the servo doesn't twitch
+  servo.attach(servoPin);
+  servo.writeMicroseconds(position);
+  attached = true;
+  energySet(ENERGY_SERVO_HOLD, true);
+}
+
+static void detach() {
+  servo.detach();
+  attached = false;
+  settling = false;
+  energySet(ENERGY_SERVO_HOLD, false);
+}
+
+FLASHMEM void actuatorBegin(uint8_t pin) {
+  servoPin = pin;
+}
+
+HOTPATH void actuatorMove(int microseconds) {
+  position = microseconds;
+  if (attached) {
+    servo.writeMicroseconds(microseconds);
+  } else {
+    attach();
+  }
+  energyServoMoved();
+  if (config.servoDetach) {
+    settling = true;
+    moveStart = quietSince = millis();
+    if (!idleBlocks) idleMa = samplerLatestCurrent();
+    windowMa = ACTUATOR_SETTLE_MA + (int)rippleMa;
+  }
+}
+
+int actuatorPosition() {
+  return position;
+}
+
+bool actuatorAttached() {
+  return attached;
+}
+
+HOTPATH void actuatorPoll() {
+  if (!config.servoDetach) {
+    // Switched to hold mode: drive the last position again
+    if (!attached && position) attach();
+    settling = false;
+    return;
+  }
+  if (!attached) return;
+  if (!settling) {
+    detach(); // switched to detach mode while holding
+    return;
+  }
+
+  uint32_t now = millis();
+  uint32_t elapsed = now - moveStart;
+  if (elapsed >= ACTUATOR_SETTLE_MAX_MS) {
+    settleTimeouts++;
+    lastSettleMs = elapsed;
+    Serial.println("Servo did not settle, detaching");
+    detach();
+    return;
+  }
+  if (elapsed < ACTUATOR_SETTLE_MIN_MS) return;
+  if (fabsf(samplerLatestCurrent() - idleMa) > windowMa) {
+    quietSince = now;
+  } else if (now - quietSince >= ACTUATOR_SETTLE_QUIET_MS) {
+    lastSettleMs = elapsed;
+    detach();
+  }
+}
+
+HOTPATH void actuatorAddBlock(const SampleBlock& block) {
+  int32_t sum = 0;
+  for (uint16_t i = 0; i < block.count; i++) sum += block.current[i];
+  uint8_t mode = config.servoDetach ? 1 : 0;
+  modeMas[mode] += (double)sum * block.periodCycles / F_CPU_ACTUAL;
+  modeSeconds[mode] += (double)block.count * block.periodCycles / F_CPU_ACTUAL;
+
+  if (settling || !block.count) return;
+  for (uint16_t i = 0; i < block.count; i++) {
+    if (block.activity[i] & (1 << ENERGY_SERVO_MOVE)) return;
+  }
+  BlockStats stats = blockStats(block.current, block.count);
+  float mean = (float)stats.sum / block.count;
+  float spread = stats.max - stats.min;
+  if (!idleBlocks) {
+    idleMa = mean;
+    rippleMa = spread;
+  } else {
+    idleMa += (mean - idleMa) / ACTUATOR_IDLE_BLOCKS;
+    rippleMa += (spread - rippleMa) / ACTUATOR_IDLE_BLOCKS;
+  }
+  idleBlocks++;
+}
+
+static float modeAverage(uint8_t mode) {
+  return modeSeconds[mode] > 0 ? modeMas[mode] / modeSeconds[mode] : 0;
+}
+
+FLASHMEM void actuatorReport() {
+  unsigned long now = millis() / 1000;
+  bool modeChanged = reportedMode >= 0 && reportedMode != config.servoDetach;
+  if (reportedMode < 0) reportedMode = config.servoDetach;
+  if (!modeChanged && now - lastReport < ACTUATOR_REPORT_INTERVAL) return;
+  lastReport = now;
+  reportedMode = config.servoDetach;
+  logEvent("Servo %s mode: average current hold %.1f mA over %.1f h, detach %.1f mA over %.1f h",
+           config.servoDetach ? "detach" : "hold", modeAverage(0), modeSeconds[0] / 3600, modeAverage(1),
+           modeSeconds[1] / 3600);
+}
+
+FLASHMEM static void servoCommand(Print& out, int argc, char* argv[]) {
+  out.printf("mode=%s position=%dus attached=%d settle=%lums timeouts=%lu\n", config.servoDetach ? "detach" : "hold",
+             position, attached, (unsigned long)lastSettleMs, (unsigned long)settleTimeouts);
+  out.printf("idle %.1fmA ripple %.1fmA, settle window %dmA\n", idleMa, rippleMa, windowMa);
+  out.printf("hold: %.1fmA over %.1fh\n", modeAverage(0), modeSeconds[0] / 3600);
+  out.printf("detach: %.1fmA over %.1fh\n", modeAverage(1), modeSeconds[1] / 3600);
+}
+
+FLASHMEM void registerActuatorCommands() {
+  registerCommand("servo", servoCommand, "servo: actuator mode, settle time and average current per mode");
+}
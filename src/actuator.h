@@ -0,0 +1,52 @@
+/**
+ * @brief Valve servo driver with optional detach between moves
+ *
+ * In hold mode (servo_detach 0) the servo is attached at the first move and
+ * driven continuously, as before. In detach mode each move attaches the
+ * servo with the new pulse width, waits for it to settle and then stops the
+ * pulses, so the servo draws no holding current while the valve sits still
+ * between moves. The 3-way valve holds its position unpowered.
+ *
+ * Settling is judged from the INA260 current: after ACTUATOR_SETTLE_MIN_MS
+ * the current must stay near its idle level for ACTUATOR_SETTLE_QUIET_MS.
+ * The idle level and its ripple (the peak-to-peak spread of each sample
+ * block, mostly the pump) are averaged over blocks without a servo move,
+ * and the window is that ripple plus ACTUATOR_SETTLE_MA, so the pump alone
+ * never holds a move open. A move that never settles is detached after
+ * ACTUATOR_SETTLE_MAX_MS and counted.
+ *
+ * The average bus current is kept separately for each mode and logged
+ * every ACTUATOR_REPORT_INTERVAL and when the mode changes, so the two can
+ * be compared on the same hardware.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "sampler.h"
+
+const uint32_t ACTUATOR_SETTLE_MIN_MS = 200;
+const uint32_t ACTUATOR_SETTLE_QUIET_MS = 100;
+const uint32_t ACTUATOR_SETTLE_MAX_MS = 2000;
+const int ACTUATOR_SETTLE_MA = 30; // above the idle ripple
+// Averaging length of the idle level and ripple, in sample blocks
+const uint8_t ACTUATOR_IDLE_BLOCKS = 8;
+const unsigned long ACTUATOR_REPORT_INTERVAL = 21600; // seconds
+
+void actuatorBegin(uint8_t pin);
+// Drive the servo to a pulse width, attaching it first if needed
+void actuatorMove(int microseconds);
+// Last commanded pulse width, whether or not the servo is attached; 0
+// before the first move
+int actuatorPosition();
+bool actuatorAttached();
+
+// Detach once a move has settled; call every tick
+void actuatorPoll();
+// Accumulate the average current of the active mode
+void actuatorAddBlock(const SampleBlock& block);
+// Log the per-mode averages when due or when the mode changed; call once a second
+void actuatorReport();
+
+// Registers servo
+void registerActuatorCommands();
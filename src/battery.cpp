@@ -0,0 +1,146 @@
+#include "battery.h"
+#include "commands.h"
+#include "config.h"
+#include "leds.h"
+#include "logging.h"
+#include "sysinfo.h"
+
+const BatteryTierSettings batteryTiers[BATTERY_TIER_COUNT] = {
+  {"normal", 101, 1, 1, true},
+  {"save", 50, 2, 2, true},
+  {"low", 25, 4, 4, false},
+  {"critical", 10, 8, 10, false},
+};
+
+struct VoltagePoint {
+  int16_t mv;
+  uint8_t percent;
+};
+
+// 12 V lead-acid open-circuit voltage, ascending
+static const VoltagePoint restingVoltage[] = {
+  {11310, 0}, {11510, 10}, {11660, 20}, {11810, 30}, {11960, 40}, {12100, 50},
+  {12240, 60}, {12370, 70}, {12500, 80}, {12620, 90}, {12730, 100},
+};
+static const size_t VOLTAGE_POINTS = sizeof(restingVoltage) / sizeof(restingVoltage[0]);
+
+static double drawnMas = 0; // since the last update
+static uint32_t lastUpdateMillis = 0;
+static float stateOfCharge = 100;
+static float voltageEstimate = 100;
+static float averageMa = 0;
+static BatteryTier tier = BATTERY_NORMAL;
+
+static float socFromVoltage(int mv, float ma) {
+  float ocv = mv + ma * BATTERY_RESISTANCE_MOHM / 1000.0f;
+  if (ocv <= restingVoltage[0].mv) return 0;
+  for (size_t i = 1; i < VOLTAGE_POINTS; i++) {
+    const VoltagePoint& lo = restingVoltage[i - 1];
+    const VoltagePoint& hi = restingVoltage[i];
+    if (ocv < hi.mv) return lo.percent + (ocv - lo.mv) * (hi.percent - lo.percent) / (hi.mv - lo.mv);
+  }
+  return 100;
+}
+
+FLASHMEM void batteryBegin() {
+  averageMa = samplerLatestCurrent();
+  voltageEstimate = socFromVoltage(samplerLatestVoltage(), averageMa);
+  stateOfCharge = voltageEstimate;
+  drawnMas = 0;
+  lastUpdateMillis = millis();
+}
+
+HOTPATH void batteryAddBlock(const SampleBlock& block) {
+  int32_t sum = 0;
+  for (uint16_t i = 0; i < block.count; i++) sum += block.current[i];
+  drawnMas += (double)sum * block.periodCycles / F_CPU_ACTUAL;
+}
+
+// Push the tier's rates to the sampler and LEDs
+static void applyTier() {
+  ledsSetEnabled(batteryLedsEnabled());
+  samplerSetRate(batterySampleRate());
+}
+
+void batteryUpdate() {
+  uint32_t nowMillis = millis();
+  float seconds = (nowMillis - lastUpdateMillis) / 1000.0f;
+  if (seconds <= 0) return;
+  lastUpdateMillis = nowMillis;
+
+  float ma = drawnMas / seconds;
+  averageMa += (ma - averageMa) * min(seconds / BATTERY_AVERAGE_SECONDS, 1.0f);
+  if (config.batteryCapacityMah > 0) {
+    stateOfCharge -= drawnMas / 3600.0 / config.batteryCapacityMah * 100;
+  }
+  drawnMas = 0;
+  voltageEstimate = socFromVoltage(samplerLatestVoltage(), ma);
+  stateOfCharge += (voltageEstimate - stateOfCharge) * min(seconds / BATTERY_VOLTAGE_TRUST_SECONDS, 1.0f);
+  stateOfCharge = constrain(stateOfCharge, 0.0f, 100.0f);
+
+  BatteryTier target = tier;
+  if (config.batteryCapacityMah <= 0) {
+    target = BATTERY_NORMAL;
+  } else {
+    while (target + 1 < BATTERY_TIER_COUNT && stateOfCharge < batteryTiers[target + 1].belowPercent) {
+      target = (BatteryTier)(target + 1);
+    }
+    while (target > BATTERY_NORMAL && stateOfCharge >= batteryTiers[target].belowPercent + BATTERY_HYSTERESIS) {
+      target = (BatteryTier)(target - 1);
+    }
+  }
+  if (target == tier) return;
+
+  tier = target;
+  applyTier();
+  logEvent("Battery tier %s: %.0f%%, %.1f h left, log %lus, sampling %ldHz, LEDs %s", batteryTiers[tier].name,
+           stateOfCharge, batteryHoursLeft(), batteryLogInterval(), (long)batterySampleRate(),
+           batteryLedsEnabled() ? "on" : "off");
+}
+
+float batteryStateOfCharge() {
+  return stateOfCharge;
+}
+
+float batteryHoursLeft() {
+  if (averageMa <= 0 || config.batteryCapacityMah <= 0) return INFINITY;
+  return config.batteryCapacityMah * stateOfCharge / 100 / averageMa;
+}
+
+BatteryTier batteryTier() {
+  return tier;
+}
+
+unsigned long batteryLogInterval() {
+  return (unsigned long)config.logInterval * batteryTiers[tier].logMultiplier;
+}
+
+int32_t batterySampleRate() {
+  return max(config.sampleRateHz / batteryTiers[tier].rateDivisor, (int32_t)10);
+}
+
+bool batteryLedsEnabled() {
+  return config.ledsEnabled && batteryTiers[tier].leds;
+}
+
+FLASHMEM static void batteryCommand(Print& out, int argc, char* argv[]) {
+  if (argc > 2 && strcmp(argv[1], "soc") == 0) {
+    float percent = atof(argv[2]);
+    if (percent < 0 || percent > 100) {
+      out.println("ERR soc 0-100");
+      return;
+    }
+    // e.g. after fitting a fresh battery whose resting voltage hasn't settled
+    stateOfCharge = percent;
+    out.println("OK");
+    return;
+  }
+  out.printf("soc=%.1f%% voltage_soc=%.1f%% capacity=%ldmAh average=%.1fmA left=%.1fh\n", stateOfCharge,
+             voltageEstimate, (long)config.batteryCapacityMah, averageMa, batteryHoursLeft());
+  out.printf("tier=%s log=%lus sampling=%ldHz leds=%s\n", batteryTiers[tier].name, batteryLogInterval(),
+             (long)batterySampleRate(), batteryLedsEnabled() ? "on" : "off");
+}
+
+FLASHMEM void registerBatteryCommands() {
+  registerCommand("battery", batteryCommand, "battery [soc <percent>]: state of charge, runtime and power tier");
+}
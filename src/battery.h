@@ -0,0 +1,69 @@
+/**
+ * @brief Battery state of charge, remaining runtime and power tiers
+ *
+ * The charge drawn is integrated from every current sample. State of charge
+ * starts from the open-circuit voltage (bus voltage plus the drop across
+ * the internal resistance at the measured current) and then follows the
+ * coulomb count, pulled slowly towards the voltage estimate to cancel drift
+ * and a wrong capacity. Remaining runtime is the remaining charge over the
+ * average current of the last BATTERY_AVERAGE_SECONDS.
+ *
+ * As the charge falls, the logging interval, sampling rate and LEDs step
+ * down through BatteryTier, with hysteresis so a tier is not left and
+ * re-entered on noise. Tier changes are logged as events. The hard
+ * threshold_voltage homing is unchanged and still has the last word.
+ *
+ * The voltage table is for a 12 V lead-acid battery at rest; other
+ * chemistries need their own. battery_mah 0 turns the tiers off.
+ * tools/battery_sim.py runs the same estimator and tiers against a
+ * discharge model to compare runtime with fixed-rate behaviour.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "sampler.h"
+
+const int32_t BATTERY_RESISTANCE_MOHM = 40;
+// Time constant of the pull towards the voltage estimate
+const uint32_t BATTERY_VOLTAGE_TRUST_SECONDS = 3600;
+const uint32_t BATTERY_AVERAGE_SECONDS = 600;
+// Percent of charge above a tier's entry point needed to leave it again
+const uint8_t BATTERY_HYSTERESIS = 5;
+
+enum BatteryTier : uint8_t {
+  BATTERY_NORMAL,
+  BATTERY_SAVE,
+  BATTERY_LOW,
+  BATTERY_CRITICAL,
+  BATTERY_TIER_COUNT
+};
+
+struct BatteryTierSettings {
+  const char* name;
+  uint8_t belowPercent;   // entered when the charge falls below this
+  uint8_t logMultiplier;  // of log_interval
+  uint8_t rateDivisor;    // of sample_rate_hz
+  bool leds;
+};
+
+extern const BatteryTierSettings batteryTiers[BATTERY_TIER_COUNT];
+
+// Start from the open-circuit voltage; call once sampling has started
+void batteryBegin();
+// Integrate the charge drawn over a block of samples
+void batteryAddBlock(const SampleBlock& block);
+// Update the estimate and the tier; call once a second
+void batteryUpdate();
+
+float batteryStateOfCharge(); // percent
+float batteryHoursLeft();     // at the recent average current
+BatteryTier batteryTier();
+
+// The config values as stepped down by the current tier
+unsigned long batteryLogInterval();
+int32_t batterySampleRate();
+bool batteryLedsEnabled();
+
+// Registers battery
+void registerBatteryCommands();
@@ -0,0 +1,185 @@
+#include "blockstats.h"
+#include "commands.h"
+#include "sysinfo.h"
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_acle.h>
+#define BLOCKSTATS_USE_SIMD
+#endif
+
+// Reversed Q15 coefficients, so output n is a forward dot product over
+// history[n .. n + TAPS - 1]
+static int16_t taps[DECIMATION_TAPS];
+// Previous TAPS - 1 samples followed by the current block
+static int16_t work[DECIMATION_TAPS - 1 + SAMPLE_BLOCK_SIZE];
+static uint8_t phase = 0; // samples until the next output
+
+// Raw extremes and the decimated outputs since the last take
+static BlockStats interval;
+static int64_t filteredSum = 0;
+static uint32_t filteredCount = 0;
+
+static inline uint32_t loadPair(const int16_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v)); // M7 handles the unaligned load
+  return v;
+}
+
+BlockStats blockStatsScalar(const int16_t* x, size_t n) {
+  BlockStats s = {0, INT16_MAX, INT16_MIN, (uint32_t)n};
+  for (size_t i = 0; i < n; i++) {
+    s.sum += x[i];
+    if (x[i] < s.min) s.min = x[i];
+    if (x[i] > s.max) s.max = x[i];
+  }
+  return s;
+}
+
+// Two lanes of running min and max packed in one word each; the lanes are
+// folded together after the loop and an odd last sample is done in scalar
+HOTPATH BlockStats blockStats(const int16_t* x, size_t n) {
+#ifdef BLOCKSTATS_USE_SIMD
+  uint32_t mins = 0x7FFF7FFF, maxs = 0x80008000;
+  int32_t sum = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    uint32_t pair = loadPair(x + i);
+    sum = __smlad(pair, 0x00010001, sum); // both halves times one
+    __ssub16(pair, mins);       // GE set where pair >= mins
+    mins = __sel(mins, pair);   // GE lanes from the first operand
+    __ssub16(pair, maxs);       // GE set where pair >= maxs
+    maxs = __sel(pair, maxs);
+  }
+  BlockStats s;
+  s.sum = sum;
+  s.min = min((int16_t)mins, (int16_t)(mins >> 16));
+  s.max = max((int16_t)maxs, (int16_t)(maxs >> 16));
+  s.count = n;
+  for (; i < n; i++) {
+    s.sum += x[i];
+    if (x[i] < s.min) s.min = x[i];
+    if (x[i] > s.max) s.max = x[i];
+  }
+  return s;
+#else
+  return blockStatsScalar(x, n);
+#endif
+}
+
+static int16_t firScalar(const int16_t* x) {
+  int32_t acc = 0;
+  for (uint8_t j = 0; j < DECIMATION_TAPS; j++) acc += (int32_t)taps[j] * x[j];
+  return constrain((acc + (1 << 14)) >> 15, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+}
+
+HOTPATH static int16_t fir(const int16_t* x) {
+#ifdef BLOCKSTATS_USE_SIMD
+  int32_t acc = 1 << 14; // rounding
+  for (uint8_t j = 0; j < DECIMATION_TAPS; j += 2) {
+    acc = __smlad(loadPair(x + j), loadPair(taps + j), acc);
+  }
+  return constrain(acc >> 15, (int32_t)INT16_MIN, (int32_t)INT16_MAX);
+#else
+  return firScalar(x);
+#endif
+}
+
+// Decimate n samples from work[], which holds TAPS - 1 samples of history first
+static size_t decimate(int16_t* out, size_t n, int16_t (*filter)(const int16_t*)) {
+  size_t outputs = 0;
+  uint8_t p = phase;
+  for (size_t i = 0; i < n; i++) {
+    if (p == 0) {
+      out[outputs++] = filter(work + i);
+      p = DECIMATION_FACTOR;
+    }
+    p--;
+  }
+  phase = p;
+  return outputs;
+}
+
+FLASHMEM void blockStatsBegin() {
+  // Windowed sinc low-pass at the decimated Nyquist, unity DC gain
+  float h[DECIMATION_TAPS];
+  float total = 0;
+  float centre = (DECIMATION_TAPS - 1) / 2.0f;
+  for (uint8_t i = 0; i < DECIMATION_TAPS; i++) {
+    float t = (i - centre) / DECIMATION_FACTOR;
+    float sinc = t == 0 ? 1 : sinf(M_PI * t) / (M_PI * t);
+    float hamming = 0.54f - 0.46f * cosf(2 * M_PI * i / (DECIMATION_TAPS - 1));
+    h[i] = sinc * hamming;
+    total += h[i];
+  }
+  for (uint8_t i = 0; i < DECIMATION_TAPS; i++) {
+    taps[DECIMATION_TAPS - 1 - i] = lroundf(h[i] / total * 32767);
+  }
+  interval = {0, INT16_MAX, INT16_MIN, 0};
+}
+
+HOTPATH void blockStageProcess(const SampleBlock& block) {
+  BlockStats s = blockStats(block.current, block.count);
+  interval.count += s.count;
+  if (s.min < interval.min) interval.min = s.min;
+  if (s.max > interval.max) interval.max = s.max;
+
+  memcpy(work + DECIMATION_TAPS - 1, block.current, block.count * sizeof(int16_t));
+  int16_t out[SAMPLE_BLOCK_SIZE / DECIMATION_FACTOR + 1];
+  size_t outputs = decimate(out, block.count, fir);
+  for (size_t i = 0; i < outputs; i++) filteredSum += out[i];
+  filteredCount += outputs;
+  // Keep the tail as history for the next block
+  memmove(work, work + block.count, (DECIMATION_TAPS - 1) * sizeof(int16_t));
+}
+
+IntervalCurrent blockStageTake() {
+  IntervalCurrent c;
+  c.samples = interval.count;
+  c.mean = filteredCount ? filteredSum / filteredCount : 0;
+  c.min = interval.count ? interval.min : 0;
+  c.max = interval.count ? interval.max : 0;
+  interval = {0, INT16_MAX, INT16_MIN, 0};
+  filteredSum = 0;
+  filteredCount = 0;
+  return c;
+}
+
+FLASHMEM static void benchCommand(Print& out, int argc, char* argv[]) {
+  const int runs = 100;
+  static int16_t block[SAMPLE_BLOCK_SIZE];
+  for (size_t i = 0; i < SAMPLE_BLOCK_SIZE; i++) block[i] = 500 + (int16_t)(200 * sinf(i * 0.3f)) + (i * 7919) % 37;
+  int16_t decimated[SAMPLE_BLOCK_SIZE / DECIMATION_FACTOR + 1];
+  // The benchmark borrows the filter state; put it back afterwards
+  int16_t history[DECIMATION_TAPS - 1];
+  memcpy(history, work, sizeof(history));
+  uint8_t savedPhase = phase;
+  memcpy(work + DECIMATION_TAPS - 1, block, sizeof(block));
+  volatile int32_t sink = 0;
+
+  uint32_t start = ARM_DWT_CYCCNT;
+  for (int r = 0; r < runs; r++) sink += blockStatsScalar(block, SAMPLE_BLOCK_SIZE).sum;
+  uint32_t statsScalar = ARM_DWT_CYCCNT - start;
+  start = ARM_DWT_CYCCNT;
+  for (int r = 0; r < runs; r++) sink += blockStats(block, SAMPLE_BLOCK_SIZE).sum;
+  uint32_t statsSimd = ARM_DWT_CYCCNT - start;
+  start = ARM_DWT_CYCCNT;
+  for (int r = 0; r < runs; r++) sink += decimate(decimated, SAMPLE_BLOCK_SIZE, firScalar);
+  uint32_t firScalarCycles = ARM_DWT_CYCCNT - start;
+  start = ARM_DWT_CYCCNT;
+  for (int r = 0; r < runs; r++) sink += decimate(decimated, SAMPLE_BLOCK_SIZE, fir);
+  uint32_t firSimdCycles = ARM_DWT_CYCCNT - start;
+  phase = savedPhase;
+  memcpy(work, history, sizeof(history));
+
+  BlockStats a = blockStatsScalar(block, SAMPLE_BLOCK_SIZE), b = blockStats(block, SAMPLE_BLOCK_SIZE);
+  bool match = a.sum == b.sum && a.min == b.min && a.max == b.max;
+  float samples = (float)runs * SAMPLE_BLOCK_SIZE;
+  out.printf("stats scalar=%.2f simd=%.2f cycles/sample%s\n", statsScalar / samples, statsSimd / samples,
+             match ? "" : " MISMATCH");
+  out.printf("fir%u/%u scalar=%.2f simd=%.2f cycles/sample\n", DECIMATION_TAPS, DECIMATION_FACTOR,
+             firScalarCycles / samples, firSimdCycles / samples);
+}
+
+FLASHMEM void registerBlockStatsCommands() {
+  registerCommand("bench", benchCommand, "cycles per sample of the block stats and decimation filter");
+}
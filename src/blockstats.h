@@ -0,0 +1,51 @@
+/**
+ * @brief Block reductions and decimating filter for sampled current
+ *
+ * Works on whole sample blocks instead of one value at a time. Min, max and
+ * sum are reduced two samples at a time with the Cortex-M7 dual 16-bit SIMD
+ * intrinsics: __smlad against 1:1 sums both halves, and __ssub16 sets the
+ * per-lane GE flags that __sel then uses to keep the smaller or larger
+ * lane. A decimating low-pass FIR, also built on __smlad (two taps per
+ * instruction), turns the raw stream into an anti-aliased one at
+ * rate / DECIMATION_FACTOR. The logger records the mean of the filtered
+ * stream over the log interval and the interval min/max instead of a
+ * single instantaneous reading.
+ *
+ * Scalar reference versions are always built. They are used off-target and
+ * by "$bench", which reports cycles per sample for both.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "sampler.h"
+
+const uint8_t DECIMATION_FACTOR = 8;
+const uint8_t DECIMATION_TAPS = 32; // must be even
+
+struct BlockStats {
+  int32_t sum;
+  int16_t min;
+  int16_t max;
+  uint32_t count;
+};
+
+struct IntervalCurrent {
+  uint32_t samples;  // 0 means no blocks this interval
+  int16_t mean;      // of the decimated outputs, mA
+  int16_t min;
+  int16_t max;
+};
+
+void blockStatsBegin();
+// Reductions over n samples
+BlockStats blockStats(const int16_t* x, size_t n);
+BlockStats blockStatsScalar(const int16_t* x, size_t n);
+
+// Feed one sample block through the reductions and the decimator
+void blockStageProcess(const SampleBlock& block);
+// Summarise the interval since the last call and reset
+IntervalCurrent blockStageTake();
+
+// Registers bench
+void registerBlockStatsCommands();
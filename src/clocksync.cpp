@@ -0,0 +1,153 @@
+#include "clocksync.h"
+#include "commands.h"
+#include "logging.h"
+#include "sysinfo.h"
+
+const size_t DELAY_HISTORY = 8;
+const float MAX_DRIFT_PPM = 500;
+
+static bool synced = false;
+static double appliedOffsetMs = 0;  // correction currently added to RTC time
+static uint32_t lastUpdateMicros = 0;
+
+// Last accepted measurement of (lander - RTC), and when it was taken
+static int64_t lastOffsetMs = 0;
+static int64_t lastSampleRtcMs = 0;
+
+// Reference sample for the drift slope
+static bool haveDriftRef = false;
+static int64_t driftRefOffsetMs = 0;
+static int64_t driftRefRtcMs = 0;
+static bool haveDrift = false;
+static float driftPpm = 0;
+
+static int64_t delayHistory[DELAY_HISTORY];
+static size_t delayCount = 0;
+
+static bool pending = false;
+static uint16_t pendingSeq = 0;
+static int64_t pendingT1 = 0;
+
+static int64_t rtcMillis() {
+  return timestampMillis(timebaseNow());
+}
+
+// Where the offset should be now, extrapolating the last sample by the drift rate
+static double targetOffsetMs(int64_t rtcMs) {
+  return lastOffsetMs + driftPpm * 1e-6 * (double)(rtcMs - lastSampleRtcMs);
+}
+
+HOTPATH void clockSyncUpdate() {
+  uint32_t nowMicros = micros();
+  uint32_t elapsed = nowMicros - lastUpdateMicros;
+  lastUpdateMicros = nowMicros;
+  if (!synced) return;
+
+  double maxStep = elapsed * CLOCK_SYNC_MAX_SLEW_PPM * 1e-9; // us * ppm -> ms
+  double error = targetOffsetMs(rtcMillis()) - appliedOffsetMs;
+  appliedOffsetMs += constrain(error, -maxStep, maxStep);
+}
+
+HOTPATH Timestamp syncedNow() {
+  return timestampFromMillis(rtcMillis() + (int64_t)llround(appliedOffsetMs));
+}
+
+float clockSyncDriftPpm() {
+  return driftPpm;
+}
+
+static bool isQueuedSample(int64_t delay) {
+  int64_t minDelay = delay;
+  for (size_t i = 0; i < delayCount && i < DELAY_HISTORY; i++) {
+    if (delayHistory[i] < minDelay) minDelay = delayHistory[i];
+  }
+  delayHistory[delayCount++ % DELAY_HISTORY] = delay;
+  return delay > minDelay * CLOCK_SYNC_DELAY_REJECT_FACTOR && delay - minDelay > 2;
+}
+
+static void stepClock(int64_t offsetMs) {
+  int64_t nowRtc = rtcMillis();
+  int64_t corrected = nowRtc + offsetMs;
+  timebaseSetRtc(corrected / 1000);
+  // Setting the RTC moved raw time by `shift`; re-express everything in it
+  int64_t shift = (corrected / 1000) * 1000 - nowRtc;
+  lastOffsetMs = offsetMs - shift;
+  lastSampleRtcMs = nowRtc + shift;
+  appliedOffsetMs = lastOffsetMs;
+  driftRefOffsetMs -= shift;
+  driftRefRtcMs += shift;
+  logEvent("Clock stepped by %ld ms", (long)shift);
+}
+
+static void acceptSample(int64_t offsetMs, int64_t rtcMs, int64_t delayMs) {
+  if (llabs(offsetMs - (int64_t)appliedOffsetMs) > CLOCK_SYNC_STEP_THRESHOLD_MS) {
+    haveDriftRef = false;
+    stepClock(offsetMs);
+    synced = true;
+    return;
+  }
+
+  if (!haveDriftRef) {
+    haveDriftRef = true;
+    driftRefOffsetMs = offsetMs;
+    driftRefRtcMs = rtcMs;
+  } else if (rtcMs - driftRefRtcMs >= (int64_t)CLOCK_SYNC_MIN_DRIFT_INTERVAL_MS) {
+    float slope = (float)(offsetMs - driftRefOffsetMs) / (float)(rtcMs - driftRefRtcMs) * 1e6f;
+    driftPpm = haveDrift ? 0.75f * driftPpm + 0.25f * slope : slope;
+    driftPpm = constrain(driftPpm, -MAX_DRIFT_PPM, MAX_DRIFT_PPM);
+    haveDrift = true;
+    driftRefOffsetMs = offsetMs;
+    driftRefRtcMs = rtcMs;
+  }
+
+  lastOffsetMs = offsetMs;
+  lastSampleRtcMs = rtcMs;
+  synced = true;
+  logEvent("Clock sync: offset %ld ms, delay %ld ms, drift %.2f ppm",
+           (long)offsetMs, (long)delayMs, driftPpm);
+}
+
+FLASHMEM static void syncCommand(Print& out, int argc, char* argv[]) {
+  pendingSeq++;
+  pending = true;
+  pendingT1 = rtcMillis();
+  out.printf("TSYNC %u %lld\n", pendingSeq, (long long)pendingT1);
+}
+
+FLASHMEM static void tsyncCommand(Print& out, int argc, char* argv[]) {
+  int64_t t4 = rtcMillis();
+  if (argc < 4) {
+    out.println("ERR usage: $tsync <seq> <t2> <t3>");
+    return;
+  }
+  if (!pending || strtoul(argv[1], nullptr, 10) != pendingSeq) {
+    out.println("ERR no matching sync");
+    return;
+  }
+  pending = false;
+
+  int64_t t1 = pendingT1;
+  int64_t t2 = strtoll(argv[2], nullptr, 10);
+  int64_t t3 = strtoll(argv[3], nullptr, 10);
+  int64_t delay = (t4 - t1) - (t3 - t2);
+  int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+  if (delay < 0 || isQueuedSample(delay)) {
+    out.printf("ERR rejected delay %ld ms\n", (long)delay);
+    return;
+  }
+  acceptSample(offset, t4, delay);
+  out.printf("OK offset=%ld delay=%ld\n", (long)offset, (long)delay);
+}
+
+FLASHMEM static void clockCommand(Print& out, int argc, char* argv[]) {
+  Timestamp ts = syncedNow();
+  out.printf("%lld synced=%d applied=%.1fms target=%.1fms drift=%.2fppm\n",
+             (long long)timestampMillis(ts), synced, appliedOffsetMs,
+             targetOffsetMs(rtcMillis()), driftPpm);
+}
+
+FLASHMEM void registerClockSyncCommands() {
+  registerCommand("sync", syncCommand, "start a clock sync exchange");
+  registerCommand("tsync", tsyncCommand, "tsync <seq> <t2> <t3>: lander reply to TSYNC");
+  registerCommand("clock", clockCommand, "show synced time and offset");
+}
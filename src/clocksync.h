@@ -0,0 +1,39 @@
+/**
+ * @brief Lander-driven clock synchronisation
+ *
+ * The lander starts an exchange with "$sync". We answer "TSYNC <seq> <t1>"
+ * and the lander replies "$tsync <seq> <t2> <t3>" with its receive and send
+ * times in epoch milliseconds. With our own send (t1) and receive (t4) times
+ * this gives the NTP offset and round-trip delay estimates.
+ *
+ * The RTC itself is left alone: a software offset is slewed towards the
+ * lander's time at a bounded rate, so synced seconds never jump and
+ * interval-based schedule edges are neither skipped nor doubled. The drift
+ * rate between our RTC and the lander is tracked so the offset keeps
+ * following the lander between exchanges. Only gross errors (first sync
+ * after a battery swap, say) step the RTC.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "timebase.h"
+
+// Maximum rate the applied offset may change, in parts per million
+const float CLOCK_SYNC_MAX_SLEW_PPM = 500;
+// Offsets larger than this are stepped rather than slewed
+const int64_t CLOCK_SYNC_STEP_THRESHOLD_MS = 2000;
+// Samples with a round trip more than this factor over the recent minimum
+// were queued somewhere on the link and are discarded
+const float CLOCK_SYNC_DELAY_REJECT_FACTOR = 2.0;
+// Minimum spacing between samples used for drift estimation
+const uint32_t CLOCK_SYNC_MIN_DRIFT_INTERVAL_MS = 60000;
+
+// Advance the slew; call on every loop pass
+void clockSyncUpdate();
+// RTC time corrected towards the lander's clock
+Timestamp syncedNow();
+float clockSyncDriftPpm();
+
+// Registers sync, tsync and clock
+void registerClockSyncCommands();
@@ -0,0 +1,117 @@
+#include "commands.h"
+#include "config.h"
+#include "sysinfo.h"
+#include "metrics.h"
+#include "trace.h"
+
+struct CommandEntry {
+  const char* name;
+  CommandHandler handler;
+  const char* help;
+};
+
+static CommandEntry commands[COMMAND_MAX_HANDLERS];
+static size_t numCommands = 0;
+
+FLASHMEM bool registerCommand(const char* name, CommandHandler handler, const char* help) {
+  if (numCommands >= COMMAND_MAX_HANDLERS) return false;
+  commands[numCommands++] = {name, handler, help};
+  return true;
+}
+
+static void dispatch(Print& out, char* line) {
+  char* argv[COMMAND_MAX_ARGS];
+  int argc = 0;
+  char* save = nullptr;
+  for (char* tok = strtok_r(line, " \t", &save); tok && argc < (int)COMMAND_MAX_ARGS;
+       tok = strtok_r(nullptr, " \t", &save)) {
+    argv[argc++] = tok;
+  }
+  if (argc == 0) return;
+
+  for (size_t i = 0; i < numCommands; i++) {
+    if (strcmp(commands[i].name, argv[0]) == 0) {
+      metricInc(COUNTER_COMMANDS);
+      TRACE_SCOPE(TRACE_COMMAND, i);
+      commands[i].handler(out, argc, argv);
+      return;
+    }
+  }
+  out.printf("ERR unknown command %s\n", argv[0]);
+}
+
+HOTPATH void pollCommands(CommandPort& port) {
+  while (port.stream.available()) {
+    char c = port.stream.read();
+
+    if (!port.inCommand) {
+      if (c == COMMAND_PREFIX) {
+        port.inCommand = true;
+        port.length = 0;
+        port.overflow = false;
+      } else if (port.onByte) {
+        port.onByte(c);
+      }
+      continue;
+    }
+
+    if (c == '\r' || c == '\n') {
+      port.inCommand = false;
+      if (port.overflow) {
+        port.out.println("ERR line too long");
+        continue;
+      }
+      port.line[port.length] = '\0';
+      dispatch(port.out, port.line);
+    } else if (port.length < COMMAND_LINE_LENGTH - 1) {
+      port.line[port.length++] = c;
+    } else {
+      port.overflow = true;
+    }
+  }
+}
+
+FLASHMEM static void helpCommand(Print& out, int argc, char* argv[]) {
+  for (size_t i = 0; i < numCommands; i++) {
+    out.printf("$%s - %s\n", commands[i].name, commands[i].help);
+  }
+}
+
+FLASHMEM static void getCommand(Print& out, int argc, char* argv[]) {
+  if (argc < 2) {
+    printConfig(out);
+    return;
+  }
+  long value;
+  if (getConfigParam(argv[1], value)) {
+    out.printf("%s=%ld\n", argv[1], value);
+  } else {
+    out.printf("ERR unknown parameter %s\n", argv[1]);
+  }
+}
+
+FLASHMEM static void setCommand(Print& out, int argc, char* argv[]) {
+  if (argc < 3) {
+    out.println("ERR usage: $set <name> <value>");
+    return;
+  }
+  char* end;
+  long value = strtol(argv[2], &end, 10);
+  if (*end != '\0' || !setConfigParam(argv[1], value)) {
+    out.printf("ERR rejected %s=%s\n", argv[1], argv[2]);
+    return;
+  }
+  out.printf("OK %s=%ld\n", argv[1], value);
+}
+
+FLASHMEM static void defaultsCommand(Print& out, int argc, char* argv[]) {
+  resetConfig();
+  printConfig(out);
+}
+
+FLASHMEM void registerCoreCommands() {
+  registerCommand("help", helpCommand, "list commands");
+  registerCommand("get", getCommand, "get [name]: show config parameters");
+  registerCommand("set", setCommand, "set <name> <value>: change and save a parameter");
+  registerCommand("defaults", defaultsCommand, "restore compiled-in defaults");
+}
@@ -0,0 +1,41 @@
+/**
+ * @brief Line-based command interface
+ *
+ * Commands are lines starting with '$', e.g. "$set log_interval 30", accepted
+ * on both USB `Serial` and `LANDER_SERIAL`. Bytes outside a '$' line are passed
+ * through to the port's byte handler so the single-character lander valve
+ * commands ('t', 'b') keep working unchanged. Replies go back to the port the
+ * command arrived on, or to its own reply stream if it has one.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const char COMMAND_PREFIX = '$';
+const size_t COMMAND_LINE_LENGTH = 64;
+const size_t COMMAND_MAX_ARGS = 6;
+const size_t COMMAND_MAX_HANDLERS = 32;
+
+// argv[0] is the command name
+typedef void (*CommandHandler)(Print& out, int argc, char* argv[]);
+typedef void (*ByteHandler)(char c);
+
+struct CommandPort {
+  Stream& stream;
+  ByteHandler onByte; // may be null
+  Print& out;         // replies
+  char line[COMMAND_LINE_LENGTH];
+  uint8_t length;
+  bool inCommand;
+  bool overflow;
+
+  CommandPort(Stream& s, ByteHandler handler = nullptr, Print* replies = nullptr)
+    : stream(s), onByte(handler), out(replies ? *replies : s), length(0), inCommand(false), overflow(false) {}
+};
+
+bool registerCommand(const char* name, CommandHandler handler, const char* help);
+void pollCommands(CommandPort& port);
+
+// Registers help, get, set and defaults
+void registerCoreCommands();
@@ -0,0 +1,116 @@
+#include "config.h"
+#include "crc.h"
+#include <EEPROM.h>
+
+Config config;
+
+struct ConfigParam {
+  const char* name;
+  int32_t Config::*field;
+  int32_t minValue;
+  int32_t maxValue;
+};
+
+static const ConfigParam params[] = {
+  {"log_interval", &Config::logInterval, 1, 86400},
+  // isIntervalTime() works within the hour, so longer intervals never fire
+  {"valve_change_interval", &Config::valveChangeInterval, 1, 3600},
+  {"threshold_voltage", &Config::thresholdVoltage, 0, 36000},
+  {"bottom_us", &Config::bottomMicroseconds, 500, 2500},
+  {"top_us", &Config::topMicroseconds, 500, 2500},
+  {"home_us", &Config::homeMicroseconds, 500, 2500},
+  {"leds_enabled", &Config::ledsEnabled, 0, 1},
+  {"sample_rate_hz", &Config::sampleRateHz, 10, 2000},
+  {"battery_mah", &Config::batteryCapacityMah, 0, 1000000},
+  {"servo_detach", &Config::servoDetach, 0, 1},
+  {"sd_power_gate", &Config::sdPowerGate, 0, 1},
+};
+static const size_t NUM_PARAMS = sizeof(params) / sizeof(params[0]);
+
+static uint16_t configCrc(const Config& c) {
+  return crc16(&c, offsetof(Config, crc));
+}
+
+static void setDefaults(Config& c) {
+  memset(&c, 0, sizeof(c));
+  c.version = CONFIG_VERSION;
+  c.logInterval = LOG_INTERVAL;
+  c.valveChangeInterval = VALVE_CHANGE_INTERVAL;
+  c.thresholdVoltage = THRESHOLD_VOLTAGE;
+  c.bottomMicroseconds = BOTTOM_MICROSECONDS;
+  c.topMicroseconds = TOP_MICROSECONDS;
+  c.homeMicroseconds = HOME_MICROSECONDS;
+  c.ledsEnabled = 1;
+  c.sampleRateHz = SAMPLE_RATE_HZ;
+  c.batteryCapacityMah = BATTERY_MAH;
+  c.servoDetach = SERVO_DETACH;
+  c.sdPowerGate = SD_POWER_GATE;
+}
+
+static bool isValid(const Config& c) {
+  for (size_t i = 0; i < NUM_PARAMS; i++) {
+    int32_t v = c.*params[i].field;
+    if (v < params[i].minValue || v > params[i].maxValue) return false;
+  }
+  // Low power homing only makes sense if home sits between the end stops
+  return c.bottomMicroseconds < c.homeMicroseconds && c.homeMicroseconds < c.topMicroseconds;
+}
+
+static const ConfigParam* findParam(const char* name) {
+  for (size_t i = 0; i < NUM_PARAMS; i++) {
+    if (strcmp(params[i].name, name) == 0) return &params[i];
+  }
+  return nullptr;
+}
+
+FLASHMEM bool loadConfig() {
+  Config stored;
+  EEPROM.get(CONFIG_EEPROM_ADDRESS, stored);
+  if (stored.version == CONFIG_VERSION && stored.crc == configCrc(stored) && isValid(stored)) {
+    config = stored;
+    return true;
+  }
+  setDefaults(config);
+  return false;
+}
+
+void saveConfig() {
+  config.version = CONFIG_VERSION;
+  config.crc = configCrc(config);
+  EEPROM.put(CONFIG_EEPROM_ADDRESS, config); // only rewrites bytes that changed
+}
+
+void resetConfig() {
+  Config previous = config;
+  setDefaults(config);
+  saveConfig();
+  onConfigChanged(previous);
+}
+
+bool getConfigParam(const char* name, long& value) {
+  const ConfigParam* p = findParam(name);
+  if (!p) return false;
+  value = config.*p->field;
+  return true;
+}
+
+bool setConfigParam(const char* name, long value) {
+  const ConfigParam* p = findParam(name);
+  if (!p || value < p->minValue || value > p->maxValue) return false;
+
+  Config candidate = config;
+  candidate.*p->field = value;
+  if (!isValid(candidate)) return false;
+
+  Config previous = config;
+  config = candidate;
+  saveConfig();
+  onConfigChanged(previous);
+  return true;
+}
+
+FLASHMEM void printConfig(Print& out) {
+  for (size_t i = 0; i < NUM_PARAMS; i++) {
+    out.printf("%s=%ld\n", params[i].name, (long)(config.*params[i].field));
+  }
+}
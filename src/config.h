@@ -0,0 +1,69 @@
+/**
+ * @brief Runtime configuration store
+ *
+ * Field-adjustable parameters live in a versioned, CRC-protected block in
+ * EEPROM. The block is read once at boot into the cached `config` struct;
+ * everything else reads the struct, so the hot path never touches EEPROM.
+ * The compile-time constants below are the defaults used when the stored
+ * block is missing, corrupt or from an older layout.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// Default clock time valve change interval in seconds
+const unsigned long VALVE_CHANGE_INTERVAL = 7.5 * 60; // 7:30 minutes
+
+const unsigned long LOG_INTERVAL = 10; // Default logging interval in seconds
+const int BOTTOM_MICROSECONDS = 1205;  // 0 degrees
+const int TOP_MICROSECONDS = 1795; // 179 degrees
+const int HOME_MICROSECONDS = 1500; // 89 degrees
+const int SAMPLE_RATE_HZ = 1000; // INA260 current sampling rate
+//Threshold voltage = too low power!!
+const int THRESHOLD_VOLTAGE = 10000; //in mV
+// Battery capacity for state of charge; 0 turns the power tiers off until
+// the pack is set with $set battery_mah
+const int BATTERY_MAH = 0;
+// Stop servo pulses between moves; the valve must hold position unpowered
+const int SERVO_DETACH = 0;
+// Power the SD card down between batched flushes (see sdpower.h)
+const int SD_POWER_GATE = 0;
+
+// Bump whenever the layout of Config changes; older blocks fall back to defaults
+const uint16_t CONFIG_VERSION = 6;
+// EEPROM address 0 holds the last valve position, so the block starts after it
+const int CONFIG_EEPROM_ADDRESS = 16;
+
+struct Config {
+  uint16_t version;
+  int32_t logInterval;         // seconds
+  int32_t valveChangeInterval; // seconds
+  int32_t thresholdVoltage;    // mV
+  int32_t bottomMicroseconds;
+  int32_t topMicroseconds;
+  int32_t homeMicroseconds;
+  int32_t ledsEnabled;         // 0 = dark deployment mode
+  int32_t sampleRateHz;
+  int32_t batteryCapacityMah;  // 0 = no power tiers
+  int32_t servoDetach;         // 1 = detach the servo between moves
+  int32_t sdPowerGate;         // 1 = power the SD card down between flushes
+  uint16_t crc;                // over every byte before this field
+};
+
+extern Config config;
+
+// Load the block from EEPROM, falling back to defaults. Returns false if
+// defaults had to be used.
+bool loadConfig();
+void saveConfig();
+void resetConfig();
+
+// Named parameter access for the command interface. setConfigParam validates
+// the value, applies it live, persists the block and calls the change hook.
+bool getConfigParam(const char* name, long& value);
+bool setConfigParam(const char* name, long value);
+void printConfig(Print& out);
+
+// Called after the live config changes, with the values it replaced
+void onConfigChanged(const Config& previous);
@@ -0,0 +1,13 @@
+#include "crc.h"
+
+uint16_t crc16(const void* data, size_t length, uint16_t seed) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint16_t crc = seed;
+  while (length--) {
+    crc ^= (uint16_t)(*p++) << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
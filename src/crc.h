@@ -0,0 +1,11 @@
+/**
+ * @brief CRC helpers shared by the persistent stores and binary frames
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF). Pass a previous result as
+// seed to extend a CRC across several buffers.
+uint16_t crc16(const void* data, size_t length, uint16_t seed = 0xFFFF);
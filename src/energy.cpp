@@ -0,0 +1,230 @@
+#include "energy.h"
+#include "commands.h"
+#include "logging.h"
+#include "sysinfo.h"
+
+const char* const energyActivityNames[ENERGY_ACTIVITY_COUNT] = {"sd", "servo_move", "servo_hold", "leds", "i2c"};
+
+static const uint8_t PATTERNS = 1 << ENERGY_ACTIVITY_COUNT;
+static const uint8_t TERMS = 1 + ENERGY_ACTIVITY_COUNT; // intercept first
+// Samples an activity needs both on and off before it can be separated
+static const uint64_t ENERGY_MIN_SAMPLES = 100;
+static const uint64_t ENERGY_MIN_TOTAL = 1000;
+
+static volatile uint8_t activityBits = 0;
+static volatile uint32_t moveUntil = 0;
+
+// Sufficient statistics: sample count and current sum per activity pattern
+static uint64_t patternCount[PATTERNS] = {};
+static int64_t patternSum[PATTERNS] = {}; // mA
+static int64_t voltageSum = 0;           // mV, weighted by samples
+static unsigned long lastReport = 0;
+
+// "$energy record" output
+static Print* recordOut = nullptr;
+static uint32_t recordLeft = 0;
+
+struct EnergyFit {
+  bool ok;
+  uint64_t samples;
+  double voltage;     // mV
+  double meanCurrent; // mA
+  double base;        // mA
+  double cost[ENERGY_ACTIVITY_COUNT];  // mA per unit of x
+  double duty[ENERGY_ACTIVITY_COUNT];  // mean x
+  int8_t state[ENERGY_ACTIVITY_COUNT]; // 1 fitted, 0 not seen, -1 always on
+};
+
+void energySet(EnergyActivity activity, bool on) {
+  if (on) {
+    __atomic_fetch_or(&activityBits, (uint8_t)(1 << activity), __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_and(&activityBits, (uint8_t)~(1 << activity), __ATOMIC_RELAXED);
+  }
+}
+
+void energyServoMoved() {
+  moveUntil = millis() + ENERGY_SERVO_MOVE_MS;
+}
+
+HOTPATH uint8_t energyActivity() {
+  uint8_t bits = activityBits;
+  if ((int32_t)(moveUntil - millis()) > 0) bits |= 1 << ENERGY_SERVO_MOVE;
+  return bits;
+}
+
+// Regressor k (0 is the intercept) for an activity pattern
+static double regressor(uint8_t pattern, uint8_t k) {
+  if (k == 0) return 1;
+  uint8_t bit = (pattern >> (k - 1)) & 1;
+  if (k - 1 == ENERGY_I2C_VOLTAGE) return ENERGY_I2C_BASE_TRANSACTIONS + bit;
+  return bit;
+}
+
+HOTPATH void energyAddBlock(const SampleBlock& block) {
+  for (uint16_t i = 0; i < block.count; i++) {
+    uint8_t pattern = block.activity[i] & (PATTERNS - 1);
+    patternCount[pattern]++;
+    patternSum[pattern] += block.current[i];
+  }
+  voltageSum += (int64_t)samplerLatestVoltage() * block.count;
+
+  if (recordLeft && recordOut) {
+    uint16_t n = min((uint32_t)block.count, recordLeft);
+    for (uint16_t i = 0; i < n; i++) {
+      recordOut->printf("E,%d,%u\n", block.current[i], block.activity[i]);
+    }
+    recordLeft -= n;
+    if (!recordLeft) recordOut->println("E,end");
+  }
+}
+
+// Solve a small dense system in place; false if it is singular
+static bool solve(double a[TERMS][TERMS], double b[TERMS], uint8_t n) {
+  for (uint8_t col = 0; col < n; col++) {
+    uint8_t pivot = col;
+    for (uint8_t row = col + 1; row < n; row++) {
+      if (fabs(a[row][col]) > fabs(a[pivot][col])) pivot = row;
+    }
+    if (fabs(a[pivot][col]) < 1e-12) return false;
+    for (uint8_t k = 0; k < n; k++) {
+      double t = a[col][k];
+      a[col][k] = a[pivot][k];
+      a[pivot][k] = t;
+    }
+    double t = b[col];
+    b[col] = b[pivot];
+    b[pivot] = t;
+    for (uint8_t row = 0; row < n; row++) {
+      if (row == col) continue;
+      double f = a[row][col] / a[col][col];
+      for (uint8_t k = col; k < n; k++) a[row][k] -= f * a[col][k];
+      b[row] -= f * b[col];
+    }
+  }
+  for (uint8_t k = 0; k < n; k++) b[k] /= a[k][k];
+  return true;
+}
+
+FLASHMEM static EnergyFit fit() {
+  EnergyFit result = {};
+  uint64_t on[ENERGY_ACTIVITY_COUNT] = {};
+  int64_t currentSum = 0;
+  for (uint8_t p = 0; p < PATTERNS; p++) {
+    result.samples += patternCount[p];
+    currentSum += patternSum[p];
+    for (uint8_t a = 0; a < ENERGY_ACTIVITY_COUNT; a++) {
+      if (p & (1 << a)) on[a] += patternCount[p];
+    }
+  }
+  if (result.samples < ENERGY_MIN_TOTAL) return result;
+  result.voltage = (double)voltageSum / result.samples;
+  result.meanCurrent = (double)currentSum / result.samples;
+
+  // Only activities seen both on and off enter the fit
+  uint8_t terms[TERMS] = {0};
+  uint8_t n = 1;
+  for (uint8_t a = 0; a < ENERGY_ACTIVITY_COUNT; a++) {
+    result.duty[a] = (double)on[a] / result.samples;
+    if (a == ENERGY_I2C_VOLTAGE) result.duty[a] += ENERGY_I2C_BASE_TRANSACTIONS;
+    if (on[a] < ENERGY_MIN_SAMPLES) {
+      result.state[a] = 0;
+    } else if (result.samples - on[a] < ENERGY_MIN_SAMPLES) {
+      result.state[a] = -1;
+    } else {
+      result.state[a] = 1;
+      terms[n++] = a + 1;
+    }
+  }
+
+  double xtx[TERMS][TERMS] = {};
+  double xty[TERMS] = {};
+  for (uint8_t p = 0; p < PATTERNS; p++) {
+    if (!patternCount[p]) continue;
+    for (uint8_t i = 0; i < n; i++) {
+      double xi = regressor(p, terms[i]);
+      xty[i] += xi * patternSum[p];
+      for (uint8_t j = 0; j < n; j++) xtx[i][j] += xi * regressor(p, terms[j]) * patternCount[p];
+    }
+  }
+  if (!solve(xtx, xty, n)) return result;
+
+  result.base = xty[0];
+  for (uint8_t i = 1; i < n; i++) result.cost[terms[i] - 1] = xty[i];
+  result.ok = true;
+  return result;
+}
+
+static double joulesPerDay(double mA, double mV, double duty) {
+  return mA / 1000.0 * mV / 1000.0 * duty * 86400.0;
+}
+
+FLASHMEM static void printFit(Print& out, const EnergyFit& f) {
+  if (!f.ok) {
+    out.printf("not enough samples (%llu)\n", (unsigned long long)f.samples);
+    return;
+  }
+  double total = joulesPerDay(f.base, f.voltage, 1);
+  out.printf("samples=%llu voltage=%.0fmV mean=%.1fmA measured=%.0fJ/day\n", (unsigned long long)f.samples,
+             f.voltage, f.meanCurrent, joulesPerDay(f.meanCurrent, f.voltage, 1));
+  for (uint8_t a = 0; a < ENERGY_ACTIVITY_COUNT; a++) {
+    out.printf("%-10s ", energyActivityNames[a]);
+    if (f.state[a] == 0) {
+      out.println("not seen");
+    } else if (f.state[a] < 0) {
+      out.println("always on, in base");
+    } else {
+      double joules = joulesPerDay(f.cost[a], f.voltage, f.duty[a]);
+      total += joules;
+      out.printf("cost=%.1fmA duty=%.4f %.1fJ/day\n", f.cost[a], f.duty[a], joules);
+    }
+  }
+  out.printf("%-10s %.1fmA %.0fJ/day\n", "base", f.base, joulesPerDay(f.base, f.voltage, 1));
+  out.printf("%-10s %.0fJ/day\n", "modelled", total);
+}
+
+FLASHMEM void energyReport() {
+  unsigned long now = millis() / 1000;
+  if (now - lastReport < ENERGY_REPORT_INTERVAL) return;
+  lastReport = now;
+
+  EnergyFit f = fit();
+  if (!f.ok) return;
+  char text[128]; // logEvent's message limit
+  size_t len = snprintf(text, sizeof(text), "Energy J/day: measured=%.0f base=%.0f",
+                        joulesPerDay(f.meanCurrent, f.voltage, 1), joulesPerDay(f.base, f.voltage, 1));
+  for (uint8_t a = 0; a < ENERGY_ACTIVITY_COUNT && len < sizeof(text); a++) {
+    if (f.state[a] > 0) {
+      len += snprintf(text + len, sizeof(text) - len, " %s=%.1f", energyActivityNames[a],
+                      joulesPerDay(f.cost[a], f.voltage, f.duty[a]));
+    } else {
+      len += snprintf(text + len, sizeof(text) - len, " %s=-", energyActivityNames[a]);
+    }
+  }
+  logEvent("%s", text);
+}
+
+FLASHMEM static void energyCommand(Print& out, int argc, char* argv[]) {
+  const char* action = argc > 1 ? argv[1] : "";
+  if (strcmp(action, "reset") == 0) {
+    memset(patternCount, 0, sizeof(patternCount));
+    memset(patternSum, 0, sizeof(patternSum));
+    voltageSum = 0;
+    out.println("OK");
+  } else if (strcmp(action, "record") == 0) {
+    if (argc < 3) {
+      out.println("ERR usage: energy record <samples>");
+      return;
+    }
+    recordLeft = 0;
+    recordOut = &out;
+    out.printf("E,voltage_mv,%d\n", samplerLatestVoltage());
+    recordLeft = strtoul(argv[2], nullptr, 10);
+  } else {
+    printFit(out, fit());
+  }
+}
+
+FLASHMEM void registerEnergyCommands() {
+  registerCommand("energy", energyCommand, "energy [reset|record <n>]: per-subsystem energy attribution");
+}
@@ -0,0 +1,66 @@
+/**
+ * @brief Per-subsystem energy attribution
+ *
+ * Every current sample carries a byte of activity bits (SD busy, servo
+ * moving, servo holding, LEDs lit, extra I2C transaction) taken when it was
+ * read. The model is
+ *
+ *   current = base + sum over k of cost_k * x_k
+ *
+ * where x_k is 1 while activity k is on (for I2C, the number of INA260
+ * transactions in the sample period). Because the regressors are small
+ * integers, the sufficient statistics are just a count and a current sum
+ * per distinct activity pattern, so streaming them costs two adds per
+ * sample. "$energy" solves the least-squares fit and reports each
+ * subsystem's cost, duty and joules per day at the measured bus voltage.
+ *
+ * An activity that was never seen, or was always on, can't be separated
+ * from the baseline. It is reported that way rather than fitted.
+ *
+ * "$energy record <n>" prints n raw samples as "E,<mA>,<bits>" lines
+ * (use USB; the lander link is too slow at 1 kHz). tools/energy_fit.py
+ * fits a recording the same way for an offline cross-check.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "sampler.h"
+
+enum EnergyActivity : uint8_t {
+  ENERGY_SD,          // SD card read or write in progress
+  ENERGY_SERVO_MOVE,  // within ENERGY_SERVO_MOVE_MS of a new position
+  ENERGY_SERVO_HOLD,  // servo attached and driven
+  ENERGY_LEDS,        // any LED lit
+  ENERGY_I2C_VOLTAGE, // the sample period included a bus voltage read
+  ENERGY_ACTIVITY_COUNT
+};
+
+// Servo travel time from one end to the other
+const uint32_t ENERGY_SERVO_MOVE_MS = 1000;
+// Each sample period has two INA260 transactions, plus one with a voltage read
+const uint8_t ENERGY_I2C_BASE_TRANSACTIONS = 2;
+const unsigned long ENERGY_REPORT_INTERVAL = 21600; // seconds
+
+extern const char* const energyActivityNames[ENERGY_ACTIVITY_COUNT];
+
+void energySet(EnergyActivity activity, bool on);
+
+// On for the lifetime of the scope
+struct EnergyScope {
+  EnergyActivity activity;
+  EnergyScope(EnergyActivity a) : activity(a) { energySet(activity, true); }
+  ~EnergyScope() { energySet(activity, false); }
+};
+// Open the servo move window
+void energyServoMoved();
+// Activity bits for the sample being read; called from the sampler ISR
+uint8_t energyActivity();
+
+// Accumulate a block of samples
+void energyAddBlock(const SampleBlock& block);
+// Log the attribution as an event when it is due; call once a second
+void energyReport();
+
+// Registers energy
+void registerEnergyCommands();
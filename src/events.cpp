@@ -0,0 +1,111 @@
+#include "events.h"
+#include "commands.h"
+#include "metrics.h"
+#include "spsc.h"
+#include "sysinfo.h"
+#include "trace.h"
+
+const char* const eventTypeNames[EVENT_TYPE_COUNT] = {"tick", "second", "power_alert"};
+
+// SNVS high power RTC: seconds << 15 | 32.768 kHz ticks
+static const uint32_t RTC_TICK_BITS = 15;
+static const uint32_t CYCLES_PER_RTC_TICK = F_CPU_ACTUAL >> RTC_TICK_BITS;
+
+// One ring per producer
+static SpscQueue<Event, 32> timerQueue;
+static SpscQueue<Event, 8> alertQueue;
+
+static EventHandler handlers[EVENT_TYPE_COUNT];
+static uint32_t handled[EVENT_TYPE_COUNT];
+static IntervalTimer eventTimer;
+
+template <typename Q>
+HOTPATH static void post(Q& queue, const Event& event) {
+  if (!queue.push(event)) metricInc(COUNTER_EVENT_DROPS);
+}
+
+HOTPATH static void eventTick() {
+  TRACE_SCOPE(TRACE_ISR_EVENTS, 0);
+  static uint32_t lastSecond = 0;
+  uint32_t cycles = ARM_DWT_CYCCNT;
+
+  // Both halves of the counter, read until they agree
+  uint32_t high, low;
+  do {
+    high = SNVS_HPRTCMR;
+    low = SNVS_HPRTCLR;
+  } while (high != SNVS_HPRTCMR || low != SNVS_HPRTCLR);
+  uint32_t rtc = high << (32 - RTC_TICK_BITS) | low >> RTC_TICK_BITS;
+  if (rtc != lastSecond) {
+    lastSecond = rtc;
+    uint32_t sinceEdge = low & ((1 << RTC_TICK_BITS) - 1);
+    post(timerQueue, {EVENT_SECOND, cycles - sinceEdge * CYCLES_PER_RTC_TICK, rtc});
+  }
+  post(timerQueue, {EVENT_TICK, cycles, 0});
+}
+
+#ifdef INA260_ALERT_PIN
+HOTPATH static void powerAlert() {
+  TRACE_INSTANT(TRACE_ISR_ALERT, 0);
+  post(alertQueue, {EVENT_POWER_ALERT, ARM_DWT_CYCCNT, 0});
+}
+#endif
+
+FLASHMEM void onEvent(EventType type, EventHandler handler) {
+  handlers[type] = handler;
+}
+
+FLASHMEM void eventsBegin() {
+#ifdef INA260_ALERT_PIN
+  pinMode(INA260_ALERT_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(INA260_ALERT_PIN), powerAlert, FALLING);
+#endif
+  eventTimer.begin(eventTick, EVENT_TICK_MS * 1000);
+}
+
+HOTPATH static void dispatch(const Event& event) {
+  TRACE_SCOPE(TRACE_EVENT, event.type);
+  handled[event.type]++;
+  if (handlers[event.type]) handlers[event.type](event);
+}
+
+HOTPATH size_t dispatchEvents() {
+  size_t count = 0;
+  Event event;
+  // Alerts first: they are the urgent ones
+  while (alertQueue.pop(event)) {
+    dispatch(event);
+    count++;
+  }
+  while (timerQueue.pop(event)) {
+    dispatch(event);
+    count++;
+  }
+  return count;
+}
+
+HOTPATH void waitForEvent() {
+  // An interrupt landing between the check and WFI costs at most one tick
+  // of latency, since the next event timer interrupt wakes us anyway
+#ifndef EVENTS_NO_WFI
+  if (timerQueue.empty() && alertQueue.empty()) {
+    TRACE_BEGIN(TRACE_WAIT, 0);
+    asm volatile("wfi");
+    TRACE_END(TRACE_WAIT, 0);
+  }
+#endif
+}
+
+FLASHMEM static void eventsCommand(Print& out, int argc, char* argv[]) {
+  for (int t = 0; t < EVENT_TYPE_COUNT; t++) {
+    out.printf("%s handled=%lu\n", eventTypeNames[t], (unsigned long)handled[t]);
+  }
+  out.printf("timer queue pushed=%lu drops=%lu max_depth=%lu\n", (unsigned long)timerQueue.pushed(),
+             (unsigned long)timerQueue.drops(), (unsigned long)timerQueue.maxDepth());
+  out.printf("alert queue pushed=%lu drops=%lu max_depth=%lu\n", (unsigned long)alertQueue.pushed(),
+             (unsigned long)alertQueue.drops(), (unsigned long)alertQueue.maxDepth());
+}
+
+FLASHMEM void registerEventCommands() {
+  registerCommand("events", eventsCommand, "event counts and queue loss counters");
+}
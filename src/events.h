@@ -0,0 +1,55 @@
+/**
+ * @brief Interrupt-driven event queue
+ *
+ * Interrupts post events into lock-free SPSC rings, one per interrupt
+ * source so each ring has a single producer. The main loop drains them and
+ * dispatches by event type to registered handlers, then sleeps (WFI) until
+ * the next interrupt. Sources:
+ *
+ *   EVENT_TICK         every EVENT_TICK_MS from the event timer
+ *   EVENT_SECOND       RTC second edge, found by the tick that crosses it;
+ *                      the latched cycle count is moved back by the RTC's
+ *                      32.768 kHz count since the edge, so it is exact to
+ *                      about 30 us without waking the core more often
+ *   EVENT_POWER_ALERT  INA260 under-voltage alert pin (if INA260_ALERT_PIN
+ *                      is defined)
+ *
+ * A push onto a full ring is dropped and counted in the event_drops metric.
+ *
+ * UART and USB receive interrupts have no hook in the Teensy core, but they
+ * still wake the loop from WFI, which then polls the serial ports. The CCM
+ * is left in RUN mode, so WFI only idles the core; build with
+ * -DEVENTS_NO_WFI to spin instead (e.g. when debugging).
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint32_t EVENT_TICK_MS = 10;
+
+enum EventType : uint8_t {
+  EVENT_TICK,
+  EVENT_SECOND,
+  EVENT_POWER_ALERT,
+  EVENT_TYPE_COUNT
+};
+
+struct Event {
+  EventType type;
+  uint32_t cycles; // ARM_DWT_CYCCNT when posted
+  uint32_t data;   // EVENT_SECOND: RTC seconds
+};
+
+typedef void (*EventHandler)(const Event& event);
+
+void onEvent(EventType type, EventHandler handler);
+// Start the event timer and attach the alert pin
+void eventsBegin();
+// Drain all queues and dispatch; returns the number of events handled
+size_t dispatchEvents();
+// Sleep until the next interrupt unless events are already waiting
+void waitForEvent();
+
+// Registers events
+void registerEventCommands();
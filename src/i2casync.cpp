@@ -0,0 +1,72 @@
+#include "i2casync.h"
+#include "sysinfo.h"
+
+const uint32_t I2C_FAULTS = LPI2C_MSR_NDF | LPI2C_MSR_ALF | LPI2C_MSR_FEF | LPI2C_MSR_PLTF;
+const uint8_t I2C_TX_FIFO = 4;
+
+static const uint16_t* commands = nullptr;
+static uint8_t commandCount = 0;
+static uint8_t sent = 0;
+static uint8_t rx[I2C_ASYNC_MAX_RX];
+static uint8_t rxExpected = 0;
+static uint8_t received = 0;
+static I2cDone doneHandler = nullptr;
+static volatile bool busy = false;
+
+HOTPATH static void finish(bool ok) {
+  LPI2C1_MIER = 0;
+  busy = false;
+  doneHandler(ok, rx, received);
+}
+
+HOTPATH static void lpi2cIsr() {
+  uint32_t status = LPI2C1_MSR;
+  if (status & I2C_FAULTS) {
+    // Drop whatever is queued and release the bus, as Wire does on a NACK
+    LPI2C1_MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;
+    LPI2C1_MSR = status & (I2C_FAULTS | LPI2C_MSR_SDF);
+    if (LPI2C1_MSR & LPI2C_MSR_MBF) LPI2C1_MTDR = i2cStop();
+    finish(false);
+    return;
+  }
+  while (received < rxExpected) {
+    uint32_t data = LPI2C1_MRDR;
+    if (data & LPI2C_MRDR_RXEMPTY) break;
+    rx[received++] = data;
+  }
+  while (sent < commandCount && (LPI2C1_MFSR & 7) < I2C_TX_FIFO) {
+    LPI2C1_MTDR = commands[sent++];
+  }
+  if (sent == commandCount) LPI2C1_MIER &= ~LPI2C_MIER_TDIE;
+  if (status & LPI2C_MSR_SDF) {
+    LPI2C1_MSR = LPI2C_MSR_SDF;
+    if (sent == commandCount) finish(received == rxExpected);
+  }
+}
+
+FLASHMEM void i2cAsyncBegin(uint8_t priority) {
+  LPI2C1_MIER = 0;
+  attachInterruptVector(IRQ_LPI2C1, lpi2cIsr);
+  NVIC_SET_PRIORITY(IRQ_LPI2C1, priority);
+  NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+}
+
+HOTPATH bool i2cAsyncStart(const uint16_t* program, uint8_t count, uint8_t rxCount, I2cDone done) {
+  if (busy || count == 0 || rxCount > I2C_ASYNC_MAX_RX) return false;
+  commands = program;
+  commandCount = count;
+  sent = 0;
+  rxExpected = rxCount;
+  received = 0;
+  doneHandler = done;
+  busy = true;
+  LPI2C1_MSR = I2C_FAULTS | LPI2C_MSR_SDF; // stale flags from Wire's polled use
+  // The transmit FIFO is empty, so TDF raises the interrupt straight away
+  LPI2C1_MIER = LPI2C_MIER_TDIE | LPI2C_MIER_RDIE | LPI2C_MIER_SDIE | LPI2C_MIER_NDIE |
+                LPI2C_MIER_ALIE | LPI2C_MIER_FEIE | LPI2C_MIER_PLTIE;
+  return true;
+}
+
+bool i2cAsyncBusy() {
+  return busy;
+}
@@ -0,0 +1,44 @@
+/**
+ * @brief Interrupt-driven transfers on the Wire port (LPI2C1)
+ *
+ * A transfer is a list of LPI2C master command words (start + address,
+ * transmit, receive, stop) queued from any context. The LPI2C interrupt
+ * feeds them into the 4-word transmit FIFO as it drains and collects the
+ * received bytes, then calls the completion handler from the interrupt. So
+ * the caller never waits on the bus, and neither does any lower priority
+ * interrupt.
+ *
+ * The port stays configured by Wire (pins, clock). Only one transfer runs
+ * at a time, and blocking Wire calls must not overlap one; the sampler
+ * arbitrates that with samplerLockBus().
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t I2C_ASYNC_MAX_RX = 8;
+
+// Command words for a transfer
+inline uint16_t i2cStart(uint8_t address, bool read) {
+  return LPI2C_MTDR_CMD_START | (address << 1) | (read ? 1 : 0);
+}
+inline uint16_t i2cSend(uint8_t data) {
+  return LPI2C_MTDR_CMD_TRANSMIT | data;
+}
+inline uint16_t i2cReceive(uint8_t count) {
+  return LPI2C_MTDR_CMD_RECEIVE | (count - 1);
+}
+inline uint16_t i2cStop() {
+  return LPI2C_MTDR_CMD_STOP;
+}
+
+// Called from the LPI2C interrupt; ok is false after a NACK, arbitration
+// loss or bus fault, in which case rx is incomplete
+typedef void (*I2cDone)(bool ok, const uint8_t* rx, uint8_t rxCount);
+
+void i2cAsyncBegin(uint8_t priority);
+// Start a transfer; commands must stay valid until done runs. False if one
+// is already running.
+bool i2cAsyncStart(const uint16_t* commands, uint8_t count, uint8_t rxCount, I2cDone done);
+bool i2cAsyncBusy();
@@ -0,0 +1,120 @@
+#include "landertx.h"
+#include "commands.h"
+#include "sysinfo.h"
+
+const char* const txClassNames[TX_CLASS_COUNT] = {"ack", "alarm", "telemetry", "bulk"};
+
+struct TxRing {
+  uint8_t* data;
+  uint16_t size;
+  volatile uint16_t head; // next write
+  volatile uint16_t tail; // next read
+  uint32_t bytesSent;
+  uint32_t bytesQueued;
+  uint32_t drops;
+
+  uint16_t used() const { return (uint16_t)(head - tail + size) % size; }
+  uint16_t space() const { return size - 1 - used(); }
+};
+
+static uint8_t ackBuffer[64];
+static uint8_t alarmBuffer[256];
+DMAMEM static uint8_t telemetryBuffer[2048];
+DMAMEM static uint8_t bulkBuffer[8192];
+
+static TxRing rings[TX_CLASS_COUNT] = {
+  {ackBuffer, sizeof(ackBuffer), 0, 0, 0, 0, 0},
+  {alarmBuffer, sizeof(alarmBuffer), 0, 0, 0, 0, 0},
+  {telemetryBuffer, sizeof(telemetryBuffer), 0, 0, 0, 0, 0},
+  {bulkBuffer, sizeof(bulkBuffer), 0, 0, 0, 0, 0},
+};
+
+LanderTxPrint landerReplies(TX_BULK);
+
+static HardwareSerial* serial = nullptr;
+static int uartBufferSize = 0;
+static bool creditMode = false;
+static uint32_t credit = 0;
+
+static bool creditLimited(TxClass c) {
+  return c >= TX_TELEMETRY && creditMode;
+}
+
+FLASHMEM void landerTxBegin(HardwareSerial& port) {
+  serial = &port;
+#ifdef LANDER_CTS_PIN
+  serial->attachCts(LANDER_CTS_PIN);
+#endif
+  // An idle UART reports its whole buffer free
+  uartBufferSize = serial->availableForWrite();
+}
+
+HOTPATH bool landerSend(TxClass c, const void* data, size_t length) {
+  TxRing& r = rings[c];
+  if (length > r.space()) {
+    r.drops++;
+    return false;
+  }
+  const uint8_t* p = (const uint8_t*)data;
+  uint16_t head = r.head;
+  for (size_t i = 0; i < length; i++) {
+    r.data[head] = p[i];
+    head = (head + 1) % r.size;
+  }
+  r.head = head;
+  r.bytesQueued += length;
+  return true;
+}
+
+HOTPATH void landerTxPump() {
+  if (!serial) return;
+  for (int c = 0; c < TX_CLASS_COUNT; c++) {
+    TxRing& r = rings[c];
+    while (r.used()) {
+      int room = serial->availableForWrite();
+      if (c != TX_ACK) {
+        // Keep the UART nearly empty behind anything but an ack
+        int queued = uartBufferSize - room;
+        room = LANDER_TX_LOW_PRIORITY_DEPTH - queued;
+      }
+      if (creditLimited((TxClass)c) && (int)credit < room) room = credit;
+      if (room <= 0) return; // a higher class can't be waiting, so lower ones must wait too
+
+      int n = min((int)r.used(), room);
+      for (int i = 0; i < n; i++) {
+        serial->write(r.data[r.tail]);
+        r.tail = (r.tail + 1) % r.size;
+      }
+      r.bytesSent += n;
+      if (creditLimited((TxClass)c)) credit -= n;
+    }
+  }
+}
+
+FLASHMEM static void txCommand(Print& out, int argc, char* argv[]) {
+  for (int c = 0; c < TX_CLASS_COUNT; c++) {
+    const TxRing& r = rings[c];
+    out.printf("%s queued=%lu sent=%lu pending=%u drops=%lu\n", txClassNames[c],
+               (unsigned long)r.bytesQueued, (unsigned long)r.bytesSent, r.used(),
+               (unsigned long)r.drops);
+  }
+  if (creditMode) out.printf("credit=%lu\n", (unsigned long)credit);
+}
+
+FLASHMEM static void creditCommand(Print& out, int argc, char* argv[]) {
+  if (argc < 2) {
+    out.println("ERR usage: $credit <bytes>|off");
+    return;
+  }
+  if (strcmp(argv[1], "off") == 0) {
+    creditMode = false;
+    return;
+  }
+  creditMode = true;
+  credit += strtoul(argv[1], nullptr, 10);
+}
+
+FLASHMEM void registerLanderTxCommands() {
+  registerCommand("tx", txCommand, "lander transmit queue byte and drop counters");
+  registerCommand("credit", creditCommand, "credit <bytes>|off: grant telemetry/bulk transmit credit");
+}
@@ -0,0 +1,61 @@
+/**
+ * @brief Prioritised, non-blocking transmit queue for LANDER_SERIAL
+ *
+ * Everything the controller sends to the lander goes through here, so a
+ * burst of telemetry or a long dump can never hold up a position ack. Each
+ * priority class (ack > alarm > telemetry > bulk) has its own ring;
+ * landerTxPump() feeds the UART from the highest non-empty class. Lower
+ * classes may only keep a few bytes queued in the UART, which bounds how
+ * long an ack can wait behind them.
+ *
+ * Command replies and dumps on the lander port are written to
+ * landerReplies and go out as bulk. Each write is queued whole or dropped
+ * and counted, so the caller never waits on the UART and a binary frame
+ * is never cut short.
+ *
+ * Flow control: if the lander grants credit with "$credit <bytes>",
+ * telemetry and bulk traffic is limited to the granted bytes; acks and
+ * alarms are never held back. Hardware CTS is used if LANDER_CTS_PIN is
+ * defined.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+enum TxClass : uint8_t {
+  TX_ACK,       // valve position echo
+  TX_ALARM,
+  TX_TELEMETRY,
+  TX_BULK,      // command replies and dumps
+  TX_CLASS_COUNT
+};
+
+// Bytes lower classes may leave in the UART buffer ahead of a possible ack
+const int LANDER_TX_LOW_PRIORITY_DEPTH = 8;
+
+void landerTxBegin(HardwareSerial& port);
+// Queue a whole message, or drop it and count the drop if it doesn't fit
+bool landerSend(TxClass txClass, const void* data, size_t length);
+// Move queued bytes into the UART; call every loop pass and after urgent sends
+void landerTxPump();
+
+// A Print that queues each write as one message of its class
+class LanderTxPrint : public Print {
+public:
+  explicit LanderTxPrint(TxClass txClass) : txClass(txClass) {}
+  using Print::write;
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    return landerSend(txClass, buffer, size) ? size : 0;
+  }
+
+private:
+  TxClass txClass;
+};
+
+// Command reply stream for the lander port
+extern LanderTxPrint landerReplies;
+
+// Registers tx and credit
+void registerLanderTxCommands();
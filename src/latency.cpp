@@ -0,0 +1,98 @@
+#include "latency.h"
+#include "commands.h"
+#include "metrics.h"
+#include "sysinfo.h"
+#include "clocksync.h"
+
+const char* const stageNames[STAGE_COUNT] = {"rx", "seen", "dispatch", "actuate", "ack"};
+
+struct LatencyRecord {
+  char command;
+  time_t when;
+  uint32_t stageMicros[STAGE_COUNT]; // time from RX to each stage
+  LoopTask blockingTask;
+  uint32_t blockingMicros;
+};
+
+static uint32_t stageCycles[STAGE_COUNT];
+static uint32_t lastPollCycles = 0;
+static bool inFlight = false;
+
+static LatencyRecord worst[LATENCY_WORST_COUNT];
+static size_t worstCount = 0;
+
+static uint32_t cyclesToMicros(uint32_t cycles) {
+  return cycles / (F_CPU_ACTUAL / 1000000);
+}
+
+HOTPATH void latencyPoll(bool available) {
+  uint32_t now = ARM_DWT_CYCCNT;
+  // Moves complete within the pass that sees them, so anything still in
+  // flight from an earlier pass was not a move and is dropped
+  inFlight = available;
+  if (available) {
+    stageCycles[STAGE_RX] = lastPollCycles;
+    stageCycles[STAGE_SEEN] = now;
+    for (int s = STAGE_DISPATCH; s < STAGE_COUNT; s++) stageCycles[s] = now;
+  }
+  lastPollCycles = now;
+}
+
+HOTPATH void latencyStage(CommandStage stage) {
+  if (inFlight) stageCycles[stage] = ARM_DWT_CYCCNT;
+}
+
+static void recordWorst(const LatencyRecord& r) {
+  size_t slot = worstCount;
+  if (worstCount < LATENCY_WORST_COUNT) {
+    worstCount++;
+  } else {
+    // Replace the least bad entry if this one is worse
+    slot = 0;
+    for (size_t i = 1; i < LATENCY_WORST_COUNT; i++) {
+      if (worst[i].stageMicros[STAGE_ACK] < worst[slot].stageMicros[STAGE_ACK]) slot = i;
+    }
+    if (worst[slot].stageMicros[STAGE_ACK] >= r.stageMicros[STAGE_ACK]) return;
+  }
+  worst[slot] = r;
+}
+
+void latencyCommandDone(char command) {
+  if (!inFlight) return;
+  inFlight = false;
+
+  LatencyRecord r;
+  r.command = command;
+  r.when = syncedNow().seconds;
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    r.stageMicros[s] = cyclesToMicros(stageCycles[s] - stageCycles[STAGE_RX]);
+  }
+  uint32_t blockingCycles;
+  r.blockingTask = lastPassSlowestTask(blockingCycles);
+  r.blockingMicros = cyclesToMicros(blockingCycles);
+
+  metricObserve(HISTOGRAM_CMD_QUEUE_US, r.stageMicros[STAGE_SEEN]);
+  metricObserve(HISTOGRAM_CMD_ACTUATE_US, r.stageMicros[STAGE_ACTUATE] - r.stageMicros[STAGE_SEEN]);
+  metricObserve(HISTOGRAM_CMD_ACK_US, r.stageMicros[STAGE_ACK] - r.stageMicros[STAGE_ACTUATE]);
+  recordWorst(r);
+}
+
+FLASHMEM static void latencyCommand(Print& out, int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    worstCount = 0;
+    return;
+  }
+  for (size_t i = 0; i < worstCount; i++) {
+    const LatencyRecord& r = worst[i];
+    out.printf("%c at %lu:", r.command, (unsigned long)r.when);
+    for (int s = STAGE_SEEN; s < STAGE_COUNT; s++) {
+      out.printf(" %s=%lu", stageNames[s], (unsigned long)r.stageMicros[s]);
+    }
+    out.printf(" us, blocked by %s for %lu us\n", loopTaskNames[r.blockingTask],
+               (unsigned long)r.blockingMicros);
+  }
+}
+
+FLASHMEM void registerLatencyCommands() {
+  registerCommand("latency", latencyCommand, "latency [reset]: worst lander command latencies");
+}
@@ -0,0 +1,41 @@
+/**
+ * @brief End-to-end latency of lander valve commands
+ *
+ * Each 't'/'b' command is timestamped with the cycle counter as it moves
+ * through the firmware:
+ *
+ *   RX        the previous poll of LANDER_SERIAL; the byte arrived after
+ *             this, so SEEN - RX bounds the time it sat in the UART buffer
+ *   SEEN      the poll that found it waiting
+ *   DISPATCH  handleLanderByte() has parsed it and decided to move
+ *   ACTUATE   valve.writeMicroseconds() has returned
+ *   ACK       the sendPos() echo has been handed to the UART
+ *
+ * Stage deltas go into metrics histograms. The worst few commands are kept
+ * together with the slowest loop task of the pass before they were seen,
+ * which is what held up the poll.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+enum CommandStage : uint8_t {
+  STAGE_RX,
+  STAGE_SEEN,
+  STAGE_DISPATCH,
+  STAGE_ACTUATE,
+  STAGE_ACK,
+  STAGE_COUNT
+};
+
+const size_t LATENCY_WORST_COUNT = 4;
+
+// Call once per pass, just before polling the lander port
+void latencyPoll(bool available);
+void latencyStage(CommandStage stage);
+// The command completed (ACK recorded); fold it into the statistics
+void latencyCommandDone(char command);
+
+// Registers latency
+void registerLatencyCommands();
@@ -0,0 +1,91 @@
+#include "leds.h"
+#include "energy.h"
+#include "sysinfo.h"
+
+// Bit n set = LED on in slot n
+const uint16_t PATTERN_OFF = 0;
+const uint16_t PATTERN_SHORT = 0b0000000001;  // 100 on, 900 off
+const uint16_t PATTERN_LONG = 0b0000000011;   // 200 on, 800 off
+const uint16_t PATTERN_DOUBLE = 0b0000000101; // two short blinks
+const uint16_t PATTERN_FAST = 0b0101010101;   // 5 Hz
+
+static IntervalTimer ledTimer;
+static volatile uint16_t redPattern = PATTERN_OFF;
+static volatile uint16_t greenPattern = PATTERN_OFF;
+static volatile uint16_t heartbeatPattern = PATTERN_SHORT;
+static volatile uint8_t slot = 0;
+
+static bool enabled = false;
+static LedValveState valveState = LED_VALVE_UNKNOWN;
+static bool sdFault = false;
+static bool sensorFault = false;
+
+HOTPATH static void ledTick() {
+  uint8_t s = slot;
+  bool red = (redPattern >> s) & 1, green = (greenPattern >> s) & 1, heartbeat = (heartbeatPattern >> s) & 1;
+  digitalWriteFast(RED_LED_PIN, red);
+  digitalWriteFast(GREEN_LED_PIN, green);
+  digitalWriteFast(HEARTBEAT_LED_PIN, heartbeat);
+  energySet(ENERGY_LEDS, red || green || heartbeat);
+  slot = (s + 1 < LED_PATTERN_SLOTS) ? s + 1 : 0;
+}
+
+static void updatePatterns() {
+  uint16_t red = PATTERN_OFF, green = PATTERN_OFF;
+  if (sensorFault) {
+    red = PATTERN_FAST;
+  } else if (valveState == LED_VALVE_LOW_POWER) {
+    red = PATTERN_LONG;
+    green = PATTERN_LONG;
+  } else if (valveState == LED_VALVE_TOP) {
+    red = PATTERN_SHORT;
+  } else if (valveState == LED_VALVE_BOTTOM) {
+    green = PATTERN_SHORT;
+  }
+  // 16-bit stores are atomic, so the ISR never sees a torn pattern
+  redPattern = red;
+  greenPattern = green;
+  heartbeatPattern = sdFault ? PATTERN_DOUBLE : PATTERN_SHORT;
+}
+
+FLASHMEM void ledsBegin() {
+  pinMode(RED_LED_PIN, OUTPUT);
+  pinMode(GREEN_LED_PIN, OUTPUT);
+  pinMode(HEARTBEAT_LED_PIN, OUTPUT);
+  updatePatterns();
+  ledsSetEnabled(true);
+}
+
+void ledsSetEnabled(bool enable) {
+  if (enable == enabled) return;
+  enabled = enable;
+  if (enabled) {
+    ledTimer.begin(ledTick, LED_SLOT_MICROSECONDS);
+    // Lowest, but only while no other PIT channel runs: IntervalTimers share
+    // IRQ_PIT, which takes the highest priority any of them asked for, so
+    // with the sampler running the LED tick runs at its 64
+    ledTimer.priority(255);
+  } else {
+    ledTimer.end();
+    digitalWriteFast(RED_LED_PIN, LOW);
+    digitalWriteFast(GREEN_LED_PIN, LOW);
+    digitalWriteFast(HEARTBEAT_LED_PIN, LOW);
+    energySet(ENERGY_LEDS, false);
+  }
+}
+
+void ledsSetValveState(LedValveState state) {
+  valveState = state;
+  updatePatterns();
+}
+
+void ledsSetSdFault(bool fault) {
+  if (fault == sdFault) return;
+  sdFault = fault;
+  updatePatterns();
+}
+
+void ledsSetSensorFault(bool fault) {
+  sensorFault = fault;
+  updatePatterns();
+}
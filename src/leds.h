@@ -0,0 +1,36 @@
+/**
+ * @brief Timer-driven status LEDs
+ *
+ * An IntervalTimer steps each LED through a bit pattern, one bit per
+ * 100 ms slot, so the main loop does no LED work at all. Status is set from
+ * the loop when it changes; the timer interrupt only shifts out bits.
+ *
+ * Red/green show the valve: red blink at top, green blink at bottom, both
+ * blinking slowly after a low power homing, fast red for a power sensor
+ * fault. The heartbeat LED blinks once a second, or double-blinks while the
+ * SD card is failing. With LEDs disabled (deployment mode) the timer is
+ * stopped and all pins are held low.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t RED_LED_PIN = 39;
+const uint8_t GREEN_LED_PIN = 36;
+const uint8_t HEARTBEAT_LED_PIN = LED_BUILTIN;
+const uint32_t LED_SLOT_MICROSECONDS = 100000;
+const uint8_t LED_PATTERN_SLOTS = 10;
+
+enum LedValveState {
+  LED_VALVE_UNKNOWN,
+  LED_VALVE_TOP,
+  LED_VALVE_BOTTOM,
+  LED_VALVE_LOW_POWER,
+};
+
+void ledsBegin();
+void ledsSetEnabled(bool enabled);
+void ledsSetValveState(LedValveState state);
+void ledsSetSdFault(bool fault);
+void ledsSetSensorFault(bool fault);
@@ -0,0 +1,174 @@
+#include "loadshed.h"
+#include "commands.h"
+#include "config.h"
+#include "energy.h"
+#include "events.h"
+#include "sampler.h"
+#include "sysinfo.h"
+
+// Current variance (mA^2) needed before the fitted resistance is used
+static const float MIN_CURRENT_VARIANCE = 400;
+// A period counts when its difference is under this share of the average
+static const float PERIODIC_RATIO = 0.5f;
+static const uint16_t SEARCH_INTERVAL_TICKS = 1000 / EVENT_TICK_MS;
+static const uint16_t INRUSH_TICKS = (LOADSHED_INRUSH_MS + EVENT_TICK_MS - 1) / EVENT_TICK_MS;
+
+// Running fit of V = source - I * R
+static float meanMa = 0, meanMv = 0;
+static float covariance = 0, variance = 0;
+static bool fitStarted = false;
+static int32_t resistanceMohm = LOADSHED_DEFAULT_MOHM;
+static int32_t sourceMv = 0;
+
+// Per-tick current, newest at historyHead - 1
+static int16_t history[LOADSHED_HISTORY_TICKS];
+static uint32_t historyHead = 0;
+static uint16_t periodTicks = 0; // 0 = no periodic load found
+
+static int pendingPosition = 0; // 0 = none
+static bool deferring = false;
+static uint32_t deferSince = 0;
+
+// Bus voltage while a move runs
+static bool moveActive = false;
+static int moveMinMv = 0;
+static int lastMoveMinMv = 0, worstMoveMinMv = 0;
+
+static uint32_t movesDeferred = 0;
+static uint32_t movesForced = 0;
+static uint32_t movesRefused = 0;
+static uint32_t maxDelayMs = 0;
+static uint32_t workDeferred = 0;
+
+static int16_t historyAt(uint32_t ticksAgo) {
+  return history[(historyHead - 1 - ticksAgo) & (LOADSHED_HISTORY_TICKS - 1)];
+}
+
+// Repeat period of the load: the lag with the least average magnitude
+// difference, if that is clearly below the average over all lags
+static uint16_t findPeriod() {
+  const uint16_t n = LOADSHED_HISTORY_TICKS;
+  float best = 0, total = 0;
+  uint16_t bestLag = 0;
+  for (uint16_t lag = LOADSHED_MIN_PERIOD_TICKS; lag <= n / 2; lag++) {
+    uint32_t sum = 0;
+    for (uint16_t k = 0; k < n - lag; k++) sum += abs(historyAt(k) - historyAt(k + lag));
+    float difference = (float)sum / (n - lag);
+    total += difference;
+    if (!bestLag || difference < best) {
+      best = difference;
+      bestLag = lag;
+    }
+  }
+  float average = total / (n / 2 - LOADSHED_MIN_PERIOD_TICKS + 1);
+  return best < PERIODIC_RATIO * average ? bestLag : 0;
+}
+
+// Most the other loads will draw over the inrush horizon
+static int32_t forecastMa() {
+  int32_t peak = samplerLatestCurrent();
+  if (!periodTicks) return peak;
+  // One period ago, the ticks that correspond to the next INRUSH_TICKS
+  for (uint16_t k = 1; k <= INRUSH_TICKS; k++) peak = max(peak, (int32_t)historyAt(periodTicks - k));
+  return peak;
+}
+
+HOTPATH void loadShedPoll() {
+  float ma = samplerLatestCurrent();
+  float mv = samplerLatestVoltage();
+  history[historyHead++ & (LOADSHED_HISTORY_TICKS - 1)] = ma;
+  if (historyHead >= LOADSHED_HISTORY_TICKS && historyHead % SEARCH_INTERVAL_TICKS == 0) {
+    periodTicks = findPeriod();
+  }
+
+  if (!fitStarted) {
+    meanMa = ma;
+    meanMv = mv;
+    fitStarted = true;
+  }
+  const float alpha = 1.0f / LOADSHED_FIT_TICKS;
+  meanMa += alpha * (ma - meanMa);
+  meanMv += alpha * (mv - meanMv);
+  covariance += alpha * ((ma - meanMa) * (mv - meanMv) - covariance);
+  variance += alpha * ((ma - meanMa) * (ma - meanMa) - variance);
+  if (variance >= MIN_CURRENT_VARIANCE) {
+    resistanceMohm = constrain((int32_t)(-covariance / variance * 1000), (int32_t)1, LOADSHED_MAX_MOHM);
+  }
+  sourceMv = meanMv + meanMa * resistanceMohm / 1000;
+
+  bool moving = energyActivity() & (1 << ENERGY_SERVO_MOVE);
+  if (moving) {
+    moveMinMv = moveActive ? min(moveMinMv, (int)mv) : (int)mv;
+  } else if (moveActive) {
+    lastMoveMinMv = moveMinMv;
+    worstMoveMinMv = worstMoveMinMv ? min(worstMoveMinMv, moveMinMv) : moveMinMv;
+  }
+  moveActive = moving;
+}
+
+int32_t loadShedBudget() {
+  int32_t spareMv = sourceMv - config.thresholdVoltage - LOADSHED_MARGIN_MV;
+  return spareMv * 1000 / resistanceMohm - forecastMa();
+}
+
+HOTPATH LoadShedAdmit loadShedAdmitMove(int position) {
+  if (deferring && position != pendingPosition) {
+    movesRefused++;
+    return LOADSHED_BUSY;
+  }
+  uint32_t now = millis();
+  bool first = !deferring;
+  if (first) deferSince = now;
+  uint32_t waited = now - deferSince;
+
+  if (loadShedBudget() < LOADSHED_SERVO_PEAK_MA) {
+    if (waited < LOADSHED_MAX_DELAY_MS) {
+      if (first) movesDeferred++;
+      deferring = true;
+      pendingPosition = position;
+      return LOADSHED_WAIT;
+    }
+    movesForced++;
+  }
+  maxDelayMs = max(maxDelayMs, waited);
+  deferring = false;
+  pendingPosition = 0;
+  return LOADSHED_ADMIT;
+}
+
+bool loadShedPendingMove(int& position) {
+  position = pendingPosition;
+  return pendingPosition != 0;
+}
+
+bool loadShedCancelMove() {
+  bool waiting = deferring;
+  deferring = false;
+  pendingPosition = 0;
+  return waiting;
+}
+
+bool loadShedBusy() {
+  return moveActive || pendingPosition;
+}
+
+bool loadShedDeferWork() {
+  if (!loadShedBusy()) return false;
+  workDeferred++;
+  return true;
+}
+
+FLASHMEM static void loadShedCommand(Print& out, int argc, char* argv[]) {
+  out.printf("supply %ldmV behind %ldmohm, budget %ldmA (servo peak %ldmA)\n", (long)sourceMv,
+             (long)resistanceMohm, (long)loadShedBudget(), (long)LOADSHED_SERVO_PEAK_MA);
+  out.printf("load period %lums, forecast %ldmA\n", (unsigned long)(periodTicks * EVENT_TICK_MS), (long)forecastMa());
+  out.printf("moves deferred=%lu forced=%lu refused=%lu max_delay=%lums pending=%d\n",
+             (unsigned long)movesDeferred, (unsigned long)movesForced, (unsigned long)movesRefused,
+             (unsigned long)maxDelayMs, pendingPosition);
+  out.printf("work deferred=%lus, bus min during moves last=%dmV worst=%dmV\n", (unsigned long)workDeferred,
+             lastMoveMinMv, worstMoveMinMv);
+}
+
+FLASHMEM void registerLoadShedCommands() {
+  registerCommand("loadshed", loadShedCommand, "loadshed: supply fit, current budget and deferred moves/work");
+}
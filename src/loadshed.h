@@ -0,0 +1,71 @@
+/**
+ * @brief Power admission control for valve moves and SD work
+ *
+ * The bus sags by the supply impedance times the total current, so a servo
+ * inrush stacked on a pump peak or an SD write can pull it under
+ * threshold_voltage when neither would alone. The supply is modelled as a
+ * source voltage behind a resistance, both fitted continuously from the
+ * INA260 voltage and current. The current budget is what could still be
+ * drawn without the bus falling below threshold_voltage plus
+ * LOADSHED_MARGIN_MV, less the most the other loads will draw over the
+ * next LOADSHED_INRUSH_MS. That forecast comes from the current history: a
+ * periodic load such as the pump is found by its repeat period (average
+ * magnitude difference over LOADSHED_HISTORY_TICKS), and what it drew one
+ * period ago is what it will draw next. Without a clear period the
+ * forecast is the current right now.
+ *
+ * A valve move is admitted when the budget covers LOADSHED_SERVO_PEAK_MA.
+ * Otherwise it waits, and is retried every tick until the budget allows it
+ * or LOADSHED_MAX_DELAY_MS has passed, when it goes ahead anyway. Only one
+ * move waits at a time: a request for another position meanwhile is
+ * refused, and the caller keeps or drops it. Low power homing is never
+ * delayed. While a move is running or waiting, deferrable
+ * SD work (staging migration, binary log blocks, the scrub) waits too.
+ *
+ * tools/loadshed_sim.py runs the same controller against a supply
+ * impedance model and compares the minimum bus voltage with and without it;
+ * test/test_loadshed drives this code against the same model.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const int32_t LOADSHED_SERVO_PEAK_MA = 800;
+const uint32_t LOADSHED_INRUSH_MS = 150;
+const int32_t LOADSHED_MARGIN_MV = 300;
+const uint32_t LOADSHED_MAX_DELAY_MS = 2000;
+// Supply resistance assumed until the current has varied enough to fit it
+const int32_t LOADSHED_DEFAULT_MOHM = 500;
+const int32_t LOADSHED_MAX_MOHM = 5000;
+// Averaging length of the supply fit
+const uint32_t LOADSHED_FIT_TICKS = 1000;
+// Current history for the load forecast, power of two; the longest period
+// found is half of it
+const uint16_t LOADSHED_HISTORY_TICKS = 256;
+const uint16_t LOADSHED_MIN_PERIOD_TICKS = 20;
+
+// Update the supply fit and track bus voltage during moves; call every tick
+void loadShedPoll();
+// Current that could still be drawn over the next LOADSHED_INRUSH_MS, mA
+int32_t loadShedBudget();
+
+enum LoadShedAdmit : uint8_t {
+  LOADSHED_ADMIT, // go ahead
+  LOADSHED_WAIT,  // kept for a retry once there is headroom
+  LOADSHED_BUSY,  // another move is already waiting
+};
+
+LoadShedAdmit loadShedAdmitMove(int position);
+// A move waiting for headroom, to retry with setValvePosition()
+bool loadShedPendingMove(int& position);
+// Drop a waiting move, e.g. when low power homing replaces it; false if
+// none was waiting
+bool loadShedCancelMove();
+// True while a move is running or waiting
+bool loadShedBusy();
+// loadShedBusy(), counting the deferral; ask before deferrable SD work
+bool loadShedDeferWork();
+
+// Registers loadshed
+void registerLoadShedCommands();
@@ -0,0 +1,120 @@
+#include "logging.h"
+#include "clocksync.h"
+#include "energy.h"
+#include "leds.h"
+#include "metrics.h"
+#include "scrub.h"
+#include "sdpower.h"
+#include "staging.h"
+#include "trace.h"
+#include <SD.h>
+
+char filename[48] = {0};
+
+const char* const LOG_HEADER =
+  "timestamp,voltage,current,valve_position,ripple_hz,ripple_bands,current_min,current_max";
+
+// The SD file written last, kept open so consecutive writes don't repeat
+// the directory lookup
+static File sdFile;
+static char sdFileName[48] = {0};
+
+void updateFilename() {
+  static time_t lastDay = 0;
+  time_t t = syncedNow().seconds;
+
+  // Whole days, not day of month: a clock step can land on the same day of another month
+  if (strlen(filename) == 0 || t / SECS_PER_DAY != lastDay) {
+    snprintf(filename, sizeof(filename), "/%04d/%02d/gems_pump_%04d-%02d-%02d.csv",
+             year(t), month(t), year(t), month(t), day(t));
+    lastDay = t / SECS_PER_DAY;
+  }
+}
+
+static bool openSdFile(const char* path, bool csvHeader) {
+  if (sdFile) sdFile.close();
+  sdFileName[0] = '\0';
+
+  char directory[sizeof(sdFileName)];
+  strlcpy(directory, path, sizeof(directory));
+  char* slash = strrchr(directory, '/');
+  if (slash && slash != directory) {
+    *slash = '\0';
+    if (!SD.exists(directory)) SD.mkdir(directory); // creates the year as well
+  }
+
+  bool isNew = !SD.exists(path);
+  sdFile = SD.open(path, FILE_WRITE);
+  if (!sdFile) return false;
+  if (isNew && csvHeader) {
+    char header[128];
+    size_t length = snprintf(header, sizeof(header), "%s\r\n", LOG_HEADER);
+    sdFile.write((const uint8_t*)header, length);
+    scrubTrack(path, 0, header, length);
+  }
+  strlcpy(sdFileName, path, sizeof(sdFileName));
+  return true;
+}
+
+bool sdWrite(const char* path, const void* data, size_t length, bool csvHeader) {
+  TRACE_SCOPE(TRACE_SD_WRITE, min(length, (size_t)UINT16_MAX));
+  EnergyScope energy(ENERGY_SD);
+  if (!sdPowerWake()) {
+    metricInc(COUNTER_SD_OPEN_FAILURES);
+    ledsSetSdFault(true);
+    return false;
+  }
+  uint32_t start = micros();
+  if ((!sdFile || strcmp(path, sdFileName) != 0) && !openSdFile(path, csvHeader)) {
+    Serial.printf("Error opening %s\n", path);
+    metricInc(COUNTER_SD_OPEN_FAILURES);
+    ledsSetSdFault(true);
+    return false;
+  }
+  uint32_t offset = sdFile.position();
+  bool ok = sdFile.write((const uint8_t*)data, length) == length;
+  // Flush so the directory entry is current if power is lost
+  sdFile.flush();
+  if (!ok) {
+    Serial.printf("Error writing %s\n", path);
+    sdFile.close(); // reopen on the next write
+    ledsSetSdFault(true);
+    return false;
+  }
+  metricObserve(HISTOGRAM_SD_WRITE_US, micros() - start);
+  scrubTrack(path, offset, data, length);
+  ledsSetSdFault(false);
+  return true;
+}
+
+void sdClose() {
+  if (sdFile) sdFile.close();
+  sdFileName[0] = '\0';
+}
+
+bool appendLog(const char* text) {
+  return stagingAppend(filename, text);
+}
+
+// Write a one-line event record ("<message> at <timestamp>") to serial and the daily log
+void logEvent(const char* format, ...) {
+  char message[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  char timestamp[32];
+  formatTimestamp(timestamp, sizeof(timestamp), syncedNow());
+
+  char line[176];
+  snprintf(line, sizeof(line), "%s at %s\n", message, timestamp);
+  Serial.print(line);
+  appendLog(line);
+}
+
+void formatTimestamp(char* buffer, size_t size, Timestamp ts) {
+  time_t t = ts.seconds;
+  snprintf(buffer, size, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ",
+           year(t), month(t), day(t), hour(t), minute(t), second(t), ts.millis);
+}
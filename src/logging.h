@@ -0,0 +1,29 @@
+/**
+ * @brief Daily SD log files and event records
+ *
+ * Power records and event lines share one CSV per day. Event lines have the
+ * form "<message> at <timestamp>" so they stand out from data rows.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "timebase.h"
+
+extern char filename[48];
+
+// Roll the log file name over at midnight. Files go in /YYYY/MM/ so no
+// directory grows past ~31 entries, keeping FAT lookups short however long
+// the deployment runs.
+void updateFilename();
+// Append text to today's log. It is committed to the flash staging journal
+// and reaches the SD card with the next migration batch.
+bool appendLog(const char* text);
+// Write straight to a file on the SD card, creating its directory and (for
+// CSV files) the header as needed. Returns false on any open or write failure.
+bool sdWrite(const char* path, const void* data, size_t length, bool csvHeader = true);
+// Close the file sdWrite() keeps open, before the card is powered down
+void sdClose();
+void logEvent(const char* format, ...) __attribute__((format(printf, 1, 2)));
+// ISO 8601 with milliseconds, e.g. 2025-06-01T12:00:00.250Z
+void formatTimestamp(char* buffer, size_t size, Timestamp ts);
@@ -4,11 +4,13 @@
  * This program controls a valve system for the GEMS pump, monitoring power conditions
  * and logging operational data. The system includes:
  * 
- * - Power monitoring using INA260 sensor for voltage and current
+ * - Power monitoring using INA260 sensor for voltage and current, sampled at a fixed rate
  * - Servo-controlled valve that can move between low (0°) and high (179°) positions
  * - SD card logging of power data with daily log files
- * - LED status indicators (red and green)
+ * - Current ripple spectrum (dominant frequency and band powers) per log record
+ * - Timer-driven LED status indicators (red, green and heartbeat)
  * - Position request input and position confirmation output
+ * - Interrupt-driven event loop that sleeps between events
  * 
  * @note The valve will return to home position if voltage drops below threshold
  * @note Based on orginial code by Samuel Koeck
@@ -19,232 +21,427 @@
 
 #include <Arduino.h>
 #include <TimeLib.h>
-#include <Servo.h>
 #include <SD.h>
 #include <Adafruit_INA260.h>
-#include <Flasher.h>
 #include <EEPROM.h>
+#include "config.h"
+#include "commands.h"
+#include "timebase.h"
+#include "clocksync.h"
+#include "logging.h"
+#include "leds.h"
+#include "sysinfo.h"
+#include "metrics.h"
+#include "latency.h"
+#include "landertx.h"
+#include "schedule.h"
+#include "events.h"
+#include "sampler.h"
+#include "spectrum.h"
+#include "blockstats.h"
+#include "staging.h"
+#include "sdprofile.h"
+#include "scrub.h"
+#include "tslog.h"
+#include "profiler.h"
+#include "trace.h"
+#include "energy.h"
+#include "battery.h"
+#include "actuator.h"
+#include "sdpower.h"
+#include "loadshed.h"
 
 // Optional timer-based valve control
 #define TIMED_VALVE_CHANGE // to enable automatic valve switching based on time
 
-// Clock time valve change interval in seconds
-const unsigned long VALVE_CHANGE_INTERVAL = 7.5 * 60; // 7:30 minutes
-
-const unsigned long LOG_INTERVAL = 10; // Logging interval in seconds
-const int BOTTOM_MICROSECONDS = 1205;  // 0 degrees
-const int TOP_MICROSECONDS = 1795; // 179 degrees
-const int HOME_MICROSECONDS = 1500; // 89 degrees
-//Threshold voltage = too low power!!
-const int THRESHOLD_VOLTAGE = 10000; //in mV
-
 Adafruit_INA260 power;
 int voltage = 0, current = 0;
-char filename[32] = {0};
-Servo valve;
-
-Flasher red(39, 0, 1000), green(36, 0, 1000), heartbeat(LED_BUILTIN, 100, 900);
 
 #define LANDER_SERIAL Serial2
+// #define INA260_ALERT_PIN 22 // wire the INA260 alert output here for instant low power homing
+
+void handleLanderByte(char command);
+CommandPort usbPort(Serial), landerPort(LANDER_SERIAL, handleLanderByte, &landerReplies);
 
 void logPower();
 void turnValve();
-void setValvePosition(int position);
-void updateFilename();
+enum MoveResult { MOVE_DONE, MOVE_LOCKED_OUT, MOVE_LOW_POWER, MOVE_DEFERRED, MOVE_BUSY };
+
+MoveResult setValvePosition(int position);
+void runScheduledMoves();
 time_t getTeensy3Time();
 bool isIntervalTime(int intervalSeconds);
 void checkAndHomeOnLowPower();
-
-void setup() {
+void onTick(const Event& event);
+void onSecond(const Event& event);
+void onPowerAlert(const Event& event);
+void processSamples();
+
+FLASHMEM void setup() {
+  sysinfoBegin();
+  // Every subsystem below reads config as it starts
+  bool configValid = loadConfig();
   Serial.begin(115200);
   Serial.println("GEMS Pump Control System");
   Serial.printf("Compiled: %s %s\n", __DATE__, __TIME__);
 
   LANDER_SERIAL.begin(115200);
   LANDER_SERIAL.println("Lander Serial Initialized");
+  LANDER_SERIAL.flush();
+  landerTxBegin(LANDER_SERIAL);
 
   setSyncProvider(getTeensy3Time);
   Serial.println(timeStatus() != timeSet ? "Unable to sync with RTC" : "RTC has set the system time");
+  timebaseBegin();
 
-  if (!SD.begin(BUILTIN_SDCARD)) Serial.println("SD card initialization failed!");
+  ledsBegin();
+  ledsSetEnabled(config.ledsEnabled);
 
-  updateFilename();
-  File dataFile = SD.open(filename, FILE_WRITE);
-  if (dataFile) {
-    char timestamp[25];
-    time_t t = now();
-    sprintf(timestamp, "%04d-%02d-%02dT%02d:%02d:%02dZ",
-      year(t), month(t), day(t), hour(t), minute(t), second(t));
-    dataFile.printf("Rebooted at %s\n", timestamp);
-    dataFile.close();
-  } else {
-    Serial.printf("Error opening %s\n", filename);
+  if (!sdPowerBegin()) {
+    Serial.println("SD card initialization failed!");
+    ledsSetSdFault(true);
   }
+  stagingBegin();
+  scrubBegin();
+
+  updateFilename();
+  logEvent("Rebooted");
+  if (!configValid) logEvent("Config invalid or missing, using defaults");
+  sdProfileStart(); // runs from the tick
+
+  registerCoreCommands();
+  registerTimebaseCommands();
+  registerClockSyncCommands();
+  registerSysinfoCommands();
+  registerMetricsCommands();
+  registerLatencyCommands();
+  registerLanderTxCommands();
+  registerScheduleCommands();
+  registerEventCommands();
+  registerSamplerCommands();
+  registerBlockStatsCommands();
+  registerStagingCommands();
+  registerSdProfileCommands();
+  registerScrubCommands();
+  registerTsLogCommands();
+  registerProfilerCommands();
+  registerTraceCommands();
+  registerEnergyCommands();
+  registerBatteryCommands();
+  registerActuatorCommands();
+  registerSdPowerCommands();
+  registerLoadShedCommands();
+  scheduleBegin();
 
   if (!power.begin()) {
     Serial.println("Couldn't find INA260 chip");
+    ledsSetSensorFault(true); // the LED timer keeps signalling while we halt
+    ledsSetEnabled(true);
     while (1);
   }
-  
+#ifdef INA260_ALERT_PIN
+  power.setAlertType(INA260_ALERT_UNDERVOLTAGE);
+  power.setAlertLimit(config.thresholdVoltage);
+  power.setAlertPolarity(INA260_ALERT_POLARITY_NORMAL);
+  power.setAlertLatch(INA260_ALERT_LATCH_ENABLED);
+#endif
+  spectrumBegin();
+  blockStatsBegin();
+  samplerBegin(power, config.sampleRateHz);
+
   // delay to allow valve to initialize and home
   delay(4000);
 
-  valve.attach(1);
-  red.begin();
-  green.begin();
-  heartbeat.begin();
+  actuatorBegin(1);
 
-  int setPos = EEPROM.read(0) ? TOP_MICROSECONDS : BOTTOM_MICROSECONDS;
+  int setPos = EEPROM.read(0) ? config.topMicroseconds : config.bottomMicroseconds;
   setValvePosition(setPos);
+  batteryBegin();
+
+  onEvent(EVENT_TICK, onTick);
+  onEvent(EVENT_SECOND, onSecond);
+  onEvent(EVENT_POWER_ALERT, onPowerAlert);
+  eventsBegin();
 }
 
+// Each pass is woken by an interrupt: serial ports are polled, queued events
+// dispatched, and the core sleeps again
 void loop() {
+  loopTimingStart();
+  loopTask(TASK_COMMANDS);
+  pollCommands(usbPort);
+  latencyPoll(LANDER_SERIAL.available());
+  pollCommands(landerPort);
+  landerTxPump();
+  dispatchEvents();
+  loopTimingEnd();
+  waitForEvent();
+}
+
+// Every EVENT_TICK_MS: power check, valve scheduling and sample blocks
+HOTPATH void onTick(const Event& event) {
+  loopTask(TASK_TIME);
+  clockSyncUpdate();
+  loopTask(TASK_LOW_POWER_CHECK);
   checkAndHomeOnLowPower();
+  loopTask(TASK_VALVE);
+  loadShedPoll();
+  int deferred;
+  if (loadShedPendingMove(deferred)) setValvePosition(deferred);
   turnValve();
-  updateFilename();
-  logPower();
-  red.run();
-  green.run();
-  heartbeat.run();
+  runScheduledMoves();
+  actuatorPoll();
+  loopTask(TASK_SAMPLES);
+  processSamples();
+  loopTask(TASK_STAGING);
+  sdProfilePoll();
 }
 
-void updateFilename() {
-  static time_t lastDay = 0;
-  time_t t = now();
-
-  if (strlen(filename) == 0 || day(t) != day(lastDay)) { // Check if filename not set or day has changed
-    sprintf(filename, "gems_pump_%04d-%02d-%02d.csv", year(t), month(t), day(t));
+// Hand each full block of current samples to the downstream stages
+HOTPATH void processSamples() {
+  while (SampleBlock* block = samplerNextBlock()) {
+    blockStageProcess(*block);
+    spectrumAddBlock(*block);
+    energyAddBlock(*block);
+    batteryAddBlock(*block);
+    actuatorAddBlock(*block);
+    samplerReleaseBlock(block);
+  }
+}
 
-    if (!SD.exists(filename)) {
-      File dataFile = SD.open(filename, FILE_WRITE);
-      if (dataFile) {
-        dataFile.println("timestamp,voltage,current,valve_position"); 
-        dataFile.close();
-      }
-    }
-    lastDay = t;
+// Every RTC second: timebase discipline and the once-a-second work
+void onSecond(const Event& event) {
+  loopTask(TASK_TIME);
+  timebaseEdge(event.data, event.cycles);
+  loopTask(TASK_FILENAME);
+  updateFilename();
+  loopTask(TASK_LOG_POWER);
+  logPower();
+  loopTask(TASK_METRICS);
+  metricsSnapshot();
+  energyReport();
+  loopTask(TASK_BATTERY);
+  batteryUpdate();
+  actuatorReport();
+  loopTask(TASK_STAGING);
+  // SD work waits while the servo draws its inrush, and while the card is
+  // being profiled so it doesn't skew the timings
+  bool deferWork = loadShedDeferWork() || sdProfileRunning();
+  if (!deferWork) {
+    stagingMigrate();
+    tsLogPoll();
   }
+  loopTask(TASK_SCRUB);
+  if (!deferWork) scrubStep();
+  sdPowerPoll();
+}
+
+HOTPATH void onPowerAlert(const Event& event) {
+  loopTask(TASK_LOW_POWER_CHECK);
+  checkAndHomeOnLowPower();
+#ifdef INA260_ALERT_PIN
+  samplerLockBus();
+  power.alertFunctionFlag(); // reading the flag releases the latched alert
+  samplerUnlockBus();
+#endif
 }
 
 void logPower() {
   static unsigned long lastLogTime = 0;
-  if ((now() - lastLogTime) < LOG_INTERVAL) return;
+  if ((now() - lastLogTime) < batteryLogInterval()) return;
 
   // Read power and valve position
-  voltage = power.readBusVoltage();
-  current = power.readCurrent();
-  int valve_pos = valve.readMicroseconds();
+  voltage = samplerLatestVoltage();
+  // Mean of the anti-aliased current over the interval, with its extremes
+  IntervalCurrent sampled = blockStageTake();
+  current = sampled.samples ? sampled.mean : samplerLatestCurrent();
+  int valve_pos = actuatorPosition();
+  metricSet(GAUGE_BUS_VOLTAGE, voltage);
+  metricSet(GAUGE_CURRENT, current);
+  metricInc(COUNTER_LOG_RECORDS);
 
   // Format timestamp
-  char timestamp[25];
-  time_t t = now();
-  snprintf(timestamp, sizeof(timestamp), "%04d-%02d-%02dT%02d:%02d:%02dZ",
-           year(t), month(t), day(t), hour(t), minute(t), second(t));
+  Timestamp stamp = syncedNow();
+  char timestamp[32];
+  formatTimestamp(timestamp, sizeof(timestamp), stamp);
 
   // Log to serial
   Serial.printf("Logged Power at %s - Voltage: %d mV, Current: %d mA, Valve Pos: %d\n",
                 timestamp, voltage, current, valve_pos);
 
-  // Log to SD card
-  File dataFile = SD.open(filename, FILE_WRITE);
-  if (dataFile) {
-    dataFile.printf("%s,%d,%d,%d\n", timestamp, voltage, current, valve_pos);
-    dataFile.close();
-  } else {
-    Serial.printf("Error opening %s\n", filename);
+  // Ripple spectrum over the interval: dominant frequency and band powers
+  SpectrumSummary ripple = spectrumTake();
+  char bands[SPECTRUM_BANDS * 12] = "";
+  for (int b = 0, n = 0; b < SPECTRUM_BANDS && ripple.blocks; b++) {
+    n += snprintf(bands + n, sizeof(bands) - n, b ? "/%.2f" : "%.2f", ripple.bandPower[b]);
   }
 
+  // Log to SD card
+  char record[80 + sizeof(bands)];
+  snprintf(record, sizeof(record), "%s,%d,%d,%d,%.1f,%s,%d,%d\n", timestamp, voltage, current, valve_pos,
+           ripple.dominantHz, bands, sampled.min, sampled.max);
+  appendLog(record);
+  TsRecord point = {timestampMillis(stamp), voltage, current, sampled.min, sampled.max, valve_pos, ripple.dominantHz};
+  tsLogAppend(point);
+
   lastLogTime = now();
 }
 
 #ifndef TIMED_VALVE_CHANGE
 void sendPos(char pos) {
-  LANDER_SERIAL.write(pos);
-  LANDER_SERIAL.flush();
+  // Acks jump the transmit queue and go straight into the UART
+  landerSend(TX_ACK, &pos, 1);
+  landerTxPump();
+  latencyStage(STAGE_ACK);
+  latencyCommandDone(pos);
   Serial.printf("Sent position: %c\n", pos);
 } 
 #endif
 
-void turnValve() {
+HOTPATH void turnValve() {
 #ifdef TIMED_VALVE_CHANGE
-  if (isIntervalTime(VALVE_CHANGE_INTERVAL)) {
-    if (valve.readMicroseconds() == BOTTOM_MICROSECONDS) {
+  if (isIntervalTime(config.valveChangeInterval)) {
+    if (actuatorPosition() == config.bottomMicroseconds) {
       Serial.println("Timer: Turning to top");
-      setValvePosition(TOP_MICROSECONDS);
+      setValvePosition(config.topMicroseconds);
     } else {
       Serial.println("Timer: Turning to bottom");
-      setValvePosition(BOTTOM_MICROSECONDS);
+      setValvePosition(config.bottomMicroseconds);
     }
   }
-#else
-  if (LANDER_SERIAL.available()) {
-    char command = LANDER_SERIAL.read();
-    if (command == 't' && valve.readMicroseconds() < TOP_MICROSECONDS - 10) {
-      Serial.println("Turning to top");
-      setValvePosition(TOP_MICROSECONDS);
-    } else if (command == 'b' && valve.readMicroseconds() > BOTTOM_MICROSECONDS + 10) {
-      Serial.println("Turning to bottom");
-      setValvePosition(BOTTOM_MICROSECONDS);
-    }
+#endif
+}
+
+// Bytes from the lander that are not part of a '$' command line
+HOTPATH void handleLanderByte(char command) {
+#ifndef TIMED_VALVE_CHANGE
+  latencyStage(STAGE_DISPATCH);
+  if (command == 't' && actuatorPosition() < config.topMicroseconds - 10) {
+    Serial.println("Turning to top");
+    setValvePosition(config.topMicroseconds);
+  } else if (command == 'b' && actuatorPosition() > config.bottomMicroseconds + 10) {
+    Serial.println("Turning to bottom");
+    setValvePosition(config.bottomMicroseconds);
   }
 #endif
 }
 
-void setValvePosition(int position) {
+HOTPATH MoveResult setValvePosition(int position) {
   static unsigned long lastMoveTime = 0;
+  static int lastRejected = 0;
   unsigned long currentTime = millis();
-  // Prevent rapid movements
-  if (currentTime - lastMoveTime < 2000) return;
+  // Prevent rapid movements. turnValve() asks again every tick, so a
+  // request is only counted as skipped once.
+  if (currentTime - lastMoveTime < 2000) {
+    if (position != lastRejected) metricInc(COUNTER_SKIPPED_MOVES);
+    lastRejected = position;
+    TRACE_INSTANT(TRACE_VALVE, MOVE_LOCKED_OUT);
+    return MOVE_LOCKED_OUT;
+  }
+
+  // Hold the move until the supply has current headroom for the servo's
+  // inrush; onTick retries it. Low power homing never waits. While one move
+  // waits, a different one is refused like a lockout.
+  bool lowPower = samplerLatestVoltage() < config.thresholdVoltage;
+  LoadShedAdmit admit = lowPower ? LOADSHED_ADMIT : loadShedAdmitMove(position);
+  if (admit == LOADSHED_WAIT) {
+    TRACE_INSTANT(TRACE_VALVE, MOVE_DEFERRED);
+    return MOVE_DEFERRED;
+  }
+  if (admit == LOADSHED_BUSY) {
+    if (position != lastRejected) metricInc(COUNTER_SKIPPED_MOVES);
+    lastRejected = position;
+    TRACE_INSTANT(TRACE_VALVE, MOVE_BUSY);
+    return MOVE_BUSY;
+  }
   
   lastMoveTime = currentTime;
+  lastRejected = 0;
 
   // Servo will lose it's home position if power is too low
   // Setting to home gives us a chance it will be OK when power returns
-  if (power.readBusVoltage() < THRESHOLD_VOLTAGE) {
+  if (lowPower) {
+    if (loadShedCancelMove()) metricInc(COUNTER_SKIPPED_MOVES); // the waiting move is dropped
     Serial.println("Power too low, returning to home position");
-    valve.writeMicroseconds(HOME_MICROSECONDS);
-    red.update(200, 800);
-    green.update(200, 800);
-    return;
+    metricInc(COUNTER_SKIPPED_MOVES);
+    metricInc(COUNTER_LOW_POWER_HOMINGS);
+    actuatorMove(config.homeMicroseconds);
+    ledsSetValveState(LED_VALVE_LOW_POWER);
+    TRACE_INSTANT(TRACE_VALVE, MOVE_LOW_POWER);
+    return MOVE_LOW_POWER;
   }
 
-  valve.writeMicroseconds(position);
-  EEPROM.update(0, (position == TOP_MICROSECONDS) ? 1 : 0); // Store position in EEPROM
+  actuatorMove(position);
+  TRACE_INSTANT(TRACE_VALVE, MOVE_DONE);
+  latencyStage(STAGE_ACTUATE);
+  metricInc(COUNTER_VALVE_MOVES);
+  EEPROM.update(0, (position == config.topMicroseconds) ? 1 : 0); // Store position in EEPROM
 
   #ifndef TIMED_VALVE_CHANGE
-  char posChar = (position == BOTTOM_MICROSECONDS) ? 'b' : 't';
+  char posChar = (position == config.bottomMicroseconds) ? 'b' : 't';
   sendPos(posChar);
   #endif
 
-  if (position == TOP_MICROSECONDS) {
-    red.update(100, 900);
-    green.update(0, 1000);
-  } else {
-    red.update(0, 1000);
-    green.update(100, 900);
-  }
+  ledsSetValveState(position == config.topMicroseconds ? LED_VALVE_TOP : LED_VALVE_BOTTOM);
+  return MOVE_DONE;
 }
 
-void checkAndHomeOnLowPower() {
-  static unsigned long lastCheck = 0;
-  if (millis() - lastCheck < 10) return;
-  lastCheck = millis();
+// Carry out the earliest due time-tagged move. A move blocked by the lockout,
+// or by another move waiting for headroom, stays queued and is retried; a low power homing consumes it, just as it
+// would an immediate command.
+HOTPATH void runScheduledMoves() {
+  ScheduledMove move;
+  if (!scheduleDue(syncedNow().seconds, move)) return;
+  TRACE_INSTANT(TRACE_SCHEDULE, move.id);
+
+  int position = move.top ? config.topMicroseconds : config.bottomMicroseconds;
+  MoveResult result = setValvePosition(position);
+  if (result == MOVE_LOCKED_OUT || result == MOVE_BUSY) return;
+  // A deferred move is carried out by the load shedding retry
+  Serial.printf("Schedule: %s %u to %s\n", result == MOVE_DEFERRED ? "deferred" : "moved", move.id,
+                move.top ? "top" : "bottom");
+  schedulePop();
+}
 
-  voltage = power.readBusVoltage();
-  if (voltage < THRESHOLD_VOLTAGE && valve.readMicroseconds() != HOME_MICROSECONDS) {
+HOTPATH void checkAndHomeOnLowPower() {
+  voltage = samplerLatestVoltage();
+  if (voltage < config.thresholdVoltage && actuatorPosition() != config.homeMicroseconds) {
     Serial.println("Low power detected, moving valve to home position");
-    valve.writeMicroseconds(HOME_MICROSECONDS);
-    red.update(200, 800);
-    green.update(200, 800);
+    metricInc(COUNTER_LOW_POWER_HOMINGS);
+    actuatorMove(config.homeMicroseconds);
+    ledsSetValveState(LED_VALVE_LOW_POWER);
   }
 }
 
+// Apply a live config change: re-drive the servo if it sits on a pulse width that moved
+FLASHMEM void onConfigChanged(const Config& previous) {
+  int pos = actuatorPosition();
+  if (pos == previous.topMicroseconds && pos != config.topMicroseconds) {
+    actuatorMove(config.topMicroseconds);
+  } else if (pos == previous.bottomMicroseconds && pos != config.bottomMicroseconds) {
+    actuatorMove(config.bottomMicroseconds);
+  } else if (pos == previous.homeMicroseconds && pos != config.homeMicroseconds) {
+    actuatorMove(config.homeMicroseconds);
+  }
+  ledsSetEnabled(batteryLedsEnabled());
+  samplerSetRate(batterySampleRate());
+#ifdef INA260_ALERT_PIN
+  samplerLockBus();
+  power.setAlertLimit(config.thresholdVoltage);
+  samplerUnlockBus();
+#endif
+  logEvent("Config changed: log %lds, valve %lds, threshold %ldmV, bottom/home/top %ld/%ld/%ldus",
+           (long)config.logInterval, (long)config.valveChangeInterval, (long)config.thresholdVoltage,
+           (long)config.bottomMicroseconds, (long)config.homeMicroseconds, (long)config.topMicroseconds);
+}
+
 time_t getTeensy3Time() {
   return Teensy3Clock.get();
 }
 
-bool isIntervalTime(int intervalSeconds) {
-  time_t t = now();
+HOTPATH bool isIntervalTime(int intervalSeconds) {
+  // Synced time is slewed, never stepped, so each second is seen exactly once
+  time_t t = syncedNow().seconds;
   int minutes = minute(t);
   int seconds = second(t);
   int totalSeconds = minutes * 60 + seconds;
@@ -0,0 +1,118 @@
+#include "metrics.h"
+#include "commands.h"
+#include "crc.h"
+#include "clocksync.h"
+#include "logging.h"
+#include "sysinfo.h"
+
+const char* const counterNames[COUNTER_COUNT] = {
+  "i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+  "valve_moves", "log_records", "commands", "scrub_failures", "event_drops",
+};
+const char* const gaugeNames[GAUGE_COUNT] = {
+  "bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water",
+};
+const char* const histogramNames[HISTOGRAM_COUNT] = {
+  "loop_us", "sd_write_us", "cmd_queue_us", "cmd_actuate_us", "cmd_ack_us",
+  "scrub_read_us", "sd_wake_us",
+};
+
+// Text form: a name of up to METRIC_NAME_MAX characters, '=', then up to
+// 11 characters per value and one separator
+static const size_t METRIC_NAME_MAX = 24;
+static const size_t TEXT_SIZE = (COUNTER_COUNT + GAUGE_COUNT) * (METRIC_NAME_MAX + 13) +
+                                HISTOGRAM_COUNT * (METRIC_NAME_MAX + 2 + METRICS_BUCKETS * 11) + 1;
+
+volatile uint32_t metricCounters[COUNTER_COUNT];
+volatile int32_t metricGauges[GAUGE_COUNT];
+volatile uint32_t metricHistograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+
+static void refreshDerivedGauges() {
+  metricSet(GAUGE_LOOP_MAX_US, loopMaxMicros());
+  metricSet(GAUGE_STACK_HIGH_WATER, stackHighWater());
+}
+
+static void put(uint8_t* buffer, size_t& pos, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) buffer[pos++] = value >> (8 * i);
+}
+
+static void writeFrame(Print& out) {
+  static uint8_t frame[8 + 8 + 4 * (COUNTER_COUNT + GAUGE_COUNT + HISTOGRAM_COUNT * METRICS_BUCKETS) + 2];
+  size_t pos = 0;
+  frame[pos++] = 0xA5;
+  frame[pos++] = 0x5A;
+  frame[pos++] = 'M';
+  frame[pos++] = METRICS_FRAME_VERSION;
+  size_t lengthPos = pos;
+  pos += 2;
+
+  size_t payloadStart = pos;
+  put(frame, pos, millis(), 4);
+  put(frame, pos, COUNTER_COUNT, 1);
+  put(frame, pos, GAUGE_COUNT, 1);
+  put(frame, pos, HISTOGRAM_COUNT, 1);
+  put(frame, pos, METRICS_BUCKETS, 1);
+  for (int i = 0; i < COUNTER_COUNT; i++) put(frame, pos, metricCounters[i], 4);
+  for (int i = 0; i < GAUGE_COUNT; i++) put(frame, pos, metricGauges[i], 4);
+  for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+    for (int b = 0; b < METRICS_BUCKETS; b++) put(frame, pos, metricHistograms[h][b], 4);
+  }
+  size_t length = pos - payloadStart;
+  put(frame, lengthPos, length, 2);
+  put(frame, pos, crc16(frame + 2, pos - 2), 2);
+  out.write(frame, pos);
+}
+
+// One line per snapshot; histograms as slash-separated bucket counts up to the last non-empty one
+static size_t formatText(char* buffer, size_t size, char separator) {
+  size_t n = 0;
+  for (int i = 0; i < COUNTER_COUNT && n < size; i++) {
+    n += snprintf(buffer + n, size - n, "%s=%lu%c", counterNames[i], (unsigned long)metricCounters[i], separator);
+  }
+  for (int i = 0; i < GAUGE_COUNT && n < size; i++) {
+    n += snprintf(buffer + n, size - n, "%s=%ld%c", gaugeNames[i], (long)metricGauges[i], separator);
+  }
+  for (int h = 0; h < HISTOGRAM_COUNT && n < size; h++) {
+    int last = METRICS_BUCKETS - 1;
+    while (last > 0 && metricHistograms[h][last] == 0) last--;
+    n += snprintf(buffer + n, size - n, "%s=", histogramNames[h]);
+    for (int b = 0; b <= last && n < size; b++) {
+      n += snprintf(buffer + n, size - n, b ? "/%lu" : "%lu", (unsigned long)metricHistograms[h][b]);
+    }
+    if (n < size) n += snprintf(buffer + n, size - n, "%c", separator);
+  }
+  return n < size ? n : size - 1;
+}
+
+void metricsSnapshot() {
+  static unsigned long lastSnapshot = 0;
+  if (now() - lastSnapshot < METRICS_SNAPSHOT_INTERVAL) return;
+  lastSnapshot = now();
+
+  refreshDerivedGauges();
+  char tail[40];
+  char timestamp[32];
+  formatTimestamp(timestamp, sizeof(timestamp), syncedNow());
+  size_t tailLength = snprintf(tail, sizeof(tail), "at %s\n", timestamp);
+  // The tail always fits, so a record never runs into the next one
+  static char line[8 + TEXT_SIZE + sizeof(tail)] = "Metrics ";
+  size_t n = 8;
+  n += formatText(line + n, sizeof(line) - n - tailLength, ' ');
+  memcpy(line + n, tail, tailLength + 1);
+  appendLog(line);
+}
+
+FLASHMEM static void metricsCommand(Print& out, int argc, char* argv[]) {
+  refreshDerivedGauges();
+  if (argc > 1 && strcmp(argv[1], "text") == 0) {
+    static char text[TEXT_SIZE];
+    formatText(text, sizeof(text), '\n');
+    out.print(text);
+  } else {
+    writeFrame(out);
+  }
+}
+
+FLASHMEM void registerMetricsCommands() {
+  registerCommand("metrics", metricsCommand, "metrics [text]: dump metrics registry (binary frame by default)");
+}
@@ -0,0 +1,85 @@
+/**
+ * @brief Fixed-memory metrics registry
+ *
+ * Counters, gauges and log2-bucketed histograms live in static arrays
+ * indexed by enum, so every update is O(1) with no allocation or lookup.
+ * Updates are single atomic read-modify-writes and safe from ISRs.
+ *
+ * "$metrics" dumps the registry as a binary frame (decode with
+ * tools/metrics_decode.py); "$metrics text" prints it. A text snapshot goes
+ * into the SD log every METRICS_SNAPSHOT_INTERVAL seconds.
+ *
+ * Frame: 0xA5 0x5A 'M' version len(u16) payload crc16(u16), little endian,
+ * crc over type..payload. Payload: uptime_ms(u32), counter/gauge/histogram/
+ * bucket counts (u8 each), counters (u32), gauges (i32), histogram buckets
+ * (u32). Adding a metric appends to an enum and bumps METRICS_FRAME_VERSION.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t METRICS_FRAME_VERSION = 5;
+const unsigned long METRICS_SNAPSHOT_INTERVAL = 3600; // seconds
+const uint8_t METRICS_BUCKETS = 16; // bucket n counts values in [2^(n-1), 2^n)
+
+enum CounterId : uint8_t {
+  COUNTER_I2C_ERRORS,
+  COUNTER_SD_OPEN_FAILURES,
+  COUNTER_LOW_POWER_HOMINGS,
+  COUNTER_SKIPPED_MOVES,
+  COUNTER_VALVE_MOVES,
+  COUNTER_LOG_RECORDS,
+  COUNTER_COMMANDS,
+  COUNTER_SCRUB_FAILURES,
+  COUNTER_EVENT_DROPS,     // interrupt events lost to a full queue
+  COUNTER_COUNT
+};
+
+enum GaugeId : uint8_t {
+  GAUGE_BUS_VOLTAGE,       // mV
+  GAUGE_CURRENT,           // mA
+  GAUGE_LOOP_MAX_US,
+  GAUGE_STACK_HIGH_WATER,  // bytes
+  GAUGE_COUNT
+};
+
+enum HistogramId : uint8_t {
+  HISTOGRAM_LOOP_US,
+  HISTOGRAM_SD_WRITE_US,
+  HISTOGRAM_CMD_QUEUE_US,   // lander byte waiting for a poll (upper bound)
+  HISTOGRAM_CMD_ACTUATE_US, // seen to servo write
+  HISTOGRAM_CMD_ACK_US,     // servo write to echo sent
+  HISTOGRAM_SCRUB_READ_US,  // one background read-back chunk
+  HISTOGRAM_SD_WAKE_US,     // power gated card up and initialised
+  HISTOGRAM_COUNT
+};
+
+// Names are at most 24 characters, which sizes the text snapshot
+extern const char* const counterNames[COUNTER_COUNT];
+extern const char* const gaugeNames[GAUGE_COUNT];
+extern const char* const histogramNames[HISTOGRAM_COUNT];
+
+extern volatile uint32_t metricCounters[COUNTER_COUNT];
+extern volatile int32_t metricGauges[GAUGE_COUNT];
+extern volatile uint32_t metricHistograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+
+inline void metricInc(CounterId id, uint32_t n = 1) {
+  __atomic_fetch_add(&metricCounters[id], n, __ATOMIC_RELAXED);
+}
+
+inline void metricSet(GaugeId id, int32_t value) {
+  metricGauges[id] = value;
+}
+
+inline void metricObserve(HistogramId id, uint32_t value) {
+  uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+  if (bucket >= METRICS_BUCKETS) bucket = METRICS_BUCKETS - 1;
+  __atomic_fetch_add(&metricHistograms[id][bucket], 1, __ATOMIC_RELAXED);
+}
+
+// Write the periodic snapshot to the SD log when it is due
+void metricsSnapshot();
+
+// Registers metrics
+void registerMetricsCommands();
@@ -0,0 +1,175 @@
+#include "profiler.h"
+#include "commands.h"
+#include "crc.h"
+
+struct ProfileSlot {
+  uint32_t pc;
+  uint32_t count;
+};
+
+static const uint8_t MAX_PROBES = 8;
+
+static ProfileSlot slots[PROFILE_SLOTS];
+static volatile uint32_t samples = 0;
+static volatile uint32_t dropped = 0;
+static volatile uint32_t handlerCycles = 0;
+static uint32_t rateHz = 0;
+static uint32_t startMillis = 0;
+static uint32_t stopMillis = 0;
+static bool running = false;
+
+static inline bool record(uint32_t pc) {
+  uint32_t slot = (pc >> 1) * 2654435761u >> (32 - PROFILE_SLOT_BITS);
+  for (uint8_t probe = 0; probe < MAX_PROBES; probe++) {
+    ProfileSlot& s = slots[(slot + probe) & (PROFILE_SLOTS - 1)];
+    if (s.pc == pc) {
+      s.count++;
+      return true;
+    }
+    if (!s.pc) {
+      s.pc = pc;
+      s.count = 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+#if defined(__IMXRT1062__)
+
+// frame points at the stacked r0-r3, r12, lr, pc, xpsr of the interrupted code
+extern "C" FASTRUN void profilerSample(const uint32_t* frame) {
+  uint32_t start = ARM_DWT_CYCCNT;
+  GPT2_SR = GPT_SR_OF1;
+  if (!record(frame[6])) dropped++;
+  samples++;
+  handlerCycles += ARM_DWT_CYCCNT - start;
+  asm volatile("dsb"); // let the flag clear before returning, or the IRQ fires twice
+}
+
+// Pick the stack the exception frame was pushed to and pass it on
+__attribute__((naked)) FASTRUN static void profilerIsr() {
+  asm volatile(
+    "tst lr, #4\n"
+    "ite eq\n"
+    "mrseq r0, msp\n"
+    "mrsne r0, psp\n"
+    "b profilerSample\n");
+}
+
+static void startTimer(uint32_t hz) {
+  CCM_CCGR0 |= CCM_CCGR0_GPT2_BUS(CCM_CCGR_ON) | CCM_CCGR0_GPT2_SERIAL(CCM_CCGR_ON);
+  GPT2_CR = 0;
+  GPT2_PR = 0;
+  GPT2_SR = 0x3F;
+  GPT2_IR = GPT_IR_OF1IE;
+  // Peripheral clock, 24 MHz as the core sets it up for the PITs
+  GPT2_OCR1 = 24000000 / hz - 1;
+  GPT2_CR = GPT_CR_CLKSRC(1) | GPT_CR_ENMOD;
+  attachInterruptVector(IRQ_GPT2, profilerIsr);
+  NVIC_SET_PRIORITY(IRQ_GPT2, 0);
+  NVIC_ENABLE_IRQ(IRQ_GPT2);
+  GPT2_CR |= GPT_CR_EN;
+}
+
+static void stopTimer() {
+  NVIC_DISABLE_IRQ(IRQ_GPT2);
+  GPT2_CR = 0;
+}
+
+#else
+
+static void startTimer(uint32_t hz) {}
+static void stopTimer() {}
+
+#endif
+
+static uint32_t elapsedMillis() {
+  return (running ? millis() : stopMillis) - startMillis;
+}
+
+// Handler and exception cost as a share of the profiled time
+static uint32_t overheadPpm() {
+  uint64_t elapsed = (uint64_t)elapsedMillis() * (F_CPU_ACTUAL / 1000);
+  if (!elapsed) return 0;
+  uint64_t spent = handlerCycles + (uint64_t)samples * PROFILE_ENTRY_EXIT_CYCLES;
+  return spent * 1000000 / elapsed;
+}
+
+static void put(uint8_t* buffer, size_t& pos, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) buffer[pos++] = value >> (8 * i);
+}
+
+static void writeFrame(Print& out) {
+  DMAMEM static uint8_t frame[6 + 22 + 8 * PROFILE_SLOTS + 2];
+  size_t pos = 0;
+  frame[pos++] = 0xA5;
+  frame[pos++] = 0x5A;
+  frame[pos++] = 'P';
+  frame[pos++] = PROFILE_FRAME_VERSION;
+  size_t lengthPos = pos;
+  pos += 2;
+
+  size_t payloadStart = pos;
+  put(frame, pos, rateHz, 4);
+  put(frame, pos, elapsedMillis(), 4);
+  put(frame, pos, samples, 4);
+  put(frame, pos, dropped, 4);
+  put(frame, pos, overheadPpm(), 4);
+  size_t countPos = pos;
+  pos += 2;
+  uint16_t used = 0;
+  for (const ProfileSlot& s : slots) {
+    if (!s.pc) continue;
+    put(frame, pos, s.pc, 4);
+    put(frame, pos, s.count, 4);
+    used++;
+  }
+  put(frame, countPos, used, 2);
+  put(frame, lengthPos, pos - payloadStart, 2);
+  put(frame, pos, crc16(frame + 2, pos - 2), 2);
+  out.write(frame, pos);
+}
+
+FLASHMEM static void profCommand(Print& out, int argc, char* argv[]) {
+  const char* action = argc > 1 ? argv[1] : "";
+  if (strcmp(action, "start") == 0) {
+    uint32_t hz = argc > 2 ? strtoul(argv[2], nullptr, 10) : PROFILE_DEFAULT_HZ;
+    if (hz < 1 || hz > PROFILE_MAX_HZ) {
+      out.printf("ERR rate 1-%lu Hz\n", (unsigned long)PROFILE_MAX_HZ);
+      return;
+    }
+#if !defined(__IMXRT1062__)
+    out.println("ERR profiler needs the Teensy 4 GPT2 timer");
+    return;
+#endif
+    stopTimer();
+    memset(slots, 0, sizeof(slots));
+    samples = dropped = handlerCycles = 0;
+    rateHz = hz;
+    startMillis = millis();
+    running = true;
+    startTimer(hz);
+    out.printf("OK profiling at %lu Hz\n", (unsigned long)hz);
+  } else if (strcmp(action, "stop") == 0) {
+    stopTimer();
+    if (running) stopMillis = millis();
+    running = false;
+    out.println("OK");
+  } else if (strcmp(action, "dump") == 0) {
+    // Hold off samples so the table and totals agree
+    stopTimer();
+    writeFrame(out);
+    if (running) startTimer(rateHz);
+  } else {
+    out.printf("%s rate=%luHz time=%lums samples=%lu dropped=%lu\n", running ? "running" : "stopped",
+               (unsigned long)rateHz, (unsigned long)elapsedMillis(), (unsigned long)samples,
+               (unsigned long)dropped);
+    out.printf("overhead=%lu ppm (%lu cycles/sample)\n", (unsigned long)overheadPpm(),
+               (unsigned long)(samples ? handlerCycles / samples + PROFILE_ENTRY_EXIT_CYCLES : 0));
+  }
+}
+
+FLASHMEM void registerProfilerCommands() {
+  registerCommand("prof", profCommand, "prof [start [hz]|stop|dump]: sampling profiler");
+}
@@ -0,0 +1,34 @@
+/**
+ * @brief Timer-interrupt sampling profiler
+ *
+ * "$prof start [hz]" runs GPT2 at the given rate. Its interrupt runs at the
+ * highest priority and reads the interrupted PC from the exception frame,
+ * so time spent in other ISRs is sampled too. The PC is counted in a fixed
+ * open-addressed table of PROFILE_SLOTS (pc, count) pairs. Samples that find
+ * the table full are counted as dropped. While stopped the timer and its
+ * IRQ are off, so the profiler costs nothing.
+ *
+ * "$prof dump" sends the table as a binary frame. Map it to functions with
+ * tools/profile_report.py and the firmware ELF.
+ *
+ * Frame: 0xA5 0x5A 'P' version len(u16) payload crc16(u16), little endian,
+ * crc over type..payload. Payload: rate_hz(u32), duration_ms(u32),
+ * samples(u32), dropped(u32), overhead_ppm(u32), slot count(u16), then
+ * (pc u32, count u32) per used slot. WFI time is sampled at the WFI in
+ * waitForEvent(), so it shows up as idle there.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t PROFILE_FRAME_VERSION = 1;
+const uint8_t PROFILE_SLOT_BITS = 9;
+const uint16_t PROFILE_SLOTS = 1 << PROFILE_SLOT_BITS;
+const uint32_t PROFILE_DEFAULT_HZ = 2000;
+const uint32_t PROFILE_MAX_HZ = 20000;
+// Exception entry and exit, on top of the measured handler body
+const uint32_t PROFILE_ENTRY_EXIT_CYCLES = 24;
+
+// Registers prof
+void registerProfilerCommands();
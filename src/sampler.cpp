@@ -0,0 +1,233 @@
+#include "sampler.h"
+#include "commands.h"
+#include "energy.h"
+#include "i2casync.h"
+#include "metrics.h"
+#include "spsc.h"
+#include "sysinfo.h"
+#include "trace.h"
+#include <Adafruit_INA260.h>
+#include <Wire.h>
+
+DMAMEM static SampleBlock blocks[SAMPLE_BLOCK_COUNT];
+static SpscQueue<uint8_t, 16> filled; // ISR -> loop
+static SpscQueue<uint8_t, 16> freed;  // loop -> ISR
+
+static Adafruit_INA260* sensor = nullptr;
+static IntervalTimer sampleTimer;
+static uint32_t rate = 0;
+static uint32_t periodCycles = 0;
+
+static volatile bool busLocked = false;
+static volatile int latestVoltage = 0;
+static volatile int latestCurrent = 0;
+
+// ISR state
+static SampleBlock* active = nullptr;
+static uint32_t lastCycles = 0;
+static uint16_t voltageCountdown = 0;
+static uint8_t voltageRead = 0;
+static uint32_t blockSeq = 0;
+
+// Statistics
+static volatile uint32_t samplesTaken = 0;
+static volatile uint32_t samplesMissed = 0;   // bus locked or still busy
+static volatile uint32_t samplesDropped = 0;  // no free block
+static volatile uint32_t maxJitterCycles = 0;
+
+// INA260 registers
+const uint8_t INA260_REG_CONFIG = 0x00;
+const uint8_t INA260_REG_CURRENT = 0x01;
+const uint8_t INA260_REG_BUS_VOLTAGE = 0x02;
+
+// Per-tick transfers: read the current (and maybe the bus voltage) from the
+// conversion triggered last tick, then write the config to trigger the next
+static uint16_t currentProgram[13];
+static uint16_t voltageProgram[13];
+static uint8_t currentProgramLength = 0;
+static uint8_t voltageProgramLength = 0;
+
+// Latched by the tick for the transfer it starts
+static uint32_t tickCycles = 0;
+static int32_t tickJitter = 0;
+static uint8_t tickActivity = 0;
+static bool tickVoltage = false;
+
+FLASHMEM static uint8_t readRegister(uint16_t* program, uint8_t reg) {
+  uint8_t n = 0;
+  program[n++] = i2cStart(INA260_I2CADDR_DEFAULT, false);
+  program[n++] = i2cSend(reg);
+  program[n++] = i2cStart(INA260_I2CADDR_DEFAULT, true);
+  program[n++] = i2cReceive(2);
+  return n;
+}
+
+FLASHMEM static uint8_t buildProgram(uint16_t* program, bool voltage, uint16_t config) {
+  uint8_t n = readRegister(program, INA260_REG_CURRENT);
+  if (voltage) n += readRegister(program + n, INA260_REG_BUS_VOLTAGE);
+  program[n++] = i2cStart(INA260_I2CADDR_DEFAULT, false);
+  program[n++] = i2cSend(INA260_REG_CONFIG);
+  program[n++] = i2cSend(config >> 8);
+  program[n++] = i2cSend(config & 0xFF);
+  program[n++] = i2cStop();
+  return n;
+}
+
+// LPI2C interrupt, same priority as the tick, so the two never interleave
+HOTPATH static void transferDone(bool ok, const uint8_t* rx, uint8_t rxCount) {
+  TRACE_END(TRACE_I2C, tickVoltage);
+  if (!ok) {
+    metricInc(COUNTER_I2C_ERRORS);
+    return;
+  }
+  // 1.25 mA and 1.25 mV per bit
+  int current = (int16_t)(rx[0] << 8 | rx[1]) * 5 / 4;
+  if (tickVoltage) latestVoltage = (uint16_t)(rx[2] << 8 | rx[3]) * 5 / 4;
+  latestCurrent = current;
+  samplesTaken++;
+
+  uint32_t absJitter = tickJitter < 0 ? -tickJitter : tickJitter;
+  if (absJitter > maxJitterCycles && samplesTaken > 1) maxJitterCycles = absJitter;
+
+  if (!active) {
+    uint8_t index;
+    if (!freed.pop(index)) {
+      samplesDropped++;
+      return;
+    }
+    active = &blocks[index];
+    active->seq = blockSeq++;
+    active->startCycles = tickCycles;
+    active->periodCycles = periodCycles;
+    active->count = 0;
+  }
+  int32_t tenths = tickJitter / (int32_t)(F_CPU_ACTUAL / 10000000);
+  active->current[active->count] = current;
+  active->jitter[active->count] = constrain(tenths, (int32_t)-32768, (int32_t)32767);
+  active->activity[active->count] = tickActivity;
+  if (++active->count == SAMPLE_BLOCK_SIZE) {
+    filled.push(active - blocks);
+    active = nullptr;
+  }
+}
+
+HOTPATH static void sampleTick() {
+  TRACE_SCOPE(TRACE_ISR_SAMPLER, 0);
+  uint32_t cycles = ARM_DWT_CYCCNT;
+  uint32_t elapsed = cycles - lastCycles;
+  lastCycles = cycles;
+  // A transfer still running means the bus is slower than the rate
+  if (busLocked || i2cAsyncBusy()) {
+    samplesMissed++;
+    return;
+  }
+
+  // The conversion being read spanned the last period, including any
+  // voltage transaction made on the previous tick
+  tickCycles = cycles;
+  tickJitter = (int32_t)(elapsed - periodCycles);
+  tickActivity = energyActivity() | voltageRead;
+  voltageRead = 0;
+  tickVoltage = voltageCountdown == 0;
+  if (tickVoltage) {
+    voltageRead = 1 << ENERGY_I2C_VOLTAGE;
+    voltageCountdown = SAMPLER_VOLTAGE_DIVIDER;
+  }
+  voltageCountdown--;
+  TRACE_BEGIN(TRACE_I2C, tickVoltage);
+  if (tickVoltage) {
+    i2cAsyncStart(voltageProgram, voltageProgramLength, 4, transferDone);
+  } else {
+    i2cAsyncStart(currentProgram, currentProgramLength, 2, transferDone);
+  }
+}
+
+FLASHMEM void samplerBegin(Adafruit_INA260& ina, uint32_t rateHz) {
+  sensor = &ina;
+  Wire.setClock(1000000);
+  sensor->setAveragingCount(INA260_COUNT_1);
+  sensor->setCurrentConversionTime(INA260_TIME_140_us);
+  sensor->setVoltageConversionTime(INA260_TIME_140_us);
+  latestVoltage = sensor->readBusVoltage();
+  sensor->setMode(INA260_MODE_TRIGGERED);
+
+  // Writing back the config just set up triggers a conversion
+  Wire.beginTransmission(INA260_I2CADDR_DEFAULT);
+  Wire.write(INA260_REG_CONFIG);
+  Wire.endTransmission(false);
+  Wire.requestFrom(INA260_I2CADDR_DEFAULT, (uint8_t)2);
+  uint16_t config = Wire.read() << 8;
+  config |= Wire.read();
+  currentProgramLength = buildProgram(currentProgram, false, config);
+  voltageProgramLength = buildProgram(voltageProgram, true, config);
+  i2cAsyncBegin(64);
+
+  for (uint8_t i = 0; i < SAMPLE_BLOCK_COUNT; i++) freed.push(i);
+  samplerSetRate(rateHz);
+}
+
+void samplerSetRate(uint32_t rateHz) {
+  rateHz = constrain(rateHz, (uint32_t)1, SAMPLER_MAX_RATE_HZ);
+  if (rateHz == rate) return;
+  sampleTimer.end();
+  while (i2cAsyncBusy()); // its completion may still append to the block
+  rate = rateHz;
+  periodCycles = F_CPU_ACTUAL / rate;
+  lastCycles = ARM_DWT_CYCCNT;
+  if (active) {
+    // A block never mixes sample rates: hand back the partial one
+    filled.push(active - blocks);
+    active = nullptr;
+  }
+  sampleTimer.begin(sampleTick, 1000000.0f / rate);
+  // Every IntervalTimer channel shares IRQ_PIT, which the core sets to the
+  // highest priority any running channel asked for. So this lifts the event
+  // and LED ticks to 64 as well rather than placing the sampler above them:
+  // a sample tick can wait behind one of those short ISRs, and the wait
+  // shows in its jitter. What 64 does guarantee is that no PIT tick
+  // interleaves with the LPI2C interrupt, which runs at the same level.
+  sampleTimer.priority(64);
+}
+
+uint32_t samplerRate() {
+  return rate;
+}
+
+HOTPATH SampleBlock* samplerNextBlock() {
+  uint8_t index;
+  return filled.pop(index) ? &blocks[index] : nullptr;
+}
+
+HOTPATH void samplerReleaseBlock(SampleBlock* block) {
+  freed.push(block - blocks);
+}
+
+int samplerLatestVoltage() {
+  return latestVoltage;
+}
+
+int samplerLatestCurrent() {
+  return latestCurrent;
+}
+
+void samplerLockBus() {
+  busLocked = true;
+  while (i2cAsyncBusy()); // let a transfer already started finish
+}
+
+void samplerUnlockBus() {
+  busLocked = false;
+}
+
+FLASHMEM static void samplerCommand(Print& out, int argc, char* argv[]) {
+  uint32_t cyclesPerMicro = F_CPU_ACTUAL / 1000000;
+  out.printf("rate=%luHz taken=%lu missed=%lu dropped=%lu blocks=%lu max_jitter=%luus\n",
+             (unsigned long)rate, (unsigned long)samplesTaken, (unsigned long)samplesMissed,
+             (unsigned long)samplesDropped, (unsigned long)blockSeq,
+             (unsigned long)(maxJitterCycles / cyclesPerMicro));
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) maxJitterCycles = 0;
+}
+
+FLASHMEM void registerSamplerCommands() {
+  registerCommand("sampler", samplerCommand, "sampler [reset]: acquisition rate, losses and jitter");
+}
@@ -0,0 +1,63 @@
+/**
+ * @brief Timer-triggered INA260 acquisition
+ *
+ * An IntervalTimer fires at exactly the configured rate. Each interrupt
+ * starts an interrupt-driven I2C transfer (see i2casync.h) that reads the
+ * current from the conversion triggered on the previous tick, then triggers
+ * the next one, so samples are evenly spaced no matter what the main loop
+ * is doing. Bus voltage is read in the same transfer on every
+ * SAMPLER_VOLTAGE_DIVIDER'th tick. The tick itself never waits on the bus;
+ * the sample is stored when the transfer completes, and a tick that finds
+ * the previous transfer still running is skipped and counted.
+ *
+ * Current samples fill fixed blocks in RAM2. Full blocks are handed to the
+ * loop through an SPSC queue, and released blocks come back through
+ * another, so neither side ever locks. Each sample also records its timing
+ * error against the nominal period and which subsystems were active (see
+ * energy.h). If the loop falls behind and no free
+ * block is available, the samples are dropped and counted.
+ *
+ * The sampler owns the I2C bus while it runs. Other INA260 access must be
+ * bracketed by samplerLockBus()/samplerUnlockBus(); the lock waits out a
+ * transfer in flight, and ticks that land inside are skipped and counted.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class Adafruit_INA260;
+
+const uint16_t SAMPLE_BLOCK_SIZE = 256;
+const uint8_t SAMPLE_BLOCK_COUNT = 8;
+// Voltage read every this many samples; at 1 kHz that is the old 10 ms check
+const uint16_t SAMPLER_VOLTAGE_DIVIDER = 10;
+const uint32_t SAMPLER_MAX_RATE_HZ = 2000;
+
+struct SampleBlock {
+  uint32_t seq;
+  uint32_t startCycles;   // ARM_DWT_CYCCNT at the first sample
+  uint32_t periodCycles;  // nominal spacing
+  uint16_t count;
+  int16_t current[SAMPLE_BLOCK_SIZE]; // mA
+  int16_t jitter[SAMPLE_BLOCK_SIZE];  // deviation from nominal spacing, 0.1 us units
+  uint8_t activity[SAMPLE_BLOCK_SIZE]; // EnergyActivity bits at the sample
+};
+
+void samplerBegin(Adafruit_INA260& ina, uint32_t rateHz);
+void samplerSetRate(uint32_t rateHz);
+uint32_t samplerRate();
+
+// Next full block, or null. Hand it back with samplerReleaseBlock().
+SampleBlock* samplerNextBlock();
+void samplerReleaseBlock(SampleBlock* block);
+
+// Most recent readings, for code that just wants the present value
+int samplerLatestVoltage(); // mV
+int samplerLatestCurrent(); // mA
+
+void samplerLockBus();
+void samplerUnlockBus();
+
+// Registers sampler
+void registerSamplerCommands();
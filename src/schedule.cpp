@@ -0,0 +1,142 @@
+#include "schedule.h"
+#include "commands.h"
+#include "crc.h"
+#include "logging.h"
+#include "sysinfo.h"
+#include <EEPROM.h>
+
+struct ScheduleBlock {
+  uint16_t version;
+  uint16_t nextId;
+  uint8_t count;
+  ScheduledMove moves[SCHEDULE_CAPACITY];
+  uint16_t crc;
+};
+
+static ScheduleBlock block;
+static ScheduledMove* const heap = block.moves;
+
+static void swap(size_t a, size_t b) {
+  ScheduledMove t = heap[a];
+  heap[a] = heap[b];
+  heap[b] = t;
+}
+
+static void siftUp(size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap[parent].deadline <= heap[i].deadline) break;
+    swap(i, parent);
+    i = parent;
+  }
+}
+
+static void siftDown(size_t i) {
+  for (;;) {
+    size_t smallest = i, left = 2 * i + 1, right = left + 1;
+    if (left < block.count && heap[left].deadline < heap[smallest].deadline) smallest = left;
+    if (right < block.count && heap[right].deadline < heap[smallest].deadline) smallest = right;
+    if (smallest == i) return;
+    swap(i, smallest);
+    i = smallest;
+  }
+}
+
+static void removeAt(size_t i) {
+  block.count--;
+  if (i == block.count) return;
+  heap[i] = heap[block.count];
+  siftDown(i);
+  siftUp(i);
+}
+
+static void save() {
+  block.version = SCHEDULE_VERSION;
+  block.crc = crc16(&block, offsetof(ScheduleBlock, crc));
+  EEPROM.put(SCHEDULE_EEPROM_ADDRESS, block);
+}
+
+FLASHMEM void scheduleBegin() {
+  EEPROM.get(SCHEDULE_EEPROM_ADDRESS, block);
+  if (block.version != SCHEDULE_VERSION || block.count > SCHEDULE_CAPACITY ||
+      block.crc != crc16(&block, offsetof(ScheduleBlock, crc))) {
+    memset(&block, 0, sizeof(block));
+    save();
+    return;
+  }
+  if (block.count) logEvent("Restored %u scheduled moves", block.count);
+}
+
+HOTPATH bool scheduleDue(time_t now, ScheduledMove& move) {
+  while (block.count && heap[0].deadline <= (uint32_t)now) {
+    if ((uint32_t)now - heap[0].deadline <= SCHEDULE_MAX_LATENESS) {
+      move = heap[0];
+      return true;
+    }
+    logEvent("Dropped scheduled move %u, %lus overdue", heap[0].id,
+             (unsigned long)((uint32_t)now - heap[0].deadline));
+    removeAt(0);
+    save();
+  }
+  return false;
+}
+
+void schedulePop() {
+  if (!block.count) return;
+  removeAt(0);
+  save();
+}
+
+FLASHMEM static void atCommand(Print& out, int argc, char* argv[]) {
+  if (argc < 3 || (strcmp(argv[2], "t") != 0 && strcmp(argv[2], "b") != 0)) {
+    out.println("ERR usage: $at <epoch seconds> <t|b>");
+    return;
+  }
+  if (block.count >= SCHEDULE_CAPACITY) {
+    out.println("ERR schedule full");
+    return;
+  }
+  ScheduledMove& m = heap[block.count];
+  m.deadline = strtoul(argv[1], nullptr, 10);
+  m.top = argv[2][0] == 't';
+  m.id = ++block.nextId;
+  siftUp(block.count++);
+  save();
+  out.printf("OK id=%u\n", block.nextId);
+}
+
+FLASHMEM static void queueCommand(Print& out, int argc, char* argv[]) {
+  for (size_t i = 0; i < block.count; i++) {
+    out.printf("id=%u at=%lu %c\n", heap[i].id, (unsigned long)heap[i].deadline, heap[i].top ? 't' : 'b');
+  }
+  out.printf("%u/%u scheduled\n", block.count, (unsigned)SCHEDULE_CAPACITY);
+}
+
+FLASHMEM static void cancelCommand(Print& out, int argc, char* argv[]) {
+  if (argc < 2) {
+    out.println("ERR usage: $cancel <id>|all");
+    return;
+  }
+  if (strcmp(argv[1], "all") == 0) {
+    block.count = 0;
+    save();
+    out.println("OK");
+    return;
+  }
+  uint16_t id = strtoul(argv[1], nullptr, 10);
+  for (size_t i = 0; i < block.count; i++) {
+    if (heap[i].id == id) {
+      removeAt(i);
+      save();
+      out.println("OK");
+      return;
+    }
+  }
+  out.printf("ERR no move %u\n", id);
+}
+
+FLASHMEM void registerScheduleCommands() {
+  registerCommand("at", atCommand, "at <epoch seconds> <t|b>: schedule a valve move");
+  registerCommand("queue", queueCommand, "list scheduled moves (heap order)");
+  registerCommand("cancel", cancelCommand, "cancel <id>|all: remove scheduled moves");
+}
@@ -0,0 +1,38 @@
+/**
+ * @brief Time-tagged valve moves
+ *
+ * The lander can queue moves for an absolute (synced) RTC time with
+ * "$at <epoch seconds> <t|b>" instead of having to be awake to send 't'/'b'
+ * at the right moment. Pending moves are kept in a bounded min-heap on
+ * deadline and saved to EEPROM on every change so they survive a reboot.
+ * Due moves are executed through setValvePosition(), so the lockout and low
+ * power rules apply exactly as for immediate commands.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+const size_t SCHEDULE_CAPACITY = 16;
+// Moves overdue by more than this (e.g. missed while powered off) are dropped
+const uint32_t SCHEDULE_MAX_LATENESS = 300; // seconds
+const int SCHEDULE_EEPROM_ADDRESS = 128;
+const uint16_t SCHEDULE_VERSION = 1;
+
+struct ScheduledMove {
+  uint32_t deadline; // epoch seconds
+  uint16_t id;
+  uint8_t top;       // 1 = top, 0 = bottom
+};
+
+// Restore the queue from EEPROM
+void scheduleBegin();
+// Peek at the earliest move if it is due. Overdue moves past
+// SCHEDULE_MAX_LATENESS are discarded on the way.
+bool scheduleDue(time_t now, ScheduledMove& move);
+// Remove the move returned by scheduleDue() once it has been carried out
+void schedulePop();
+
+// Registers at, queue and cancel
+void registerScheduleCommands();
@@ -0,0 +1,277 @@
+#include "scrub.h"
+#include "commands.h"
+#include "crc.h"
+#include "energy.h"
+#include "logging.h"
+#include "metrics.h"
+#include "sdpower.h"
+#include "staging.h"
+#include <SD.h>
+
+static const char* const MANIFEST = "/scrub.lst";
+static const char* const CURRENT = "/scrub.cur";
+
+struct ScrubSegment {
+  char path[48];
+  uint32_t start;
+  uint32_t length;
+  uint16_t crc;
+};
+
+static FS* flash = nullptr;
+static ScrubSegment tracked[SCRUB_TRACKED] = {}; // segments being appended
+static uint32_t trackedUse[SCRUB_TRACKED] = {};   // last write, for eviction
+static uint32_t trackedWrites = 0;
+static ScrubSegment checking = {}; // segment being read back
+static File scrubFile;
+static uint32_t checked = 0;
+static uint16_t checkCrc = 0xFFFF;
+static uint32_t cursor = 0;        // manifest line of the segment being read back
+static uint32_t cursorOffset = 0;  // its byte offset in the manifest
+static uint32_t nextOffset = 0;    // offset of the line after it
+static uint32_t passStart = 0;     // seconds
+static bool passDone = false;      // waiting for SCRUB_PASS_INTERVAL
+static bool suspended = false;     // checking is part read, its file closed
+
+static uint32_t segmentsVerified = 0;
+static uint32_t failures = 0;
+static uint32_t passes = 0;
+static uint32_t passFailures = 0;
+// Read latency for the pass in progress and the one before it
+static uint32_t passReads = 0, passMicros = 0, passMaxMicros = 0;
+static uint32_t lastPassAverage = 0, lastPassMax = 0;
+
+static bool parseSegment(const char* text, ScrubSegment& segment) {
+  unsigned long start, length;
+  unsigned crc;
+  if (sscanf(text, "%47s %lu %lu %x", segment.path, &start, &length, &crc) != 4) return false;
+  segment.start = start;
+  segment.length = length;
+  segment.crc = crc;
+  return true;
+}
+
+static void printSegment(Print& out, const ScrubSegment& segment) {
+  out.printf("%s %lu %lu %04x\n", segment.path, (unsigned long)segment.start,
+             (unsigned long)segment.length, segment.crc);
+}
+
+FLASHMEM void scrubBegin() {
+  flash = stagingFlash();
+  if (!flash || !flash->exists(CURRENT)) return;
+  File file = flash->open(CURRENT, FILE_READ);
+  char text[80 * SCRUB_TRACKED] = {0};
+  file.read(text, sizeof(text) - 1);
+  file.close();
+  char* line = text;
+  for (uint8_t i = 0; i < SCRUB_TRACKED && *line; i++) {
+    if (!parseSegment(line, tracked[i])) tracked[i] = {};
+    line += strcspn(line, "\n");
+    if (*line) line++;
+  }
+}
+
+static void seal(ScrubSegment& segment) {
+  if (!segment.length) return;
+  if (flash) {
+    File file = flash->open(MANIFEST, FILE_WRITE);
+    if (file) {
+      printSegment(file, segment);
+      file.close();
+    }
+  }
+  segment.length = 0;
+}
+
+// The slot appending to path, else the least recently written one
+static uint8_t slotFor(const char* path) {
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < SCRUB_TRACKED; i++) {
+    if (strcmp(path, tracked[i].path) == 0) return i;
+    if (trackedUse[i] < trackedUse[oldest]) oldest = i;
+  }
+  return oldest;
+}
+
+void scrubTrack(const char* path, uint32_t offset, const void* data, size_t length) {
+  uint8_t i = slotFor(path);
+  ScrubSegment& segment = tracked[i];
+  if (strcmp(path, segment.path) != 0 || offset != segment.start + segment.length) {
+    seal(segment);
+    strlcpy(segment.path, path, sizeof(segment.path));
+    segment.start = offset;
+    segment.crc = 0xFFFF;
+  }
+  segment.crc = crc16(data, length, segment.crc);
+  segment.length += length;
+  trackedUse[i] = ++trackedWrites;
+  if (!flash) return;
+  File file = flash->open(CURRENT, FILE_WRITE);
+  if (!file) return;
+  file.truncate();
+  for (const ScrubSegment& s : tracked) {
+    if (s.path[0]) printSegment(file, s);
+  }
+  file.close();
+}
+
+static uint32_t seconds() {
+  return millis() / 1000;
+}
+
+// Move the cursor past the segment being read back
+static void advance() {
+  cursor++;
+  cursorOffset = nextOffset;
+}
+
+static void fail(const char* reason) {
+  logEvent("Scrub %s@%lu: %s", checking.path, (unsigned long)checking.start, reason);
+  metricInc(COUNTER_SCRUB_FAILURES);
+  failures++;
+  passFailures++;
+  if (scrubFile) scrubFile.close();
+  advance();
+}
+
+static void endPass() {
+  passes++;
+  lastPassAverage = passReads ? passMicros / passReads : 0;
+  lastPassMax = passMaxMicros;
+  // A clean pass is only counted; its event would itself be a new segment
+  if (passFailures) {
+    logEvent("Scrub pass %lu: %lu segments, %lu failures, read avg %lu us max %lu us",
+             (unsigned long)passes, (unsigned long)cursor, (unsigned long)passFailures,
+             (unsigned long)lastPassAverage, (unsigned long)lastPassMax);
+  }
+  cursor = cursorOffset = 0;
+  passFailures = passReads = passMicros = passMaxMicros = 0;
+  passDone = true;
+}
+
+// Open the segment at the cursor; false when there is nothing to read now
+static bool openNext() {
+  if (passDone) {
+    if (seconds() - passStart < SCRUB_PASS_INTERVAL) return false;
+    passDone = false;
+  }
+  File manifest = flash->open(MANIFEST, FILE_READ);
+  if (!manifest) return false;
+  // The manifest is only appended to, so the cursor's offset stays valid
+  manifest.seek(cursorOffset);
+  char line[80];
+  size_t length = 0;
+  uint32_t offset = cursorOffset;
+  bool found = false;
+  int c;
+  while (!found && (c = manifest.read()) >= 0) {
+    offset++;
+    if (c != '\n' && length < sizeof(line) - 1) {
+      line[length++] = c;
+      continue;
+    }
+    line[length] = '\0';
+    length = 0;
+    found = parseSegment(line, checking);
+    if (!found) cursorOffset = offset; // skip a damaged line
+  }
+  manifest.close();
+  if (!found) {
+    if (cursor) endPass();
+    return false;
+  }
+  nextOffset = offset;
+  if (!cursor) passStart = seconds();
+
+  scrubFile = SD.open(checking.path, FILE_READ);
+  if (!scrubFile) {
+    fail("missing");
+    return false;
+  }
+  if (scrubFile.size() < checking.start + checking.length) {
+    fail("truncated");
+    return false;
+  }
+  scrubFile.seek(checking.start);
+  checked = 0;
+  checkCrc = 0xFFFF;
+  return true;
+}
+
+void scrubStep() {
+  // Stay off a card that is failing writes; staging retries it. A power
+  // gated card is only read while a flush has it awake.
+  if (!flash || !stagingSdHealthy() || !sdPowerAwake()) return;
+  if (!scrubFile && suspended) {
+    suspended = false;
+    scrubFile = SD.open(checking.path, FILE_READ);
+    if (!scrubFile) {
+      fail("missing");
+      return;
+    }
+    scrubFile.seek(checking.start + checked);
+  }
+  if (!scrubFile && !openNext()) return;
+
+  static uint8_t buffer[SCRUB_READ_SIZE];
+  uint32_t budget = SCRUB_BYTES_PER_SECOND;
+  while (budget && checked < checking.length) {
+    uint32_t want = min(min((uint32_t)SCRUB_READ_SIZE, budget), checking.length - checked);
+    uint32_t start = micros();
+    energySet(ENERGY_SD, true);
+    int n = scrubFile.read(buffer, want);
+    energySet(ENERGY_SD, false);
+    uint32_t elapsed = micros() - start;
+    metricObserve(HISTOGRAM_SCRUB_READ_US, elapsed);
+    passReads++;
+    passMicros += elapsed;
+    passMaxMicros = max(passMaxMicros, elapsed);
+    if (n != (int)want) {
+      fail("read error");
+      return;
+    }
+    checkCrc = crc16(buffer, n, checkCrc);
+    checked += n;
+    budget -= n;
+  }
+  if (checked < checking.length) return;
+
+  if (checkCrc != checking.crc) {
+    fail("CRC mismatch");
+    return;
+  }
+  scrubFile.close();
+  segmentsVerified++;
+  advance();
+}
+
+void scrubSuspend() {
+  if (!scrubFile) return;
+  scrubFile.close();
+  suspended = true;
+}
+
+FLASHMEM static void scrubCommand(Print& out, int argc, char* argv[]) {
+  if (!flash) {
+    out.println("ERR no flash manifest");
+    return;
+  }
+  out.printf("verified=%lu failures=%lu passes=%lu\n", (unsigned long)segmentsVerified,
+             (unsigned long)failures, (unsigned long)passes);
+  out.printf("reading %s@%lu %lu/%lu (segment %lu)\n", scrubFile || suspended ? checking.path : "-",
+             (unsigned long)checking.start, (unsigned long)checked, (unsigned long)checking.length,
+             (unsigned long)cursor);
+  if (passDone) {
+    out.printf("next pass in %lus\n", (unsigned long)(SCRUB_PASS_INTERVAL - min(seconds() - passStart, SCRUB_PASS_INTERVAL)));
+  }
+  out.printf("read avg=%lu max=%lu us, last pass avg=%lu max=%lu us\n",
+             (unsigned long)(passReads ? passMicros / passReads : 0), (unsigned long)passMaxMicros,
+             (unsigned long)lastPassAverage, (unsigned long)lastPassMax);
+  for (const ScrubSegment& s : tracked) {
+    if (s.path[0]) out.printf("tracking %s@%lu %lu bytes\n", s.path, (unsigned long)s.start, (unsigned long)s.length);
+  }
+}
+
+FLASHMEM void registerScrubCommands() {
+  registerCommand("scrub", scrubCommand, "SD read-back scrub status and read latency trend");
+}
@@ -0,0 +1,40 @@
+/**
+ * @brief Background read-back scrub of completed SD log files
+ *
+ * Every byte written to an SD log is folded into a running CRC-16 for the
+ * segment of the file being appended. When writing moves on to other files
+ * (or the append offset jumps) the segment is sealed into a manifest in
+ * the staging flash as "path start length crc". The manifest outlives the
+ * card, so the checksums don't rot along with the data.
+ *
+ * scrubStep() re-reads the sealed segments in manifest order, at most
+ * SCRUB_BYTES_PER_SECOND per call, starting a pass at most every
+ * SCRUB_PASS_INTERVAL. It checks each CRC and times every read so slowing
+ * reads show up before outright errors. Mismatches, truncated or missing
+ * files and read errors go into the event log and the scrub_failures
+ * metric; a pass is only logged if it found something.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint32_t SCRUB_BYTES_PER_SECOND = 4096;
+const uint16_t SCRUB_READ_SIZE = 512;
+const uint32_t SCRUB_PASS_INTERVAL = 21600; // seconds from one pass start to the next
+// Files appended at once (the CSV and the binary log) before the least
+// recently written one is sealed
+const uint8_t SCRUB_TRACKED = 2;
+
+// Restore the open segment after a reset; call after stagingBegin()
+void scrubBegin();
+// Record bytes just written at offset in an SD log file
+void scrubTrack(const char* path, uint32_t offset, const void* data, size_t length);
+// Read back the next slice of the manifest; call once a second
+void scrubStep();
+// Close the file being read back, before the card is powered down. The
+// next step reopens it where it left off.
+void scrubSuspend();
+
+// Registers scrub
+void registerScrubCommands();
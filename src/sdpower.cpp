@@ -0,0 +1,165 @@
+#include "sdpower.h"
+#include "commands.h"
+#include "config.h"
+#include "logging.h"
+#include "metrics.h"
+#include "sampler.h"
+#include "scrub.h"
+#include "staging.h"
+#include <SD.h>
+
+#ifdef SD_POWER_PIN
+// Built-in socket SDIO lines: DAT1, DAT0, CLK, CMD, DAT3, DAT2
+static const uint8_t sdioPins[] = {42, 43, 44, 45, 46, 47};
+#endif
+
+static bool awake = false; // mounted, set by sdPowerBegin()
+static uint32_t lastAccess = 0;
+
+// Awake period in progress, metered from a wake to the next power down
+static bool metering = false;
+static uint32_t wakeMicros = 0;
+static uint32_t pointMicros = 0;
+static int pointMa = 0;
+static int idleMa = 0;
+static double chargeMas = 0;
+
+static uint32_t wakes = 0;
+static uint32_t wakeFailures = 0;
+static uint32_t lastWakeUs = 0, maxWakeUs = 0;
+static uint32_t flushes = 0;
+static uint32_t lastAwakeMs = 0;
+static float lastFlushMj = 0;
+static double totalFlushMj = 0;
+
+static void powerOn(bool on) {
+#ifdef SD_POWER_PIN
+  if (!on) {
+    // Don't feed the unpowered card through its I/O protection diodes;
+    // SD.begin() gives the pins back to the SDIO controller
+    for (uint8_t pin : sdioPins) {
+      pinMode(pin, OUTPUT);
+      digitalWriteFast(pin, LOW);
+    }
+  }
+  digitalWriteFast(SD_POWER_PIN, on);
+  if (on) delay(SD_POWER_SETTLE_MS);
+#endif
+}
+
+// Trapezoid step of the charge drawn while awake
+static void integrate() {
+  uint32_t now = micros();
+  int ma = samplerLatestCurrent();
+  chargeMas += (ma + pointMa) / 2.0 * (now - pointMicros) / 1e6;
+  pointMicros = now;
+  pointMa = ma;
+}
+
+static void sleep() {
+  if (metering) integrate();
+  sdClose();
+  scrubSuspend();
+  SD.sdfs.end();
+  powerOn(false);
+  awake = false;
+  if (!metering) return; // awake since boot or since gating was turned on
+  metering = false;
+
+  float seconds = (pointMicros - wakeMicros) / 1e6f;
+  lastAwakeMs = seconds * 1000;
+  lastFlushMj = (chargeMas - idleMa * seconds) * samplerLatestVoltage() / 1000.0;
+  totalFlushMj += lastFlushMj;
+  flushes++;
+}
+
+FLASHMEM bool sdPowerBegin() {
+#ifdef SD_POWER_PIN
+  pinMode(SD_POWER_PIN, OUTPUT);
+  digitalWriteFast(SD_POWER_PIN, HIGH);
+  delay(SD_POWER_SETTLE_MS);
+#endif
+  lastAccess = millis();
+  // A card that didn't mount is retried by the next sdPowerWake()
+  awake = SD.begin(BUILTIN_SDCARD);
+  return awake;
+}
+
+bool sdPowerGated() {
+  return config.sdPowerGate;
+}
+
+bool sdPowerAwake() {
+  return awake;
+}
+
+bool sdPowerWake() {
+  lastAccess = millis();
+  if (awake) {
+    if (metering) integrate();
+    return true;
+  }
+
+  idleMa = samplerLatestCurrent();
+  chargeMas = 0;
+  wakeMicros = pointMicros = micros();
+  pointMa = idleMa;
+  powerOn(true);
+  awake = SD.begin(BUILTIN_SDCARD);
+  lastWakeUs = micros() - wakeMicros;
+  integrate();
+  if (!awake) {
+    wakeFailures++;
+    powerOn(false);
+    return false;
+  }
+  wakes++;
+  metering = true;
+  maxWakeUs = max(maxWakeUs, lastWakeUs);
+  metricObserve(HISTOGRAM_SD_WAKE_US, lastWakeUs);
+  return true;
+}
+
+bool sdPowerRestart() {
+  if (awake) {
+    sdClose();
+    scrubSuspend();
+    SD.sdfs.end();
+#ifdef SD_POWER_PIN
+    powerOn(false);
+    delay(SD_POWER_SETTLE_MS);
+#endif
+    awake = false;
+    metering = false;
+  }
+  return sdPowerWake();
+}
+
+void sdPowerPoll() {
+  if (!config.sdPowerGate) {
+    // Gating just turned off; a failed card is left to the staging retry
+    if (!awake && stagingSdHealthy()) sdPowerWake();
+  } else if (awake && millis() - lastAccess >= SD_POWER_IDLE_MS) {
+    sleep(); // integrates up to the power down
+    return;
+  }
+  // Idle seconds count too, not only the writes
+  if (metering) integrate();
+}
+
+FLASHMEM static void sdPowerCommand(Print& out, int argc, char* argv[]) {
+#ifdef SD_POWER_PIN
+  const char* gate = "switch";
+#else
+  const char* gate = "session only";
+#endif
+  out.printf("gate=%s (%s) card=%s\n", config.sdPowerGate ? "on" : "off", gate, awake ? "awake" : "asleep");
+  out.printf("wakes=%lu failures=%lu wake last=%lu max=%lu us\n", (unsigned long)wakes,
+             (unsigned long)wakeFailures, (unsigned long)lastWakeUs, (unsigned long)maxWakeUs);
+  out.printf("flushes=%lu last awake=%lums %.1fmJ avg %.1fmJ above idle\n", (unsigned long)flushes,
+             (unsigned long)lastAwakeMs, lastFlushMj, flushes ? totalFlushMj / flushes : 0.0);
+}
+
+FLASHMEM void registerSdPowerCommands() {
+  registerCommand("sdpower", sdPowerCommand, "SD card power gating, wake latency and energy per flush");
+}
@@ -0,0 +1,44 @@
+/**
+ * @brief SD card power gating between batched flushes
+ *
+ * With sd_power_gate set, the card is only powered while it is being
+ * written. sdWrite() wakes it on demand (power on, wait for the supply,
+ * re-initialise), and sdPowerPoll() powers it down again once it has been
+ * idle for SD_POWER_IDLE_MS. Staging then holds records for up to
+ * SD_POWER_BATCH_AGE seconds or a full batch, so the card wakes only a few
+ * times an hour; without the flash journal, records wait in a RAM buffer
+ * instead (and are lost on a reset).
+ *
+ * The supply switch is a load switch on SD_POWER_PIN, e.g. a P-FET high
+ * side switch on the card socket's 3.3 V. Without the pin the card stays
+ * powered, but its session is still ended between flushes so it idles in
+ * its lowest standby state. The scrub only reads while the card is awake.
+ *
+ * Each wake is timed (sd_wake_us) and the charge drawn over each awake
+ * period is integrated from the INA260 current; "$sdpower" shows the
+ * latency and the energy per flush above the idle current.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+// #define SD_POWER_PIN 23 // load switch enable for the SD card supply, high = on
+
+const uint32_t SD_POWER_SETTLE_MS = 5;   // supply rise before initialising
+const uint32_t SD_POWER_IDLE_MS = 2000;  // awake after the last write
+const uint32_t SD_POWER_BATCH_AGE = 1200; // seconds a record may wait for the card
+
+// Switch the card's supply on and mount it; false if it didn't come up
+bool sdPowerBegin();
+bool sdPowerGated();
+bool sdPowerAwake();
+// Make sure the card is powered and initialised; false if it didn't come up
+bool sdPowerWake();
+// Re-initialise a failed card, power cycling it where there is a switch
+bool sdPowerRestart();
+// Meter the awake card and power it down once idle; call once a second
+void sdPowerPoll();
+
+// Registers sdpower
+void registerSdPowerCommands();
@@ -0,0 +1,203 @@
+#include "sdprofile.h"
+#include "commands.h"
+#include "loadshed.h"
+#include "logging.h"
+#include "sdpower.h"
+#include "staging.h"
+#include <SD.h>
+#include <stdlib.h>
+
+const uint32_t SD_PROFILE_SIZES[SD_PROFILE_SIZE_COUNT] = {512, 1024, 2048, 4096, 8192, 16384};
+
+static const char* const SCRATCH = "/sdprofile.tmp";
+static const uint32_t MAX_WRITES = SD_PROFILE_BYTES / 512;
+
+DMAMEM static uint8_t buffer[16384];
+DMAMEM static uint32_t latency[MAX_WRITES];
+static uint32_t sorted[MAX_WRITES];
+
+static SdProfile lastProfile = {};
+static SdTuning lastTuning = {STAGING_BATCH_BYTES, STAGING_MAX_AGE};
+
+// Run in progress
+static bool running = false;
+static SdProfile profile = {};
+static File scratch;
+static uint8_t sizeIndex = 0;
+static uint32_t writeIndex = 0;
+static uint32_t total = 0;
+
+static int compareU32(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Spacing of the long stalls in the first pass, as the median gap in bytes
+static uint32_t stallPeriod(uint32_t writes, uint32_t size, uint32_t median, uint16_t& stalls) {
+  uint32_t threshold = max(median * SD_PROFILE_STALL_FACTOR, (uint32_t)1000);
+  uint32_t gaps = 0, last = 0;
+  stalls = 0;
+  for (uint32_t i = 0; i < writes; i++) {
+    if (latency[i] < threshold) continue;
+    if (stalls++) sorted[gaps++] = (i - last) * size;
+    last = i;
+  }
+  if (gaps < 2) return 0;
+  qsort(sorted, gaps, sizeof(sorted[0]), compareU32);
+  return sorted[gaps / 2];
+}
+
+static bool openScratch() {
+  SD.remove(SCRATCH);
+  scratch = SD.open(SCRATCH, FILE_WRITE);
+  writeIndex = 0;
+  total = 0;
+  return scratch;
+}
+
+// Latency and throughput of the size just written
+static void summarise() {
+  uint32_t size = SD_PROFILE_SIZES[sizeIndex];
+  uint32_t writes = SD_PROFILE_BYTES / size;
+  memcpy(sorted, latency, writes * sizeof(latency[0]));
+  qsort(sorted, writes, sizeof(sorted[0]), compareU32);
+  SdSizeProfile& p = profile.sizes[sizeIndex];
+  p.p50 = sorted[writes / 2];
+  p.p99 = sorted[writes * 99 / 100];
+  p.max = sorted[writes - 1];
+  p.kBps = total ? (uint32_t)((uint64_t)SD_PROFILE_BYTES * 1000 / total) : 0;
+  if (sizeIndex == 0) profile.stallPeriod = stallPeriod(writes, size, p.p50, profile.stalls);
+}
+
+static void finish(bool valid) {
+  if (scratch) scratch.close();
+  SD.remove(SCRATCH);
+  running = false;
+  profile.valid = valid;
+  lastProfile = profile;
+  if (!valid) {
+    logEvent("SD profile failed, staging defaults kept");
+    return;
+  }
+  lastTuning = sdProfileTune(lastProfile);
+  stagingSetBatch(lastTuning.batchBytes, lastTuning.maxAge);
+
+  uint32_t minRate = UINT32_MAX, maxRate = 0, worst = 0;
+  for (uint8_t s = 0; s < SD_PROFILE_SIZE_COUNT; s++) {
+    minRate = min(minRate, lastProfile.sizes[s].kBps);
+    maxRate = max(maxRate, lastProfile.sizes[s].kBps);
+    worst = max(worst, lastProfile.sizes[s].max);
+  }
+  logEvent("SD profile: %lu-%lu kB/s, p50 %lu us at 512B, worst %lu us, %u stalls every %lu B; batch %lu B, age %lu s",
+           (unsigned long)minRate, (unsigned long)maxRate, (unsigned long)lastProfile.sizes[0].p50,
+           (unsigned long)worst, lastProfile.stalls, (unsigned long)lastProfile.stallPeriod,
+           (unsigned long)lastTuning.batchBytes, (unsigned long)lastTuning.maxAge);
+}
+
+FLASHMEM bool sdProfileStart() {
+  if (running) return false;
+  profile = {};
+  running = true;
+  sizeIndex = 0;
+  if (!sdPowerWake() || !openScratch()) {
+    finish(false);
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(buffer); i++) buffer[i] = 'a' + i % 26;
+  return true;
+}
+
+void sdProfilePoll() {
+  // The card's write current stays off a servo inrush
+  if (!running || loadShedBusy()) return;
+  if (!sdPowerWake()) {
+    finish(false);
+    return;
+  }
+  uint32_t sliceStart = micros();
+  do {
+    uint32_t size = SD_PROFILE_SIZES[sizeIndex];
+    uint32_t start = micros();
+    bool ok = scratch.write(buffer, size) == size;
+    scratch.flush();
+    latency[writeIndex] = micros() - start;
+    total += latency[writeIndex];
+    if (!ok) {
+      finish(false);
+      return;
+    }
+    if (++writeIndex < SD_PROFILE_BYTES / size) continue;
+
+    scratch.close();
+    summarise();
+    if (++sizeIndex == SD_PROFILE_SIZE_COUNT) {
+      finish(true);
+      return;
+    }
+    if (!openScratch()) {
+      finish(false);
+      return;
+    }
+  } while (micros() - sliceStart < SD_PROFILE_SLICE_US);
+}
+
+bool sdProfileRunning() {
+  return running;
+}
+
+SdTuning sdProfileTune(const SdProfile& profile) {
+  SdTuning tuning = {STAGING_BATCH_BYTES, STAGING_MAX_AGE};
+  if (!profile.valid) return tuning;
+
+  // Smallest size within 90% of the best throughput
+  uint32_t best = 0;
+  for (uint8_t s = 0; s < SD_PROFILE_SIZE_COUNT; s++) best = max(best, profile.sizes[s].kBps);
+  uint8_t chosen = SD_PROFILE_SIZE_COUNT - 1;
+  for (uint8_t s = 0; s < SD_PROFILE_SIZE_COUNT; s++) {
+    if (profile.sizes[s].kBps * 10 >= best * 9) {
+      chosen = s;
+      break;
+    }
+  }
+  tuning.batchBytes = SD_PROFILE_SIZES[chosen];
+
+  // Cover a whole stall period per batch, so each migration takes at most one
+  // erase stall instead of one every few writes
+  if (profile.stallPeriod > tuning.batchBytes) {
+    while (chosen + 1 < SD_PROFILE_SIZE_COUNT && SD_PROFILE_SIZES[chosen] < profile.stallPeriod) chosen++;
+    tuning.batchBytes = SD_PROFILE_SIZES[chosen];
+  }
+
+  // Cards with long worst-case writes are touched less often
+  uint32_t p99 = profile.sizes[chosen].p99;
+  if (p99 >= 100000) tuning.maxAge = STAGING_MAX_AGE * 2;
+  else if (p99 < 10000) tuning.maxAge = STAGING_MAX_AGE / 2;
+  return tuning;
+}
+
+FLASHMEM static void sdProfileCommand(Print& out, int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "run") == 0) {
+    out.println(sdProfileStart() ? "OK profiling" : "ERR profile already running");
+    return;
+  }
+  if (running) {
+    out.printf("profiling %luB: %lu/%lu writes\n", (unsigned long)SD_PROFILE_SIZES[sizeIndex],
+               (unsigned long)writeIndex, (unsigned long)(SD_PROFILE_BYTES / SD_PROFILE_SIZES[sizeIndex]));
+  }
+  if (!lastProfile.valid) {
+    out.println("ERR no SD profile");
+    return;
+  }
+  for (uint8_t s = 0; s < SD_PROFILE_SIZE_COUNT; s++) {
+    const SdSizeProfile& p = lastProfile.sizes[s];
+    out.printf("%5luB p50=%lu p99=%lu max=%lu us %lu kB/s\n", (unsigned long)SD_PROFILE_SIZES[s],
+               (unsigned long)p.p50, (unsigned long)p.p99, (unsigned long)p.max, (unsigned long)p.kBps);
+  }
+  out.printf("stalls=%u period=%luB batch=%luB max_age=%lus\n", lastProfile.stalls,
+             (unsigned long)lastProfile.stallPeriod, (unsigned long)lastTuning.batchBytes,
+             (unsigned long)lastTuning.maxAge);
+}
+
+FLASHMEM void registerSdProfileCommands() {
+  registerCommand("sdprofile", sdProfileCommand, "sdprofile [run]: SD write latency profile and staging tuning");
+}
@@ -0,0 +1,59 @@
+/**
+ * @brief SD card write characterization and staging auto-tune
+ *
+ * Cards in the fleet differ widely in write latency. At boot (and on
+ * "$sdprofile run") a scratch file is written sequentially at each size in
+ * SD_PROFILE_SIZES, timing every write+flush. The results give a latency
+ * distribution per size, the throughput knee, and the spacing of the long
+ * stalls a card takes when it erases or remaps a block.
+ *
+ * The run is a state machine advanced by sdProfilePoll() from the tick, a
+ * slice of about SD_PROFILE_SLICE_US at a time, so the tick and valve
+ * control keep running. Staging keeps its defaults until the run is done.
+ *
+ * sdProfileTune() turns a profile into a staging batch size and migration
+ * age. It is a pure function of the profile so the decision can be
+ * reproduced off-target from logged numbers.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t SD_PROFILE_SIZE_COUNT = 6;
+extern const uint32_t SD_PROFILE_SIZES[SD_PROFILE_SIZE_COUNT];
+const uint32_t SD_PROFILE_BYTES = 128 * 1024; // written at each size
+// A write is a stall if it takes this many times the median, and >= 1 ms
+const uint8_t SD_PROFILE_STALL_FACTOR = 4;
+// Writes per poll stop once this much time has gone (at least one write)
+const uint32_t SD_PROFILE_SLICE_US = 2000;
+
+struct SdSizeProfile {
+  uint32_t p50;  // us per write+flush
+  uint32_t p99;
+  uint32_t max;
+  uint32_t kBps; // sequential throughput at this size
+};
+
+struct SdProfile {
+  bool valid;
+  SdSizeProfile sizes[SD_PROFILE_SIZE_COUNT];
+  uint32_t stallPeriod; // bytes between stalls at the smallest size, 0 if none seen
+  uint16_t stalls;
+};
+
+struct SdTuning {
+  uint32_t batchBytes;
+  uint32_t maxAge; // seconds
+};
+
+SdTuning sdProfileTune(const SdProfile& profile);
+// Start a run; false if one is already running. When it finishes, the
+// staging batch is tuned and the profile recorded in the event log.
+bool sdProfileStart();
+// Advance a run by one slice; call every tick
+void sdProfilePoll();
+bool sdProfileRunning();
+
+// Registers sdprofile
+void registerSdProfileCommands();
@@ -0,0 +1,133 @@
+#include "spectrum.h"
+#include "sysinfo.h"
+
+#if defined(__IMXRT1062__)
+#include <arm_math.h>
+#define SPECTRUM_USE_CMSIS
+#endif
+
+const uint16_t BINS = SPECTRUM_SIZE / 2;
+
+static float window[SPECTRUM_SIZE];
+static float windowPower = 0;              // sum of w^2, for scaling
+DMAMEM static float frame[SPECTRUM_SIZE];
+DMAMEM static float fftOut[SPECTRUM_SIZE];
+DMAMEM static float power[BINS];
+static float accumulated[BINS];
+static uint16_t blocksAccumulated = 0;
+static uint32_t accumulatedPeriod = 0;
+
+#ifdef SPECTRUM_USE_CMSIS
+static arm_rfft_fast_instance_f32 rfft;
+#else
+// Portable fallback: in-place complex radix-2 FFT on separate re/im arrays
+static void fftComplex(float* re, float* im, uint16_t n) {
+  for (uint16_t i = 1, j = 0; i < n; i++) {
+    uint16_t bit = n >> 1;
+    for (; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      float t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for (uint16_t len = 2; len <= n; len <<= 1) {
+    float angle = -2 * M_PI / len;
+    float wr = cosf(angle), wi = sinf(angle);
+    for (uint16_t i = 0; i < n; i += len) {
+      float cr = 1, ci = 0;
+      for (uint16_t k = 0; k < len / 2; k++) {
+        uint16_t a = i + k, b = a + len / 2;
+        float tr = re[b] * cr - im[b] * ci;
+        float ti = re[b] * ci + im[b] * cr;
+        re[b] = re[a] - tr; im[b] = im[a] - ti;
+        re[a] += tr; im[a] += ti;
+        float nr = cr * wr - ci * wi;
+        ci = cr * wi + ci * wr;
+        cr = nr;
+      }
+    }
+  }
+}
+#endif
+
+// |X[k]|^2 for k = 0..BINS-1 of the real input in frame[]
+static void powerSpectrum() {
+#ifdef SPECTRUM_USE_CMSIS
+  arm_mult_f32(frame, window, frame, SPECTRUM_SIZE);
+  arm_rfft_fast_f32(&rfft, frame, fftOut, 0);
+  // fftOut[1] packs the Nyquist term; drop it so bin 0 is pure DC
+  fftOut[1] = 0;
+  arm_cmplx_mag_squared_f32(fftOut, power, BINS);
+#else
+  float* re = frame;
+  float* im = fftOut;
+  for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) {
+    re[i] *= window[i];
+    im[i] = 0;
+  }
+  fftComplex(re, im, SPECTRUM_SIZE);
+  for (uint16_t k = 0; k < BINS; k++) power[k] = re[k] * re[k] + im[k] * im[k];
+#endif
+}
+
+FLASHMEM void spectrumBegin() {
+  windowPower = 0;
+  for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / SPECTRUM_SIZE);
+    windowPower += window[i] * window[i];
+  }
+#ifdef SPECTRUM_USE_CMSIS
+  arm_rfft_fast_init_f32(&rfft, SPECTRUM_SIZE);
+#endif
+}
+
+void spectrumAddBlock(const SampleBlock& block) {
+  // Partial blocks are left over from a rate change
+  if (block.count != SPECTRUM_SIZE) return;
+  if (block.periodCycles != accumulatedPeriod) {
+    memset(accumulated, 0, sizeof(accumulated));
+    blocksAccumulated = 0;
+    accumulatedPeriod = block.periodCycles;
+  }
+
+  float mean = 0;
+  for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) mean += block.current[i];
+  mean /= SPECTRUM_SIZE;
+  for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) frame[i] = block.current[i] - mean;
+
+  powerSpectrum();
+  for (uint16_t k = 0; k < BINS; k++) accumulated[k] += power[k];
+  blocksAccumulated++;
+}
+
+SpectrumSummary spectrumTake() {
+  SpectrumSummary s;
+  memset(&s, 0, sizeof(s));
+  s.blocks = blocksAccumulated;
+  if (!blocksAccumulated) return s;
+
+  s.sampleRateHz = (float)F_CPU_ACTUAL / accumulatedPeriod;
+  float binHz = s.sampleRateHz / SPECTRUM_SIZE;
+  // One-sided spectrum scaled so band powers sum to the ripple variance
+  float scale = 2.0f / (blocksAccumulated * windowPower * SPECTRUM_SIZE);
+
+  uint16_t peak = 1;
+  for (uint16_t k = 1; k < BINS; k++) {
+    if (accumulated[k] > accumulated[peak]) peak = k;
+    uint8_t band = (uint32_t)(k - 1) * SPECTRUM_BANDS / (BINS - 1);
+    s.bandPower[band] += accumulated[k] * scale;
+  }
+  // Parabolic interpolation between neighbouring bins
+  float offset = 0;
+  if (peak > 1 && peak < BINS - 1) {
+    float a = accumulated[peak - 1], b = accumulated[peak], c = accumulated[peak + 1];
+    float denominator = a - 2 * b + c;
+    if (denominator != 0) offset = 0.5f * (a - c) / denominator;
+  }
+  s.dominantHz = (peak + offset) * binHz;
+
+  memset(accumulated, 0, sizeof(accumulated));
+  blocksAccumulated = 0;
+  return s;
+}
@@ -0,0 +1,33 @@
+/**
+ * @brief Current ripple spectrum from the sampled INA260 current
+ *
+ * Each sample block is mean-removed, Hann windowed and transformed with a
+ * real FFT; power spectra are averaged over the log interval (Welch). At
+ * each log record the averaged spectrum is reduced to the dominant ripple
+ * frequency and the power in SPECTRUM_BANDS equal-width bands, so pump
+ * wear and cavitation trends can be logged without raw waveforms.
+ *
+ * On the Teensy the FFT, window and magnitude kernels come from CMSIS-DSP
+ * (arm_math, shipped with the Teensy core). Other builds use a portable
+ * scalar radix-2 FFT.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include "sampler.h"
+
+const uint16_t SPECTRUM_SIZE = SAMPLE_BLOCK_SIZE;
+const uint8_t SPECTRUM_BANDS = 8;
+
+struct SpectrumSummary {
+  uint16_t blocks;                 // FFTs averaged; 0 means no data
+  float sampleRateHz;
+  float dominantHz;                // strongest non-DC component
+  float bandPower[SPECTRUM_BANDS]; // mA^2 per band, DC excluded
+};
+
+void spectrumBegin();
+void spectrumAddBlock(const SampleBlock& block);
+// Summarise and reset the running average
+SpectrumSummary spectrumTake();
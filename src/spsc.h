@@ -0,0 +1,51 @@
+/**
+ * @brief Lock-free single-producer/single-consumer ring
+ *
+ * One side (typically an ISR) only pushes and the other (the main loop) only
+ * pops, so no locking is needed: each index is written by one side only and
+ * the barrier orders the slot write before the index update. A push onto a
+ * full ring is dropped and counted rather than overwriting unread items.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+template <typename T, uint32_t N>
+class SpscQueue {
+  static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+  bool push(const T& item) {
+    uint32_t h = head;
+    if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == N) {
+      dropped++;
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+    uint32_t depth = h + 1 - tail;
+    if (depth > highWater) highWater = depth;
+    return true;
+  }
+
+  bool pop(T& item) {
+    uint32_t t = tail;
+    if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return false;
+    item = items[t & (N - 1)];
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool empty() const { return __atomic_load_n(&head, __ATOMIC_ACQUIRE) == tail; }
+  uint32_t pushed() const { return head; }
+  uint32_t drops() const { return dropped; }
+  uint32_t maxDepth() const { return highWater; }
+
+private:
+  T items[N];
+  volatile uint32_t head = 0;
+  volatile uint32_t tail = 0;
+  volatile uint32_t dropped = 0;
+  volatile uint32_t highWater = 0;
+};
@@ -0,0 +1,334 @@
+#include "staging.h"
+#include "commands.h"
+#include "logging.h"
+#include "sdpower.h"
+#include <LittleFS.h>
+#include <TimeLib.h>
+
+static const char* const JOURNAL = "/journal.txt";
+static const char* const POSITION = "/journal.pos";
+
+static LittleFS_Program flash;
+static bool flashReady = false;
+static File journal;
+static char journalTarget[48] = {0}; // target of the last "@" line written
+static uint32_t stagedBytes = 0;     // bytes in the journal not yet migrated
+static time_t stagedSince = 0;       // when the oldest of them was appended
+static bool migrating = false;       // a bounded migration has more to copy
+static bool unflushed = false;
+static time_t flushedAt = 0;
+
+static uint32_t batchBytes = STAGING_BATCH_BYTES;
+static uint32_t maxAge = STAGING_MAX_AGE;
+
+static bool sdHealthy = true;
+static time_t sdRetryAt = 0;
+
+static uint32_t recordsStaged = 0;
+static uint32_t bytesMigrated = 0;
+static uint32_t migrations = 0;
+static uint32_t migrationFailures = 0;
+static uint32_t journalFull = 0;
+
+// One SD batch; DMAMEM keeps it out of the tightly coupled RAM
+DMAMEM static char batch[STAGING_BATCH_MAX];
+static size_t batchUsed = 0;
+
+// Without the journal, records for a power gated card wait here
+DMAMEM static char ramBuffer[STAGING_BATCH_MAX];
+static size_t ramUsed = 0;
+static char ramTarget[48] = {0};
+static time_t ramSince = 0;
+
+static bool openJournal() {
+  journal = flash.open(JOURNAL, FILE_WRITE);
+  journalTarget[0] = '\0'; // a fresh handle always restates its target
+  return journal;
+}
+
+FLASHMEM bool stagingBegin() {
+  flashReady = flash.begin(STAGING_FLASH_BYTES) && openJournal();
+  if (!flashReady) {
+    Serial.println("Flash staging unavailable, logging straight to SD");
+    return false;
+  }
+  // Anything left from before a reset migrates with the first batch
+  stagedBytes = journal.size();
+  if (flash.exists(POSITION)) {
+    File pos = flash.open(POSITION, FILE_READ);
+    char text[64] = {0};
+    pos.read(text, sizeof(text) - 1);
+    pos.close();
+    unsigned long offset = strtoul(text, nullptr, 10);
+    if (offset < stagedBytes) {
+      stagedBytes -= offset;
+    } else if (offset == stagedBytes) {
+      // Copied in full; the reset came before the journal was removed
+      journal.close();
+      flash.remove(POSITION);
+      flash.remove(JOURNAL);
+      stagedBytes = 0;
+      if (!openJournal()) {
+        flashReady = false;
+        Serial.println("Flash journal lost, logging straight to SD");
+        return false;
+      }
+    } else {
+      // Left from a journal that is gone; it would skip into this one
+      flash.remove(POSITION);
+    }
+  }
+  if (stagedBytes) stagedSince = now();
+  return true;
+}
+
+static bool flushRam() {
+  if (!ramUsed) return true;
+  if (!sdHealthy || !sdWrite(ramTarget, ramBuffer, ramUsed)) return false;
+  bytesMigrated += ramUsed;
+  migrations++;
+  ramUsed = 0;
+  return true;
+}
+
+static bool bufferInRam(const char* path, const char* text, size_t length) {
+  if (ramUsed && (strcmp(path, ramTarget) != 0 || ramUsed + length > sizeof(ramBuffer))) {
+    // A full buffer that can't be written drops its oldest records
+    if (!flushRam()) ramUsed = 0;
+  }
+  if (length > sizeof(ramBuffer)) return sdHealthy && sdWrite(path, text, length);
+  if (!ramUsed) {
+    strlcpy(ramTarget, path, sizeof(ramTarget));
+    ramSince = now();
+  }
+  memcpy(ramBuffer + ramUsed, text, length);
+  ramUsed += length;
+  recordsStaged++;
+  return true;
+}
+
+bool stagingAppend(const char* path, const char* text) {
+  size_t length = strlen(text);
+  if (!flashReady) {
+    if (sdPowerGated() || ramUsed) return bufferInRam(path, text, length);
+    return sdWrite(path, text, length);
+  }
+
+  for (int attempt = 0; attempt < 2; attempt++) {
+    bool ok = true;
+    if (strcmp(path, journalTarget) != 0) {
+      ok = journal.printf("@%s\n", path) > 0;
+      if (ok) strlcpy(journalTarget, path, sizeof(journalTarget));
+    }
+    ok = ok && journal.write(text, length) == length;
+    // LittleFS commits on flush; stagingMigrate() flushes periodically
+    if (!unflushed) flushedAt = now();
+    unflushed = true;
+    if (ok) {
+      if (!stagedBytes) stagedSince = now();
+      stagedBytes += length;
+      recordsStaged++;
+      return true;
+    }
+    // Journal full: empty it into SD and try once more
+    journalFull++;
+    journalTarget[0] = '\0';
+    if (attempt == 0) stagingMigrate(true);
+  }
+  return sdHealthy && sdWrite(path, text, length);
+}
+
+static void savePosition(uint32_t offset, const char* target) {
+  File pos = flash.open(POSITION, FILE_WRITE);
+  if (!pos) return;
+  pos.truncate();
+  pos.printf("%lu %s\n", (unsigned long)offset, target);
+  pos.close();
+}
+
+// Restore the checkpoint left by an interrupted migration
+static uint32_t loadPosition(char* target, size_t size) {
+  target[0] = '\0';
+  if (!flash.exists(POSITION)) return 0;
+  File pos = flash.open(POSITION, FILE_READ);
+  char text[80] = {0};
+  pos.read(text, sizeof(text) - 1);
+  pos.close();
+  char* rest;
+  uint32_t offset = strtoul(text, &rest, 10);
+  if (*rest == ' ') {
+    strlcpy(target, rest + 1, size);
+    target[strcspn(target, "\n")] = '\0';
+  }
+  return offset;
+}
+
+static bool writeBatch(const char* target) {
+  if (!batchUsed) return true;
+  if (!target[0]) {
+    batchUsed = 0; // lines with no target have nowhere to go
+    return true;
+  }
+  if (!sdWrite(target, batch, batchUsed)) return false;
+  bytesMigrated += batchUsed;
+  batchUsed = 0;
+  return true;
+}
+
+enum MigrateResult { MIGRATE_DONE, MIGRATE_MORE, MIGRATE_FAILED };
+
+// Copy the journal to SD from the last checkpoint, batch by batch, stopping
+// at a checkpoint once budget bytes have been read
+static MigrateResult migrate(uint32_t budget, uint32_t& offset) {
+  char target[48];
+  offset = loadPosition(target, sizeof(target));
+  File in = flash.open(JOURNAL, FILE_READ);
+  if (!in) return MIGRATE_DONE;
+  if (offset > in.size()) {
+    offset = 0; // not this journal's checkpoint
+    target[0] = '\0';
+  }
+  in.seek(offset);
+  uint32_t start = offset;
+
+  char line[256];
+  size_t length = 0;
+  bool ok = true;
+  int c;
+  while (ok) {
+    if (!length && in.position() - start >= budget) {
+      ok = writeBatch(target);
+      if (!ok) break;
+      offset = in.position();
+      savePosition(offset, target);
+      in.close();
+      return MIGRATE_MORE;
+    }
+    if ((c = in.read()) < 0) break;
+    line[length++] = c;
+    if (c != '\n' && length < sizeof(line) - 1) continue;
+    line[length] = '\0';
+    if (line[0] == '@') {
+      ok = writeBatch(target);
+      if (ok) {
+        strlcpy(target, line + 1, sizeof(target));
+        target[strcspn(target, "\n")] = '\0';
+        savePosition(in.position(), target);
+      }
+    } else {
+      if (batchUsed + length > batchBytes) {
+        ok = writeBatch(target);
+        if (ok) savePosition(in.position() - length, target);
+      }
+      if (ok) {
+        memcpy(batch + batchUsed, line, length);
+        batchUsed += length;
+      }
+    }
+    length = 0;
+  }
+  ok = ok && writeBatch(target);
+  in.close();
+  batchUsed = 0;
+  return ok ? MIGRATE_DONE : MIGRATE_FAILED;
+}
+
+// A power gated card is woken for full batches or at the longer age
+static bool batchDue(uint32_t bytes, time_t since, time_t t) {
+  if (sdPowerGated()) return bytes >= STAGING_BATCH_MAX || t - since >= (time_t)max(maxAge, SD_POWER_BATCH_AGE);
+  return bytes >= batchBytes || t - since >= (time_t)maxAge;
+}
+
+static bool sdUsable(time_t t) {
+  if (sdHealthy) return true;
+  if (t < sdRetryAt) return false;
+  sdHealthy = sdPowerRestart();
+  if (!sdHealthy) sdRetryAt = t + STAGING_SD_RETRY;
+  return sdHealthy;
+}
+
+void stagingMigrate(bool force) {
+  time_t t = now();
+  if (!flashReady) {
+    if (!ramUsed || !(force || batchDue(ramUsed, ramSince, t)) || !sdUsable(t)) return;
+    if (!flushRam()) {
+      migrationFailures++;
+      sdHealthy = false;
+      sdRetryAt = t + STAGING_SD_RETRY;
+    }
+    return;
+  }
+  if (unflushed && t - flushedAt >= (time_t)STAGING_FLUSH_INTERVAL) {
+    journal.flush();
+    unflushed = false;
+  }
+  if (!stagedBytes) return;
+  if (!force && !migrating && !batchDue(stagedBytes, stagedSince, t)) return;
+  if (!sdUsable(t)) return;
+
+  journal.close(); // flushes
+  unflushed = false;
+  uint32_t offset = 0;
+  MigrateResult result = migrate(force ? UINT32_MAX : STAGING_MIGRATE_BYTES, offset);
+  migrating = result == MIGRATE_MORE;
+  if (result == MIGRATE_DONE) {
+    // Checkpoint first: a reset in between re-copies the journal rather
+    // than leaving an offset into the next one
+    flash.remove(POSITION);
+    flash.remove(JOURNAL);
+    stagedBytes = 0;
+    migrations++;
+  } else if (result == MIGRATE_FAILED) {
+    // Keep staging in flash; the checkpoint resumes the copy next time
+    migrationFailures++;
+    sdHealthy = false;
+    sdRetryAt = t + STAGING_SD_RETRY;
+  }
+  if (!openJournal()) {
+    flashReady = false;
+    Serial.println("Flash journal lost, logging straight to SD");
+    return;
+  }
+  if (migrating) stagedBytes = journal.size() > offset ? journal.size() - offset : 0;
+}
+
+FLASHMEM void stagingSetBatch(uint32_t bytes, uint32_t age) {
+  batchBytes = constrain(bytes, (uint32_t)512, STAGING_BATCH_MAX);
+  maxAge = age;
+}
+
+FS* stagingFlash() {
+  return flashReady ? &flash : nullptr;
+}
+
+bool stagingSdHealthy() {
+  return sdHealthy;
+}
+
+FLASHMEM static void stagingCommand(Print& out, int argc, char* argv[]) {
+  out.printf("flash=%s sd=%s staged=%lu age=%lds%s\n", flashReady ? "ok" : "off",
+             sdHealthy ? "ok" : "retrying", (unsigned long)stagedBytes,
+             stagedBytes ? (long)(now() - stagedSince) : 0L, migrating ? " migrating" : "");
+  out.printf("records=%lu migrated=%lu migrations=%lu failures=%lu full=%lu\n",
+             (unsigned long)recordsStaged, (unsigned long)bytesMigrated,
+             (unsigned long)migrations, (unsigned long)migrationFailures,
+             (unsigned long)journalFull);
+  out.printf("batch=%lu max_age=%lus%s\n", (unsigned long)batchBytes, (unsigned long)maxAge,
+             sdPowerGated() ? " (power gated)" : "");
+  if (flashReady) {
+    out.printf("flash used=%lu/%lu\n", (unsigned long)flash.usedSize(), (unsigned long)flash.totalSize());
+  } else {
+    out.printf("ram=%lu/%u\n", (unsigned long)ramUsed, (unsigned)sizeof(ramBuffer));
+  }
+}
+
+FLASHMEM static void flushCommand(Print& out, int argc, char* argv[]) {
+  sdRetryAt = 0; // an explicit flush retries a failed card immediately
+  stagingMigrate(true);
+  out.println(stagedBytes || ramUsed ? "ERR migration incomplete" : "OK");
+}
+
+FLASHMEM void registerStagingCommands() {
+  registerCommand("staging", stagingCommand, "flash staging journal status");
+  registerCommand("flush", flushCommand, "migrate staged records to SD now");
+}
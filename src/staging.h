@@ -0,0 +1,55 @@
+/**
+ * @brief Flash staging journal for log records
+ *
+ * Records are committed first to a journal in the Teensy 4.1's spare
+ * program flash (LittleFS, which spreads wear across the area), then
+ * migrated to the SD card in large batches. A slow or failed card can no
+ * longer lose records: while it is unusable the journal is the primary
+ * store, and the card is retried every STAGING_SD_RETRY seconds.
+ *
+ * The journal is plain text. A line "@<path>" switches the target file for
+ * the lines after it. Migration checkpoints its progress in a small
+ * position file after every batch written to SD, so a reset mid-migration
+ * repeats at most one batch. Each call copies at most
+ * STAGING_MIGRATE_BYTES and the next one resumes from the checkpoint, so a
+ * backlog after an SD outage drains over several seconds instead of
+ * stalling the loop.
+ *
+ * The journal is flushed every STAGING_FLUSH_INTERVAL rather than after
+ * every record, to spare the program flash a metadata commit per record.
+ * A reset or brown-out can therefore lose up to that many seconds of
+ * records that hadn't reached the SD card yet.
+ *
+ * Without the journal, records go straight to SD, except while the card is
+ * power gated (see sdpower.h): then they wait for a batch in RAM.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+const uint32_t STAGING_FLASH_BYTES = 1024 * 1024;
+// Migrate once this much is staged, or once the oldest record is this old.
+// These are defaults; the SD card profile tunes them at boot.
+const uint32_t STAGING_BATCH_BYTES = 4096;
+const uint32_t STAGING_BATCH_MAX = 16384;
+const uint32_t STAGING_MAX_AGE = 600;  // seconds
+const uint32_t STAGING_SD_RETRY = 60;  // seconds
+const uint32_t STAGING_MIGRATE_BYTES = 2 * STAGING_BATCH_MAX; // per call
+const uint32_t STAGING_FLUSH_INTERVAL = 60; // seconds
+
+bool stagingBegin();
+bool stagingAppend(const char* path, const char* text);
+// Move staged records to SD when a batch is due; call once a second. A
+// forced migration copies everything at once.
+void stagingMigrate(bool force = false);
+// Set the SD batch size (clamped to STAGING_BATCH_MAX) and migration age
+void stagingSetBatch(uint32_t bytes, uint32_t maxAge);
+// The journal's flash filesystem, or nullptr if it failed to mount
+FS* stagingFlash();
+// False while the SD card has failed and is waiting for a retry
+bool stagingSdHealthy();
+
+// Registers staging and flush
+void registerStagingCommands();
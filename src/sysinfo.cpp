@@ -0,0 +1,121 @@
+#include "sysinfo.h"
+#include "commands.h"
+#include "metrics.h"
+#include "trace.h"
+
+// Provided by the Teensy 4 linker script: the stack grows down from
+// _estack towards the end of DTCM data
+extern unsigned long _ebss;
+extern unsigned long _estack;
+extern unsigned long _stext;
+extern unsigned long _etext;
+extern unsigned long _sdata;
+extern unsigned long _heap_start;
+extern unsigned long _heap_end;
+
+const uint32_t STACK_PAINT = 0xA5A5A5A5;
+// Leave the live frames of setup() and its callers untouched
+const size_t STACK_PAINT_MARGIN = 256;
+
+const char* const loopTaskNames[TASK_COUNT] = {
+  "time", "commands", "low_power_check", "valve", "filename", "log_power", "metrics", "samples", "staging", "scrub",
+  "battery",
+};
+
+static uint32_t loopStartCycles = 0;
+static LoopTask currentTask = TASK_TIME;
+static uint32_t taskStartCycles = 0;
+static LoopTask slowestTask = TASK_TIME;
+static uint32_t slowestCycles = 0;
+static LoopTask lastSlowestTask = TASK_TIME;
+static uint32_t lastSlowestCycles = 0;
+static uint32_t loopMaxCycles = 0;
+static uint64_t loopTotalCycles = 0;
+static uint32_t loopCount = 0;
+
+FLASHMEM void sysinfoBegin() {
+  uint32_t* p = (uint32_t*)&_ebss;
+  uint32_t* end = (uint32_t*)((uint8_t*)__builtin_frame_address(0) - STACK_PAINT_MARGIN);
+  while (p < end) *p++ = STACK_PAINT;
+}
+
+HOTPATH void loopTimingStart() {
+  loopStartCycles = ARM_DWT_CYCCNT;
+  taskStartCycles = loopStartCycles;
+  currentTask = TASK_TIME;
+  slowestCycles = 0;
+  TRACE_BEGIN(TRACE_LOOP, 0);
+  TRACE_BEGIN(TRACE_TASK, TASK_TIME);
+}
+
+HOTPATH void loopTask(LoopTask task) {
+  uint32_t now = ARM_DWT_CYCCNT;
+  uint32_t cycles = now - taskStartCycles;
+  if (cycles > slowestCycles) {
+    slowestCycles = cycles;
+    slowestTask = currentTask;
+  }
+  TRACE_END(TRACE_TASK, currentTask);
+  TRACE_BEGIN(TRACE_TASK, task);
+  currentTask = task;
+  taskStartCycles = now;
+}
+
+LoopTask lastPassSlowestTask(uint32_t& cycles) {
+  cycles = lastSlowestCycles;
+  return lastSlowestTask;
+}
+
+HOTPATH void loopTimingEnd() {
+  loopTask(TASK_TIME);
+  TRACE_END(TRACE_TASK, TASK_TIME);
+  TRACE_END(TRACE_LOOP, 0);
+  lastSlowestTask = slowestTask;
+  lastSlowestCycles = slowestCycles;
+
+  uint32_t cycles = ARM_DWT_CYCCNT - loopStartCycles;
+  if (cycles > loopMaxCycles) loopMaxCycles = cycles;
+  metricObserve(HISTOGRAM_LOOP_US, cycles / (F_CPU_ACTUAL / 1000000));
+  loopTotalCycles += cycles;
+  loopCount++;
+}
+
+uint32_t loopMaxMicros() {
+  return loopMaxCycles / (F_CPU_ACTUAL / 1000000);
+}
+
+FLASHMEM size_t stackHighWater() {
+  uint32_t* p = (uint32_t*)&_ebss;
+  uint32_t* top = (uint32_t*)&_estack;
+  while (p < top && *p == STACK_PAINT) p++;
+  return (uint8_t*)top - (uint8_t*)p;
+}
+
+FLASHMEM static void memCommand(Print& out, int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    loopMaxCycles = 0;
+    loopTotalCycles = 0;
+    loopCount = 0;
+  }
+  size_t stackSize = (uint8_t*)&_estack - (uint8_t*)&_ebss;
+  out.printf("itcm_code=%u dtcm_data=%u stack=%u/%u ram2_heap=%u\n",
+             (unsigned)((uint8_t*)&_etext - (uint8_t*)&_stext),
+             (unsigned)((uint8_t*)&_ebss - (uint8_t*)&_sdata),
+             (unsigned)stackHighWater(), (unsigned)stackSize,
+             (unsigned)((uint8_t*)&_heap_end - (uint8_t*)&_heap_start));
+  uint32_t cyclesPerMicro = F_CPU_ACTUAL / 1000000;
+  out.printf("loop passes=%lu max=%lu cycles (%lu us) avg=%lu cycles%s\n",
+             (unsigned long)loopCount, (unsigned long)loopMaxCycles,
+             (unsigned long)(loopMaxCycles / cyclesPerMicro),
+             (unsigned long)(loopCount ? loopTotalCycles / loopCount : 0),
+#ifdef HOT_PATH_IN_FLASH
+             " hotpath=flash"
+#else
+             " hotpath=itcm"
+#endif
+  );
+}
+
+FLASHMEM void registerSysinfoCommands() {
+  registerCommand("mem", memCommand, "mem [reset]: memory use, stack high-water, loop cycles");
+}
@@ -0,0 +1,58 @@
+/**
+ * @brief Memory placement and loop timing diagnostics
+ *
+ * On the Teensy 4.1 code runs from ITCM unless marked FLASHMEM, and ITCM
+ * and DTCM share the 512K RAM1 in 32K banks. Control-path code and ISRs are
+ * marked HOTPATH so they stay in ITCM; setup and command handling are
+ * marked FLASHMEM, which shrinks ITCM and leaves more RAM1 for DTCM data and
+ * stack. Large buffers go in RAM2 with DMAMEM.
+ *
+ * Build with -DHOT_PATH_IN_FLASH to move the HOTPATH code to flash instead;
+ * comparing the worst-case loop cycles reported by $mem between the two
+ * builds shows what the placement buys.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifdef HOT_PATH_IN_FLASH
+#define HOTPATH FLASHMEM
+#else
+#define HOTPATH FASTRUN
+#endif
+
+// Fill unused stack with a pattern so the high-water mark can be measured.
+// Call first thing in setup().
+void sysinfoBegin();
+// What loop() is doing, so latency outliers can be blamed on a task
+enum LoopTask : uint8_t {
+  TASK_TIME,
+  TASK_COMMANDS,
+  TASK_LOW_POWER_CHECK,
+  TASK_VALVE,
+  TASK_FILENAME,
+  TASK_LOG_POWER,
+  TASK_METRICS,
+  TASK_SAMPLES,
+  TASK_STAGING,
+  TASK_SCRUB,
+  TASK_BATTERY,
+  TASK_COUNT
+};
+
+extern const char* const loopTaskNames[TASK_COUNT];
+
+// Bracket one pass of loop() to track its cycle count. loopTask() marks the
+// start of each task within the pass.
+void loopTimingStart();
+void loopTask(LoopTask task);
+void loopTimingEnd();
+// Slowest task of the previous complete pass and how long it took
+LoopTask lastPassSlowestTask(uint32_t& cycles);
+uint32_t loopMaxMicros();
+// Deepest stack use seen so far, in bytes
+size_t stackHighWater();
+
+// Registers mem
+void registerSysinfoCommands();
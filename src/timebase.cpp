@@ -0,0 +1,105 @@
+#include "timebase.h"
+#include "commands.h"
+#include "sysinfo.h"
+
+// Updates further apart than this risk a cycle counter wrap (~7 s at 600 MHz)
+const uint32_t MAX_EDGE_GAP_MS = 4000;
+// Restart the drift baseline if a measured second is this far off nominal,
+// which means the RTC was stepped
+const float MAX_SECOND_ERROR = 0.05;
+
+static time_t edgeSeconds = 0;
+static uint32_t edgeCycles = 0;
+static uint32_t edgeMillis = 0;
+static uint32_t cyclesPerSecond = 0;
+
+static uint64_t baselineCycles = 0;
+static uint32_t baselineSeconds = 0;
+
+static void restartBaseline(time_t rtc) {
+  edgeSeconds = rtc;
+  edgeCycles = ARM_DWT_CYCCNT;
+  edgeMillis = millis();
+  baselineCycles = 0;
+  baselineSeconds = 0;
+}
+
+FLASHMEM void timebaseBegin() {
+  cyclesPerSecond = F_CPU_ACTUAL;
+  // Wait for a second edge so the first latch is aligned
+  time_t start = (time_t)Teensy3Clock.get();
+  uint32_t waitStart = millis();
+  while ((time_t)Teensy3Clock.get() == start && millis() - waitStart < 1100);
+  restartBaseline((time_t)Teensy3Clock.get());
+}
+
+HOTPATH void timebaseEdge(time_t rtc, uint32_t cycles) {
+  if (rtc == edgeSeconds) return;
+
+  uint32_t ms = millis();
+  uint32_t elapsedSeconds = rtc - edgeSeconds;
+  uint32_t elapsedCycles = cycles - edgeCycles;
+
+  float expected = (float)cyclesPerSecond * elapsedSeconds;
+  if (rtc < edgeSeconds || ms - edgeMillis > MAX_EDGE_GAP_MS ||
+      fabsf(elapsedCycles - expected) > expected * MAX_SECOND_ERROR) {
+    restartBaseline(rtc);
+    return;
+  }
+
+  baselineCycles += elapsedCycles;
+  baselineSeconds += elapsedSeconds;
+  // Each edge is latched to within one RTC tick (30 us); averaging over the
+  // baseline shrinks its effect on the rate estimate as the baseline grows
+  if (baselineSeconds >= 10) {
+    cyclesPerSecond = baselineCycles / baselineSeconds;
+  }
+
+  edgeSeconds = rtc;
+  edgeCycles = cycles;
+  edgeMillis = ms;
+}
+
+HOTPATH Timestamp timebaseNow() {
+  uint32_t cycles = ARM_DWT_CYCCNT;
+  Timestamp ts;
+  ts.seconds = edgeSeconds;
+  if (millis() - edgeMillis > MAX_EDGE_GAP_MS) {
+    // Stale latch: cycle count may have wrapped, fall back to the RTC
+    ts.seconds = (time_t)Teensy3Clock.get();
+    ts.millis = 0;
+    return ts;
+  }
+  uint32_t ms = (uint64_t)(cycles - edgeCycles) * 1000 / cyclesPerSecond;
+  // Hold at the end of the second until the next edge is latched
+  ts.millis = ms > 999 ? 999 : ms;
+  return ts;
+}
+
+void timebaseSetRtc(time_t seconds) {
+  Teensy3Clock.set(seconds);
+  setTime(seconds);
+  restartBaseline(seconds);
+}
+
+float timebaseDriftPpm() {
+  return ((float)cyclesPerSecond / F_CPU_ACTUAL - 1.0f) * 1e6f;
+}
+
+uint32_t timebaseCyclesPerSecond() {
+  return cyclesPerSecond;
+}
+
+uint32_t timebaseBaselineSeconds() {
+  return baselineSeconds;
+}
+
+FLASHMEM static void timeCommand(Print& out, int argc, char* argv[]) {
+  Timestamp ts = timebaseNow();
+  out.printf("%lu.%03u drift=%.2fppm cps=%lu baseline=%lus\n", (unsigned long)ts.seconds, ts.millis,
+             timebaseDriftPpm(), (unsigned long)cyclesPerSecond, (unsigned long)baselineSeconds);
+}
+
+FLASHMEM void registerTimebaseCommands() {
+  registerCommand("time", timeCommand, "show ms timestamp and RTC/CPU drift");
+}
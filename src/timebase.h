@@ -0,0 +1,48 @@
+/**
+ * @brief Millisecond timebase disciplined to the RTC
+ *
+ * The RTC only counts whole seconds. The timebase latches the CPU cycle
+ * counter at each RTC second edge and interpolates between edges, so log
+ * and event timestamps carry milliseconds. The CPU clock rate is measured
+ * against the RTC over a long baseline, which both corrects the
+ * interpolation and reports the drift between the two oscillators.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+struct Timestamp {
+  time_t seconds;
+  uint16_t millis;
+};
+
+inline int64_t timestampMillis(Timestamp ts) {
+  return (int64_t)ts.seconds * 1000 + ts.millis;
+}
+
+inline Timestamp timestampFromMillis(int64_t ms) {
+  Timestamp ts;
+  ts.seconds = ms / 1000;
+  ts.millis = ms % 1000;
+  return ts;
+}
+
+void timebaseBegin();
+// Record an RTC second edge seen at `cycles`. The event tick interrupt
+// latches both and back-dates the cycles to the edge (see events.h).
+void timebaseEdge(time_t rtc, uint32_t cycles);
+Timestamp timebaseNow();
+// Step the RTC. Setting it zeroes the RTC's sub-second counter, so the edge
+// is re-latched right away; the drift baseline restarts.
+void timebaseSetRtc(time_t seconds);
+// CPU clock rate relative to the RTC, in parts per million
+float timebaseDriftPpm();
+// Measured CPU cycles per RTC second
+uint32_t timebaseCyclesPerSecond();
+// Seconds of RTC time the drift estimate is averaged over
+uint32_t timebaseBaselineSeconds();
+
+// Registers the time command
+void registerTimebaseCommands();
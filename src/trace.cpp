@@ -0,0 +1,145 @@
+#include "trace.h"
+#include "commands.h"
+
+#ifdef TRACE_ENABLED
+
+#include "crc.h"
+#include "sysinfo.h"
+
+struct TraceEntry {
+  uint32_t cycles;
+  uint8_t code;
+  uint8_t phase;
+  uint16_t arg;
+};
+
+DMAMEM static TraceEntry ring[TRACE_CAPACITY];
+static volatile uint32_t head = 0; // total records ever reserved
+static volatile bool frozen = false;
+
+// Freeze TRACE_CAPACITY / 2 records after a match; 0xFF is no trigger
+static uint8_t triggerCode = 0xFF;
+static int32_t triggerArg = -1; // -1 matches any
+static volatile uint32_t freezeAt = 0;
+static volatile bool triggered = false;
+
+HOTPATH void traceRecord(TraceCode code, TracePhase phase, uint16_t arg) {
+  if (frozen) return;
+  // Slot first, so a record that interrupts this one lands after it in
+  // both slot and time; the exporter sorts what a preemption between the
+  // two still swaps
+  uint32_t i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+  uint32_t cycles = ARM_DWT_CYCCNT;
+  ring[i & (TRACE_CAPACITY - 1)] = {cycles, code, phase, arg};
+
+  if (triggered) {
+    if (i >= freezeAt) frozen = true;
+  } else if (code == triggerCode && (triggerArg < 0 || triggerArg == arg)) {
+    triggered = true;
+    freezeAt = i + TRACE_CAPACITY / 2;
+  }
+}
+
+static void put(uint8_t* buffer, size_t& pos, uint32_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) buffer[pos++] = value >> (8 * i);
+}
+
+static void writeFrames(Print& out) {
+  DMAMEM static uint8_t frame[6 + 12 + 8 * TRACE_FRAME_RECORDS + 2];
+  uint32_t end = head;
+  uint32_t count = end < TRACE_CAPACITY ? end : TRACE_CAPACITY;
+  uint32_t first = end - count;
+  uint16_t chunks = (count + TRACE_FRAME_RECORDS - 1) / TRACE_FRAME_RECORDS;
+
+  for (uint16_t chunk = 0; chunk < chunks; chunk++) {
+    size_t pos = 0;
+    frame[pos++] = 0xA5;
+    frame[pos++] = 0x5A;
+    frame[pos++] = 'T';
+    frame[pos++] = TRACE_FRAME_VERSION;
+    size_t lengthPos = pos;
+    pos += 2;
+
+    size_t payloadStart = pos;
+    put(frame, pos, F_CPU_ACTUAL, 4);
+    put(frame, pos, chunk, 2);
+    put(frame, pos, chunks, 2);
+    put(frame, pos, first, 4);
+    uint32_t from = first + chunk * TRACE_FRAME_RECORDS;
+    uint32_t to = min(from + TRACE_FRAME_RECORDS, end);
+    for (uint32_t i = from; i < to; i++) {
+      const TraceEntry& e = ring[i & (TRACE_CAPACITY - 1)];
+      put(frame, pos, e.cycles, 4);
+      put(frame, pos, e.code, 1);
+      put(frame, pos, e.phase, 1);
+      put(frame, pos, e.arg, 2);
+    }
+    put(frame, lengthPos, pos - payloadStart, 2);
+    put(frame, pos, crc16(frame + 2, pos - 2), 2);
+    out.write(frame, pos);
+  }
+}
+
+static void clear() {
+  frozen = true;
+  head = 0;
+  triggered = false;
+  frozen = false;
+}
+
+FLASHMEM static void traceCommand(Print& out, int argc, char* argv[]) {
+  const char* action = argc > 1 ? argv[1] : "";
+  if (strcmp(action, "dump") == 0) {
+    bool wasFrozen = frozen;
+    frozen = true;
+    writeFrames(out);
+    frozen = wasFrozen;
+  } else if (strcmp(action, "clear") == 0) {
+    clear();
+    out.println("OK");
+  } else if (strcmp(action, "freeze") == 0) {
+    frozen = true;
+    out.println("OK");
+  } else if (strcmp(action, "run") == 0) {
+    frozen = false;
+    out.println("OK");
+  } else if (strcmp(action, "trigger") == 0) {
+    if (argc < 3) {
+      out.println("ERR usage: trace trigger <code>|off [arg]");
+      return;
+    }
+    if (strcmp(argv[2], "off") == 0) {
+      triggerCode = 0xFF;
+    } else {
+      unsigned long code = strtoul(argv[2], nullptr, 10);
+      if (code >= TRACE_CODE_COUNT) {
+        out.printf("ERR code 0-%u\n", TRACE_CODE_COUNT - 1);
+        return;
+      }
+      triggerArg = argc > 3 ? atol(argv[3]) : -1;
+      clear();
+      triggerCode = code;
+    }
+    out.println("OK");
+  } else {
+    uint32_t records = head;
+    out.printf("%s records=%lu held=%lu capacity=%u\n", frozen ? "frozen" : "running",
+               (unsigned long)records, (unsigned long)min(records, (uint32_t)TRACE_CAPACITY),
+               TRACE_CAPACITY);
+    if (triggerCode != 0xFF) {
+      out.printf("trigger code=%u arg=%ld %s\n", triggerCode, (long)triggerArg, triggered ? "fired" : "armed");
+    }
+  }
+}
+
+#else
+
+FLASHMEM static void traceCommand(Print& out, int argc, char* argv[]) {
+  out.println("ERR built without -DTRACE_ENABLED");
+}
+
+#endif
+
+FLASHMEM void registerTraceCommands() {
+  registerCommand("trace", traceCommand, "trace [dump|clear|freeze|run|trigger <code>|off [arg]]: trace ring");
+}
@@ -0,0 +1,78 @@
+/**
+ * @brief Binary trace ring for microsecond-level ordering
+ *
+ * Built with -DTRACE_ENABLED, trace points append 8-byte records (cycle
+ * count, code, phase, argument) to a TRACE_CAPACITY ring in RAM2, from the
+ * loop and from ISRs alike. The ring keeps the newest records. Without the
+ * flag every TRACE_* macro compiles to nothing and the ring is not built.
+ *
+ * "$trace dump" sends the ring oldest first as binary frames of up to
+ * TRACE_FRAME_RECORDS records. tools/trace_export.py turns them into Chrome
+ * trace JSON (chrome://tracing, Perfetto). "$trace trigger <code> [arg]"
+ * freezes the ring half a buffer after a matching record, to catch the
+ * lead-up to and aftermath of e.g. a locked-out valve move.
+ *
+ * Frame: 0xA5 0x5A 'T' version len(u16) payload crc16(u16), little endian,
+ * crc over type..payload. Payload: cpu_hz(u32), chunk(u16), chunks(u16),
+ * overwritten(u32), then records of cycles(u32) code(u8) phase(u8) arg(u16).
+ * Adding a code appends to TraceCode and bumps TRACE_FRAME_VERSION.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint8_t TRACE_FRAME_VERSION = 1;
+const uint16_t TRACE_CAPACITY = 4096; // records, power of two
+const uint16_t TRACE_FRAME_RECORDS = 512;
+
+enum TraceCode : uint8_t {
+  TRACE_LOOP,        // one loop() pass
+  TRACE_TASK,        // arg: LoopTask
+  TRACE_WAIT,        // WFI until the next interrupt
+  TRACE_EVENT,       // handler dispatch, arg: EventType
+  TRACE_COMMAND,     // '$' command handler, arg: registry index
+  TRACE_SD_WRITE,    // arg: bytes, saturated
+  TRACE_VALVE,       // instant, arg: MoveResult
+  TRACE_SCHEDULE,    // instant, a scheduled move came due, arg: id
+  TRACE_ISR_EVENTS,  // event timer interrupt
+  TRACE_ISR_SAMPLER, // sampler interrupt
+  TRACE_ISR_ALERT,   // instant, INA260 alert pin
+  TRACE_I2C,         // INA260 transfer, tick to completion, arg: 1 with voltage
+  TRACE_CODE_COUNT
+};
+
+enum TracePhase : uint8_t {
+  TRACE_PHASE_BEGIN = 'B',
+  TRACE_PHASE_END = 'E',
+  TRACE_PHASE_INSTANT = 'i',
+};
+
+#ifdef TRACE_ENABLED
+
+void traceRecord(TraceCode code, TracePhase phase, uint16_t arg);
+
+// Begin on construction, end when the scope exits by any return
+struct TraceScope {
+  TraceCode code;
+  uint16_t arg;
+  TraceScope(TraceCode c, uint16_t a) : code(c), arg(a) { traceRecord(code, TRACE_PHASE_BEGIN, arg); }
+  ~TraceScope() { traceRecord(code, TRACE_PHASE_END, arg); }
+};
+
+#define TRACE_BEGIN(code, arg) traceRecord(code, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(code, arg) traceRecord(code, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(code, arg) traceRecord(code, TRACE_PHASE_INSTANT, arg)
+#define TRACE_SCOPE(code, arg) TraceScope traceScope_(code, arg)
+
+#else
+
+#define TRACE_BEGIN(code, arg) do {} while (0)
+#define TRACE_END(code, arg) do {} while (0)
+#define TRACE_INSTANT(code, arg) do {} while (0)
+#define TRACE_SCOPE(code, arg) do {} while (0)
+
+#endif
+
+// Registers trace
+void registerTraceCommands();
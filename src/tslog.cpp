@@ -0,0 +1,180 @@
+#include "tslog.h"
+#include "commands.h"
+#include "crc.h"
+#include "loadshed.h"
+#include "logging.h"
+#include "sdpower.h"
+
+static const size_t HEADER_SIZE = 7;
+static const size_t MAX_RECORD_SIZE = 10 + 5 * 5; // varint u64, five zigzag varints
+static const size_t MAX_RUN_SIZE = 5 + 5;
+
+static void putVarint(uint8_t* buffer, size_t& pos, uint64_t value) {
+  while (value >= 0x80) {
+    buffer[pos++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  buffer[pos++] = (uint8_t)value;
+}
+
+static inline uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int32_t deciHz(float hz) {
+  return lroundf(hz * 10);
+}
+
+static void flushRun(TsEncoder& encoder) {
+  putVarint(encoder.runs, encoder.runsLength, zigzag(encoder.runValue));
+  putVarint(encoder.runs, encoder.runsLength, encoder.runLength);
+}
+
+void tsEncoderReset(TsEncoder& encoder) {
+  encoder.length = HEADER_SIZE;
+  encoder.runsLength = 0;
+  encoder.count = 0;
+  encoder.previousDelta = 0;
+  encoder.runLength = 0;
+}
+
+bool tsEncoderAdd(TsEncoder& encoder, const TsRecord& record) {
+  // Room for this record, a run it may close, the final run and the CRC
+  if (encoder.length + encoder.runsLength + MAX_RECORD_SIZE + 2 * MAX_RUN_SIZE + 2 > TSLOG_BLOCK_SIZE) return false;
+  if (encoder.runsLength + 2 * MAX_RUN_SIZE > sizeof(encoder.runs) || encoder.count == UINT16_MAX) return false;
+
+  uint8_t* out = encoder.block;
+  size_t& pos = encoder.length;
+  const TsRecord& last = encoder.previous;
+  if (encoder.count == 0) {
+    putVarint(out, pos, record.millis);
+    putVarint(out, pos, zigzag(record.voltage));
+    putVarint(out, pos, zigzag(record.current));
+  } else {
+    int64_t delta = record.millis - last.millis;
+    putVarint(out, pos, zigzag(delta - encoder.previousDelta));
+    putVarint(out, pos, zigzag((int64_t)record.voltage - last.voltage));
+    putVarint(out, pos, zigzag((int64_t)record.current - last.current));
+    encoder.previousDelta = delta;
+  }
+  putVarint(out, pos, zigzag((int64_t)record.current - record.currentMin));
+  putVarint(out, pos, zigzag((int64_t)record.currentMax - record.current));
+  int64_t ripple = deciHz(record.rippleHz);
+  putVarint(out, pos, zigzag(encoder.count ? ripple - deciHz(last.rippleHz) : ripple));
+
+  if (encoder.count && record.valve == encoder.runValue) {
+    encoder.runLength++;
+  } else {
+    if (encoder.count) flushRun(encoder);
+    encoder.runValue = record.valve;
+    encoder.runLength = 1;
+  }
+  encoder.previous = record;
+  encoder.count++;
+  return true;
+}
+
+size_t tsEncoderFinish(TsEncoder& encoder) {
+  if (!encoder.count) return 0;
+  flushRun(encoder);
+  uint8_t* out = encoder.block;
+  size_t streamLength = encoder.length - HEADER_SIZE;
+  out[0] = 'G';
+  out[1] = 'T';
+  out[2] = TSLOG_VERSION;
+  out[3] = encoder.count;
+  out[4] = encoder.count >> 8;
+  out[5] = streamLength;
+  out[6] = streamLength >> 8;
+  memcpy(out + encoder.length, encoder.runs, encoder.runsLength);
+  size_t length = encoder.length + encoder.runsLength;
+  uint16_t crc = crc16(out, length);
+  out[length++] = crc;
+  out[length++] = crc >> 8;
+  return length;
+}
+
+static TsEncoder encoder;
+static char blockPath[48] = {0};
+static uint32_t records = 0;
+static uint32_t blocks = 0;
+static uint32_t bytesWritten = 0;
+static uint32_t writeFailures = 0;
+
+struct PendingBlock {
+  char path[sizeof(blockPath)];
+  uint16_t length;
+  uint8_t data[TSLOG_BLOCK_SIZE];
+};
+DMAMEM static PendingBlock pending[TSLOG_PENDING];
+static uint8_t pendingCount = 0;
+
+static void writeBlock(const char* path, const uint8_t* data, size_t length) {
+  if (sdWrite(path, data, length, false)) {
+    blocks++;
+    bytesWritten += length;
+  } else {
+    writeFailures++;
+  }
+}
+
+static void writePending() {
+  for (uint8_t i = 0; i < pendingCount; i++) writeBlock(pending[i].path, pending[i].data, pending[i].length);
+  pendingCount = 0;
+}
+
+void tsLogFlush() {
+  size_t length = tsEncoderFinish(encoder);
+  if (length) {
+    // Hold the block while the card is asleep or a valve move needs the current
+    bool hold = (sdPowerGated() && !sdPowerAwake()) || loadShedBusy();
+    if (hold && pendingCount < TSLOG_PENDING) {
+      PendingBlock& block = pending[pendingCount++];
+      strlcpy(block.path, blockPath, sizeof(block.path));
+      block.length = length;
+      memcpy(block.data, encoder.block, length);
+    } else {
+      writePending(); // keep the file in order
+      writeBlock(blockPath, encoder.block, length);
+    }
+  }
+  tsEncoderReset(encoder);
+}
+
+void tsLogPoll() {
+  if (pendingCount && sdPowerAwake() && !loadShedBusy()) writePending();
+}
+
+void tsLogAppend(const TsRecord& record) {
+  // Same name as the daily CSV, with a .gts extension
+  char path[sizeof(blockPath)];
+  strlcpy(path, filename, sizeof(path));
+  char* extension = strrchr(path, '.');
+  if (extension) strlcpy(extension, ".gts", sizeof(path) - (extension - path));
+
+  if (encoder.count && strcmp(path, blockPath) != 0) tsLogFlush();
+  if (!encoder.count) tsEncoderReset(encoder);
+  if (!tsEncoderAdd(encoder, record)) {
+    tsLogFlush();
+    tsEncoderAdd(encoder, record);
+  }
+  strlcpy(blockPath, path, sizeof(blockPath));
+  records++;
+}
+
+FLASHMEM static void tsLogCommand(Print& out, int argc, char* argv[]) {
+  if (argc > 1 && strcmp(argv[1], "flush") == 0) {
+    tsLogFlush();
+    writePending();
+  }
+  out.printf("records=%lu blocks=%lu bytes=%lu failures=%lu pending=%u\n", (unsigned long)records,
+             (unsigned long)blocks, (unsigned long)bytesWritten, (unsigned long)writeFailures, pendingCount);
+  uint32_t stored = records - encoder.count;
+  out.printf("%.2f bytes/record, open block %u records %u bytes\n",
+             stored ? (float)bytesWritten / stored : 0.0f, encoder.count,
+             encoder.count ? (unsigned)(encoder.length + encoder.runsLength) : 0);
+}
+
+FLASHMEM void registerTsLogCommands() {
+  registerCommand("tslog", tsLogCommand, "tslog [flush]: compressed binary log status");
+}
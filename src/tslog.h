@@ -0,0 +1,72 @@
+/**
+ * @brief Compressed binary time-series log
+ *
+ * Each power record also goes to a binary log beside the daily CSV
+ * (same name, .gts). Records are packed into independently decodable
+ * blocks of at most TSLOG_BLOCK_SIZE bytes:
+ *
+ *   'G' 'T' version count(u16) streamLength(u16)
+ *   stream: first record in full, then per record
+ *     zigzag varint delta-of-delta of the millisecond timestamp
+ *     zigzag varint deltas of voltage and current (mV, mA)
+ *     zigzag varints current - current_min and current_max - current
+ *     zigzag varint delta of ripple_hz in 0.1 Hz steps (the CSV resolution)
+ *   valve runs: (zigzag varint valve_us, varint run length) until count
+ *   crc16 (u16) over everything before it
+ *
+ * The first record stores the timestamp as a varint and the other fields as
+ * zigzag varints. Multi-byte fields are little endian. Decode with
+ * tools/tslog_decode.py.
+ *
+ * A block is written when full (roughly every 10 minutes at the default
+ * interval) or when the day rolls over. Records in a partial block are lost
+ * on reset, but the CSV still has them. While the SD card is power gated
+ * and asleep, or a valve move has the current budget (see loadshed.h), up
+ * to TSLOG_PENDING finished blocks wait in RAM.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+const uint16_t TSLOG_BLOCK_SIZE = 512;
+const uint8_t TSLOG_PENDING = 4;
+const uint8_t TSLOG_VERSION = 1;
+
+struct TsRecord {
+  int64_t millis; // epoch milliseconds
+  int32_t voltage;
+  int32_t current;
+  int32_t currentMin;
+  int32_t currentMax;
+  int32_t valve;  // servo pulse width, us
+  float rippleHz;
+};
+
+struct TsEncoder {
+  uint8_t block[TSLOG_BLOCK_SIZE];
+  uint8_t runs[64];
+  size_t length;      // bytes of block used, header included
+  size_t runsLength;
+  uint16_t count;
+  TsRecord previous;
+  int64_t previousDelta;
+  int32_t runValue;
+  uint32_t runLength;
+};
+
+void tsEncoderReset(TsEncoder& encoder);
+// False if the block is full; the record was not added
+bool tsEncoderAdd(TsEncoder& encoder, const TsRecord& record);
+// Close the block; returns its length in encoder.block
+size_t tsEncoderFinish(TsEncoder& encoder);
+
+// Add a record to the binary log for the current daily file
+void tsLogAppend(const TsRecord& record);
+// Close the partial block now
+void tsLogFlush();
+// Write held blocks once the card is awake and no move is running; call once a second
+void tsLogPoll();
+
+// Registers tslog
+void registerTsLogCommands();
@@ -0,0 +1,198 @@
+/**
+ * @brief Host stand-in for the parts of the Teensy core the tested modules use
+ *
+ * Only the [env:native] test build sees this directory. Time is virtual:
+ * tests move hostMicros and hostCycles forward themselves, so timing
+ * behaviour is deterministic.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FASTRUN
+#define FLASHMEM
+#define DMAMEM
+#define PROGMEM
+
+#define F_CPU_ACTUAL 600000000UL
+
+inline uint64_t hostMicros = 0;
+inline uint32_t hostCycles = 0;
+#define ARM_DWT_CYCCNT hostCycles
+
+// SNVS high power RTC counter: seconds << 15 | 32.768 kHz ticks
+inline volatile uint32_t hostRtcHigh = 0;
+inline volatile uint32_t hostRtcLow = 0;
+#define SNVS_HPRTCMR hostRtcHigh
+#define SNVS_HPRTCLR hostRtcLow
+
+inline uint32_t millis() { return hostMicros / 1000; }
+inline uint32_t micros() { return hostMicros; }
+inline void delay(uint32_t ms) { hostMicros += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { hostMicros += us; }
+
+// RTC seconds; a test can supply a virtual RTC that advances as it is polled
+struct HostRtc {
+  unsigned long (*source)() = nullptr;
+  unsigned long seconds = 0;
+  unsigned long get() { return source ? source() : seconds; }
+  void set(unsigned long s) { seconds = s; }
+};
+inline HostRtc Teensy3Clock;
+
+// Stand-in GPIO: the last level written to each pin
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define LED_BUILTIN 13
+inline uint8_t hostPins[64];
+inline uint8_t hostPinModes[64];
+inline void pinMode(uint8_t pin, uint8_t mode) { hostPinModes[pin] = mode; }
+inline void digitalWrite(uint8_t pin, uint8_t value) { hostPins[pin] = value ? HIGH : LOW; }
+inline void digitalWriteFast(uint8_t pin, uint8_t value) { digitalWrite(pin, value); }
+inline uint8_t digitalRead(uint8_t pin) { return hostPins[pin]; }
+
+// Never fires by itself; a test calls callback() to step it
+class IntervalTimer {
+public:
+  void (*callback)() = nullptr;
+  float period = 0;
+  bool begin(void (*f)(), float microseconds) {
+    callback = f;
+    period = microseconds;
+    return true;
+  }
+  void update(float microseconds) { period = microseconds; }
+  void end() { callback = nullptr; }
+  void priority(uint8_t) {}
+};
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+  size_t length = strlen(src);
+  if (size) {
+    size_t n = length < size - 1 ? length : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = 0;
+  }
+  return length;
+}
+#endif
+
+template <class A, class B>
+auto min(A a, B b) -> decltype(a < b ? a : b) { return b < a ? b : a; }
+template <class A, class B>
+auto max(A a, B b) -> decltype(a < b ? a : b) { return a < b ? b : a; }
+template <class T, class L, class H>
+T constrain(T x, L low, H high) { return x < low ? low : (x > high ? high : x); }
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  int printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    write((const uint8_t*)buffer, strlen(buffer));
+    return n;
+  }
+  size_t print(const char* s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(int v) { return print((long)v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(unsigned int v) { return print((unsigned long)v); }
+  size_t print(double v) { return printf("%.2f", v); }
+  template <class T>
+  size_t println(T v) { return print(v) + print('\n'); }
+  size_t println() { return print('\n'); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual int peek() { return -1; }
+};
+
+// Collects what the firmware prints so a test can inspect it
+class HostSerial : public Stream {
+public:
+  char output[4096];
+  size_t length = 0;
+  size_t write(uint8_t b) override {
+    if (length + 1 < sizeof(output)) {
+      output[length++] = b;
+      output[length] = 0;
+    }
+    return 1;
+  }
+  using Print::write;
+  void clear() { length = 0; output[0] = 0; }
+  void begin(uint32_t) {}
+  void flush() {}
+  operator bool() const { return true; }
+};
+
+inline HostSerial Serial;
+
+// UART at a real baud rate against virtual time. Each byte leaves the line
+// one character time after the one before it; availableForWrite() counts
+// what is still buffered. Polling lets a microsecond pass, so code that
+// spins on the UART makes progress.
+class HardwareSerial : public Stream {
+public:
+  uint32_t baud = 115200;
+  int bufferSize = 40;
+  // Called as each byte finishes on the line
+  void (*onLine)(uint8_t b, uint64_t micros) = nullptr;
+
+  void begin(uint32_t rate) { baud = rate; }
+  void attachCts(uint8_t) {}
+  int availableForWrite() {
+    hostMicros++;
+    drain();
+    return bufferSize - (int)(count - sent);
+  }
+  size_t write(uint8_t b) override {
+    while (availableForWrite() <= 0);
+    uint64_t start = count > sent && done[(count - 1) % 256] > hostMicros ? done[(count - 1) % 256] : hostMicros;
+    bytes[count % 256] = b;
+    done[count % 256] = start + 10000000ULL / baud;
+    count++;
+    return 1;
+  }
+  using Print::write;
+  void flush() {
+    while (count > sent) availableForWrite();
+  }
+  void drain() {
+    for (; sent < count && done[sent % 256] <= hostMicros; sent++) {
+      if (onLine) onLine(bytes[sent % 256], done[sent % 256]);
+    }
+  }
+
+private:
+  uint8_t bytes[256];
+  uint64_t done[256];
+  uint32_t count = 0;
+  uint32_t sent = 0;
+};
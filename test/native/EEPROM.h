@@ -0,0 +1,30 @@
+/**
+ * @brief Host stand-in for the Teensy EEPROM emulation, backed by RAM
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+class HostEEPROM {
+public:
+  uint8_t bytes[4284];
+  HostEEPROM() { erase(); }
+  void erase() { memset(bytes, 0xFF, sizeof(bytes)); }
+  uint8_t read(int address) { return bytes[address]; }
+  void write(int address, uint8_t value) { bytes[address] = value; }
+  void update(int address, uint8_t value) { bytes[address] = value; }
+  template <class T>
+  T& get(int address, T& value) {
+    memcpy(&value, bytes + address, sizeof(T));
+    return value;
+  }
+  template <class T>
+  const T& put(int address, const T& value) {
+    memcpy(bytes + address, &value, sizeof(T));
+    return value;
+  }
+  int length() { return sizeof(bytes); }
+};
+
+inline HostEEPROM EEPROM;
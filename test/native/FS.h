@@ -0,0 +1,202 @@
+/**
+ * @brief Host stand-in for the Teensy FS/File API, backed by RAM
+ *
+ * Enough of a filesystem for the SD and flash stores: files, directories
+ * created on demand, append on FILE_WRITE. Tests reach into it to model
+ * the hardware: `failed` makes every call fail as if the card were pulled,
+ * `capacity` bounds the bytes stored, `writeMicros`, `flushMicros` and
+ * `readMicros` charge virtual time per call, and lookups count the directory
+ * entries they scan the way FAT does, in `entriesScanned`.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+#define FILE_WRITE_BEGIN 2
+
+struct HostNode {
+  bool directory = false;
+  std::vector<uint8_t> data;
+  std::vector<std::string> entries; // directory: children in creation order
+};
+
+class FS;
+
+class File : public Stream {
+public:
+  File() {}
+  File(FS* fs, std::shared_ptr<HostNode> node, const std::string& path, uint64_t position)
+    : fs(fs), node(node), path(path), offset(position) {}
+
+  operator bool() const { return node != nullptr; }
+  const char* name() const { return path.c_str(); }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  int read() override {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+  int read(void* buffer, size_t size);
+  int peek() override { return node && offset < node->data.size() ? node->data[offset] : -1; }
+  int available() override { return node ? (int)(node->data.size() - offset) : 0; }
+  bool seek(uint64_t position) {
+    if (!node || position > node->data.size()) return false;
+    offset = position;
+    return true;
+  }
+  uint64_t position() const { return offset; }
+  uint64_t size() const { return node ? node->data.size() : 0; }
+  bool truncate(uint64_t size = 0);
+  void flush();
+  void close() { node = nullptr; }
+
+private:
+  FS* fs = nullptr;
+  std::shared_ptr<HostNode> node;
+  std::string path;
+  uint64_t offset = 0;
+};
+
+class FS {
+public:
+  std::map<std::string, std::shared_ptr<HostNode>> nodes;
+  bool failed = false;
+  uint64_t capacity = UINT64_MAX;
+  // Virtual time charged for a write of `bytes` at `offset`, for a flush and
+  // for a read
+  uint32_t (*writeMicros)(size_t bytes, uint64_t offset) = nullptr;
+  uint32_t (*flushMicros)() = nullptr;
+  uint32_t (*readMicros)(size_t bytes, uint64_t offset) = nullptr;
+  uint32_t lookupMicrosPerEntry = 0;
+  uint64_t entriesScanned = 0;
+  uint32_t opens = 0;
+
+  FS() { reset(); }
+  virtual ~FS() {}
+
+  void reset() {
+    nodes.clear();
+    nodes["/"] = std::make_shared<HostNode>();
+    nodes["/"]->directory = true;
+    failed = false;
+    entriesScanned = 0;
+    opens = 0;
+  }
+
+  File open(const char* filename, uint8_t mode = FILE_READ) {
+    if (failed) return File();
+    opens++;
+    std::string path = normalise(filename);
+    std::shared_ptr<HostNode> node = lookup(path);
+    if (!node) {
+      if (mode == FILE_READ) return File();
+      std::shared_ptr<HostNode> parent = lookup(parentOf(path));
+      if (!parent || !parent->directory) return File();
+      node = std::make_shared<HostNode>();
+      nodes[path] = node;
+      parent->entries.push_back(path);
+    }
+    if (node->directory) return File();
+    if (mode == FILE_WRITE_BEGIN) return File(this, node, path, 0);
+    return File(this, node, path, mode == FILE_WRITE ? node->data.size() : 0);
+  }
+  bool exists(const char* filename) { return !failed && lookup(normalise(filename)) != nullptr; }
+  bool remove(const char* filename) {
+    std::string path = normalise(filename);
+    if (failed || !lookup(path) || nodes[path]->directory) return false;
+    nodes.erase(path);
+    std::vector<std::string>& entries = nodes[parentOf(path)]->entries;
+    for (size_t i = 0; i < entries.size(); i++) {
+      if (entries[i] == path) entries.erase(entries.begin() + i);
+    }
+    return true;
+  }
+  bool mkdir(const char* filename) {
+    if (failed) return false;
+    std::string path = normalise(filename);
+    if (lookup(path)) return false;
+    std::string parent = parentOf(path);
+    if (!lookup(parent) && !mkdir(parent.c_str())) return false;
+    nodes[path] = std::make_shared<HostNode>();
+    nodes[path]->directory = true;
+    nodes[parent]->entries.push_back(path);
+    return true;
+  }
+  uint64_t usedSize() {
+    uint64_t used = 0;
+    for (auto& n : nodes) used += n.second->data.size();
+    return used;
+  }
+  uint64_t totalSize() { return capacity; }
+
+  // Whole-file access for tests
+  std::vector<uint8_t>* contents(const char* filename) {
+    std::shared_ptr<HostNode> node = lookup(normalise(filename));
+    return node ? &node->data : nullptr;
+  }
+
+  static std::string normalise(const char* filename) {
+    std::string path = filename[0] == '/' ? filename : std::string("/") + filename;
+    if (path.size() > 1 && path.back() == '/') path.pop_back();
+    return path;
+  }
+  static std::string parentOf(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == 0 ? "/" : path.substr(0, slash);
+  }
+
+private:
+  friend class File;
+
+  // Walk the path a component at a time, scanning each directory linearly
+  std::shared_ptr<HostNode> lookup(const std::string& path) {
+    if (path == "/") return nodes["/"];
+    std::shared_ptr<HostNode> parent = lookup(parentOf(path));
+    if (!parent || !parent->directory) return nullptr;
+    for (const std::string& entry : parent->entries) {
+      entriesScanned++;
+      hostMicros += lookupMicrosPerEntry;
+      if (entry == path) return nodes[path];
+    }
+    return nullptr;
+  }
+};
+
+inline size_t File::write(const uint8_t* buffer, size_t size) {
+  if (!node || fs->failed) return 0;
+  if (fs->usedSize() + size > fs->capacity) return 0;
+  if (fs->writeMicros) hostMicros += fs->writeMicros(size, offset);
+  if (node->data.size() < offset + size) node->data.resize(offset + size);
+  memcpy(node->data.data() + offset, buffer, size);
+  offset += size;
+  return size;
+}
+
+inline int File::read(void* buffer, size_t size) {
+  if (!node || fs->failed) return -1;
+  size_t n = min(size, (size_t)(node->data.size() - offset));
+  if (fs->readMicros) hostMicros += fs->readMicros(n, offset);
+  memcpy(buffer, node->data.data() + offset, n);
+  offset += n;
+  return n;
+}
+
+inline bool File::truncate(uint64_t size) {
+  if (!node || fs->failed) return false;
+  node->data.resize(size);
+  if (offset > size) offset = size;
+  return true;
+}
+
+inline void File::flush() {
+  if (node && fs->flushMicros) hostMicros += fs->flushMicros();
+}
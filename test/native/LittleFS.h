@@ -0,0 +1,15 @@
+/**
+ * @brief Host stand-in for LittleFS on program flash, a RAM filesystem
+ */
+
+#pragma once
+
+#include <FS.h>
+
+class LittleFS_Program : public FS {
+public:
+  bool begin(uint32_t size) {
+    capacity = size;
+    return !failed;
+  }
+};
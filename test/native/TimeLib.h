@@ -0,0 +1,30 @@
+/**
+ * @brief Host stand-in for TimeLib: a settable system time in UTC
+ */
+
+#pragma once
+
+#include <time.h>
+
+#define SECS_PER_DAY ((time_t)(86400UL))
+
+inline time_t hostTime = 0;
+typedef time_t (*getExternalTime)();
+
+inline void setTime(time_t t) { hostTime = t; }
+inline time_t now() { return hostTime; }
+inline void setSyncProvider(getExternalTime) {}
+enum timeStatus_t { timeNotSet, timeNeedsSync, timeSet };
+inline timeStatus_t timeStatus() { return timeSet; }
+
+inline struct tm hostTm(time_t t) {
+  struct tm parts;
+  gmtime_r(&t, &parts);
+  return parts;
+}
+inline int year(time_t t = now()) { return hostTm(t).tm_year + 1900; }
+inline int month(time_t t = now()) { return hostTm(t).tm_mon + 1; }
+inline int day(time_t t = now()) { return hostTm(t).tm_mday; }
+inline int hour(time_t t = now()) { return hostTm(t).tm_hour; }
+inline int minute(time_t t = now()) { return hostTm(t).tm_min; }
+inline int second(time_t t = now()) { return hostTm(t).tm_sec; }
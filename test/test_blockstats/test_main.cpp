@@ -0,0 +1,101 @@
+#include <unity.h>
+#include "blockstats.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+static SampleBlock block;
+
+static void fillConstant(int16_t value) {
+  block.count = SAMPLE_BLOCK_SIZE;
+  for (uint16_t i = 0; i < SAMPLE_BLOCK_SIZE; i++) block.current[i] = value;
+}
+
+void setUp() {
+  srand(5);
+  blockStatsBegin();
+  blockStageTake();
+  phase = 0;
+  memset(work, 0, sizeof(work));
+}
+
+void tearDown() {}
+
+static void testReductionsMatchScalarReference() {
+  int16_t x[SAMPLE_BLOCK_SIZE + 1];
+  for (size_t i = 0; i < sizeof(x) / sizeof(x[0]); i++) x[i] = rand() % 65536 - 32768;
+  x[17] = INT16_MIN;
+  x[200] = INT16_MAX;
+  // Odd lengths leave a sample for the scalar tail
+  const size_t lengths[] = {1, 2, 7, SAMPLE_BLOCK_SIZE, SAMPLE_BLOCK_SIZE + 1};
+  for (size_t n : lengths) {
+    BlockStats a = blockStatsScalar(x, n), b = blockStats(x, n);
+    TEST_ASSERT_EQUAL(a.sum, b.sum);
+    TEST_ASSERT_EQUAL(a.min, b.min);
+    TEST_ASSERT_EQUAL(a.max, b.max);
+    TEST_ASSERT_EQUAL(n, b.count);
+  }
+  BlockStats s = blockStats(x, SAMPLE_BLOCK_SIZE);
+  TEST_ASSERT_EQUAL(INT16_MIN, s.min);
+  TEST_ASSERT_EQUAL(INT16_MAX, s.max);
+}
+
+static void testFilterPathsAgree() {
+  int16_t x[DECIMATION_TAPS];
+  for (uint8_t i = 0; i < DECIMATION_TAPS; i++) x[i] = rand() % 4000 - 2000;
+  TEST_ASSERT_INT_WITHIN(1, firScalar(x), fir(x));
+}
+
+static void testFilterHasUnityDcGain() {
+  fillConstant(1234);
+  blockStageProcess(block); // fills the history
+  blockStageTake();
+  blockStageProcess(block);
+  IntervalCurrent c = blockStageTake();
+  TEST_ASSERT_INT_WITHIN(1, 1234, c.mean);
+}
+
+static void testDecimatesAcrossBlocks() {
+  fillConstant(0);
+  for (int b = 0; b < 3; b++) blockStageProcess(block);
+  block.count = 100; // partial block after a rate change
+  blockStageProcess(block);
+  // Phase carries over block boundaries, so no output is lost or doubled
+  TEST_ASSERT_EQUAL((3 * SAMPLE_BLOCK_SIZE + 100 + DECIMATION_FACTOR - 1) / DECIMATION_FACTOR, filteredCount);
+  IntervalCurrent c = blockStageTake();
+  TEST_ASSERT_EQUAL(3 * SAMPLE_BLOCK_SIZE + 100, c.samples);
+}
+
+static void testRippleAveragesOutOfMean() {
+  // Alternating +-300 around 500: far above the decimated Nyquist
+  block.count = SAMPLE_BLOCK_SIZE;
+  for (uint16_t i = 0; i < SAMPLE_BLOCK_SIZE; i++) block.current[i] = i % 2 ? 800 : 200;
+  blockStageProcess(block); // fills the history
+  blockStageTake();
+  for (int b = 0; b < 4; b++) blockStageProcess(block);
+  IntervalCurrent c = blockStageTake();
+  TEST_ASSERT_INT_WITHIN(5, 500, c.mean);
+  TEST_ASSERT_EQUAL(200, c.min);
+  TEST_ASSERT_EQUAL(800, c.max);
+}
+
+static void testTakeResetsInterval() {
+  fillConstant(50);
+  blockStageProcess(block);
+  blockStageTake();
+  IntervalCurrent c = blockStageTake();
+  TEST_ASSERT_EQUAL(0, c.samples);
+  TEST_ASSERT_EQUAL(0, c.mean);
+  TEST_ASSERT_EQUAL(0, c.min);
+  TEST_ASSERT_EQUAL(0, c.max);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testReductionsMatchScalarReference);
+  RUN_TEST(testFilterPathsAgree);
+  RUN_TEST(testFilterHasUnityDcGain);
+  RUN_TEST(testDecimatesAcrossBlocks);
+  RUN_TEST(testRippleAveragesOutOfMean);
+  RUN_TEST(testTakeResetsInterval);
+  return UNITY_END();
+}
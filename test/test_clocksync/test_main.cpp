@@ -0,0 +1,167 @@
+#include <unity.h>
+#include "clocksync.cpp"
+
+// Virtual clocks: the lander keeps true time; our RTC runs localPpm off it
+// from an arbitrary starting error
+static double trueMs;
+static double localPpm;
+static double localBaseMs;
+static int rtcSteps;
+
+static double localMs(double t) {
+  return t * (1 + localPpm * 1e-6) + localBaseMs;
+}
+
+Timestamp timebaseNow() {
+  return timestampFromMillis((int64_t)floor(localMs(trueMs)));
+}
+
+void timebaseSetRtc(time_t seconds) {
+  localBaseMs += seconds * 1000.0 - localMs(trueMs);
+  rtcSteps++;
+}
+
+void logEvent(const char*, ...) {}
+
+struct Registered {
+  const char* name;
+  CommandHandler handler;
+};
+static Registered commands[4];
+static size_t commandCount = 0;
+
+bool registerCommand(const char* name, CommandHandler handler, const char*) {
+  commands[commandCount++] = {name, handler};
+  return true;
+}
+
+static void run(const char* name, char* line) {
+  char* argv[COMMAND_MAX_ARGS];
+  int argc = 0;
+  for (char* arg = strtok(line, " "); arg && argc < (int)COMMAND_MAX_ARGS; arg = strtok(nullptr, " ")) {
+    argv[argc++] = arg;
+  }
+  for (size_t i = 0; i < commandCount; i++) {
+    if (strcmp(commands[i].name, name) == 0) commands[i].handler(Serial, argc, argv);
+  }
+}
+
+static void advance(double ms) {
+  // Update the slew the way the loop does, every 10 ms
+  for (double end = trueMs + ms; trueMs < end;) {
+    trueMs = min(end, trueMs + 10);
+    hostMicros = (uint64_t)(trueMs * 1000);
+    clockSyncUpdate();
+  }
+}
+
+// One $sync/$tsync exchange with the given one-way delays; true if accepted
+static bool exchange(double outMs, double backMs) {
+  char line[64];
+  Serial.clear();
+  strcpy(line, "sync");
+  run("sync", line);
+  unsigned seq = 0;
+  long long t1 = 0;
+  sscanf(Serial.output, "TSYNC %u %lld", &seq, &t1);
+  advance(outMs);
+  long long t2 = (long long)trueMs;
+  advance(5);
+  long long t3 = (long long)trueMs;
+  advance(backMs);
+  snprintf(line, sizeof(line), "tsync %u %lld %lld", seq, t2, t3);
+  Serial.clear();
+  run("tsync", line);
+  return strncmp(Serial.output, "OK", 2) == 0;
+}
+
+static double syncedErrorMs() {
+  return timestampMillis(syncedNow()) - trueMs;
+}
+
+// The module keeps one exchange's worth of state; start each test unsynced
+static void resetClockSync() {
+  synced = false;
+  appliedOffsetMs = 0;
+  haveDriftRef = false;
+  haveDrift = false;
+  driftPpm = 0;
+  delayCount = 0;
+  pending = false;
+}
+
+void setUp() {
+  srand(7);
+  resetClockSync();
+  trueMs = 1.7e12;
+  hostMicros = 0;
+  localPpm = 0;
+  localBaseMs = 0;
+  rtcSteps = 0;
+  if (!commandCount) registerClockSyncCommands();
+}
+
+void tearDown() {}
+
+static void testFirstSyncStepsGrossError() {
+  localBaseMs = -3600e3; // an hour behind after a battery swap
+  TEST_ASSERT_TRUE(exchange(30, 30));
+  TEST_ASSERT_EQUAL(1, rtcSteps);
+  TEST_ASSERT_FLOAT_WITHIN(3, 0, syncedErrorMs());
+}
+
+static void testSlewIsRateLimited() {
+  exchange(30, 30);
+  localBaseMs += 800; // under the step threshold
+  exchange(30, 30);
+  TEST_ASSERT_EQUAL(0, rtcSteps);
+  double previousError = syncedErrorMs();
+  for (int i = 0; i < 300; i++) {
+    advance(100);
+    double error = syncedErrorMs();
+    // 500 ppm of 100 ms, plus a millisecond of rounding
+    TEST_ASSERT_FLOAT_WITHIN(0.05 + 1, previousError, error);
+    previousError = error;
+  }
+  // 30 s at 500 ppm removes 15 ms of the 800
+  TEST_ASSERT_FLOAT_WITHIN(3, 785, syncedErrorMs());
+}
+
+static void testTracksDriftThroughDelayJitter() {
+  localPpm = 40;
+  localBaseMs = 250;
+  // An exchange every 10 minutes for 20 hours, 20-30 ms each way
+  for (int i = 0; i < 120; i++) {
+    double outMs = 20 + rand() % 10;
+    double backMs = 20 + rand() % 10;
+    exchange(outMs, backMs);
+    advance(600e3);
+  }
+  // Our clock gains, so the lander's offset from it falls
+  TEST_ASSERT_FLOAT_WITHIN(5, -40, clockSyncDriftPpm());
+  // Half the worst delay asymmetry plus slew residue
+  TEST_ASSERT_FLOAT_WITHIN(10, 0, syncedErrorMs());
+}
+
+static void testQueuedSampleIsRejected() {
+  for (int i = 0; i < 4; i++) exchange(25, 25);
+  TEST_ASSERT_FALSE(exchange(400, 25));
+  TEST_ASSERT_EQUAL_STRING("ERR rejected delay 425 ms\n", Serial.output);
+}
+
+static void testStaleReplyIsRejected() {
+  char line[] = "tsync 999 1 2";
+  Serial.clear();
+  run("tsync", line);
+  TEST_ASSERT_EQUAL_STRING("ERR no matching sync\n", Serial.output);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testFirstSyncStepsGrossError);
+  RUN_TEST(testSlewIsRateLimited);
+  RUN_TEST(testTracksDriftThroughDelayJitter);
+  RUN_TEST(testQueuedSampleIsRejected);
+  RUN_TEST(testStaleReplyIsRejected);
+  return UNITY_END();
+}
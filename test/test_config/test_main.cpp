@@ -0,0 +1,100 @@
+#include <unity.h>
+#include "config.cpp"
+#include "crc.cpp"
+
+static int changes = 0;
+static Config before;
+
+void onConfigChanged(const Config& previous) {
+  changes++;
+  before = previous;
+}
+
+void setUp() {
+  EEPROM.erase();
+  changes = 0;
+}
+
+void tearDown() {}
+
+static void testCrcCheckValue() {
+  // Standard CRC-16/CCITT-FALSE check value
+  TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16("123456789", 9));
+}
+
+static void testCrcChainsAcrossBuffers() {
+  uint16_t split = crc16("56789", 5, crc16("1234", 4));
+  TEST_ASSERT_EQUAL_HEX16(crc16("123456789", 9), split);
+}
+
+static void testBlankEepromGivesDefaults() {
+  TEST_ASSERT_FALSE(loadConfig());
+  TEST_ASSERT_EQUAL(CONFIG_VERSION, config.version);
+  TEST_ASSERT_EQUAL(LOG_INTERVAL, config.logInterval);
+  TEST_ASSERT_EQUAL(HOME_MICROSECONDS, config.homeMicroseconds);
+  TEST_ASSERT_EQUAL(1, config.ledsEnabled);
+}
+
+static void testSavedBlockRoundTrips() {
+  loadConfig();
+  TEST_ASSERT_TRUE(setConfigParam("log_interval", 30));
+  config.logInterval = 0; // loading must come from EEPROM, not the cache
+  TEST_ASSERT_TRUE(loadConfig());
+  TEST_ASSERT_EQUAL(30, config.logInterval);
+}
+
+static void testCorruptBlockFallsBack() {
+  loadConfig();
+  setConfigParam("log_interval", 30);
+  EEPROM.bytes[CONFIG_EEPROM_ADDRESS + offsetof(Config, logInterval)] ^= 0x01;
+  TEST_ASSERT_FALSE(loadConfig());
+  TEST_ASSERT_EQUAL(LOG_INTERVAL, config.logInterval);
+}
+
+static void testOlderVersionFallsBack() {
+  loadConfig();
+  saveConfig();
+  Config stored;
+  EEPROM.get(CONFIG_EEPROM_ADDRESS, stored);
+  stored.version = CONFIG_VERSION - 1;
+  stored.crc = crc16(&stored, offsetof(Config, crc));
+  EEPROM.put(CONFIG_EEPROM_ADDRESS, stored);
+  TEST_ASSERT_FALSE(loadConfig());
+}
+
+static void testSetRejectsOutOfRangeAndUnknown() {
+  loadConfig();
+  TEST_ASSERT_FALSE(setConfigParam("log_interval", 0));
+  TEST_ASSERT_FALSE(setConfigParam("no_such_param", 1));
+  TEST_ASSERT_EQUAL(0, changes);
+}
+
+static void testSetKeepsHomeBetweenEndStops() {
+  loadConfig();
+  TEST_ASSERT_FALSE(setConfigParam("home_us", TOP_MICROSECONDS + 10));
+  TEST_ASSERT_EQUAL(HOME_MICROSECONDS, config.homeMicroseconds);
+}
+
+static void testSetAppliesLiveAndReportsPrevious() {
+  loadConfig();
+  TEST_ASSERT_TRUE(setConfigParam("threshold_voltage", 11500));
+  long value = 0;
+  TEST_ASSERT_TRUE(getConfigParam("threshold_voltage", value));
+  TEST_ASSERT_EQUAL(11500, value);
+  TEST_ASSERT_EQUAL(1, changes);
+  TEST_ASSERT_EQUAL(THRESHOLD_VOLTAGE, before.thresholdVoltage);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testCrcCheckValue);
+  RUN_TEST(testCrcChainsAcrossBuffers);
+  RUN_TEST(testBlankEepromGivesDefaults);
+  RUN_TEST(testSavedBlockRoundTrips);
+  RUN_TEST(testCorruptBlockFallsBack);
+  RUN_TEST(testOlderVersionFallsBack);
+  RUN_TEST(testSetRejectsOutOfRangeAndUnknown);
+  RUN_TEST(testSetKeepsHomeBetweenEndStops);
+  RUN_TEST(testSetAppliesLiveAndReportsPrevious);
+  return UNITY_END();
+}
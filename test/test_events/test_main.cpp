@@ -0,0 +1,134 @@
+#include <unity.h>
+#include <thread>
+#define EVENTS_NO_WFI
+#include "events.cpp"
+
+volatile uint32_t metricCounters[COUNTER_COUNT];
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+// Pushes from a second thread while this one pops, like an ISR and the loop.
+// Both sides yield when they can't progress, so it also runs on one core.
+const uint32_t STRESS_ITEMS = 1000000;
+
+static void testStressKeepsOrderAndCountsLoss() {
+  static SpscQueue<uint32_t, 64> queue;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < STRESS_ITEMS; i++) {
+      if (!queue.push(i)) std::this_thread::yield();
+    }
+  });
+  uint32_t popped = 0;
+  int64_t last = -1;
+  bool ordered = true;
+  for (;;) {
+    uint32_t item;
+    if (queue.pop(item)) {
+      ordered &= (int64_t)item > last;
+      last = item;
+      popped++;
+    } else if (queue.pushed() + queue.drops() == STRESS_ITEMS && queue.empty()) {
+      break;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(ordered);
+  TEST_ASSERT_EQUAL(queue.pushed(), popped);
+  TEST_ASSERT_EQUAL(STRESS_ITEMS, popped + queue.drops());
+  TEST_ASSERT_LESS_OR_EQUAL(64, queue.maxDepth());
+}
+
+static void testStressWithRetryLosesNothing() {
+  static SpscQueue<uint32_t, 16> queue;
+  std::thread producer([] {
+    for (uint32_t i = 0; i < STRESS_ITEMS; i++) {
+      while (!queue.push(i)) std::this_thread::yield();
+    }
+  });
+  uint32_t expected = 0;
+  bool exact = true;
+  while (expected < STRESS_ITEMS) {
+    uint32_t item;
+    if (queue.pop(item)) {
+      exact &= item == expected++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  TEST_ASSERT_TRUE(exact);
+  TEST_ASSERT_EQUAL(STRESS_ITEMS, queue.pushed());
+}
+
+static Event seen[64];
+static size_t seenCount = 0;
+
+static void record(const Event& event) {
+  seen[seenCount++ % 64] = event;
+}
+
+static void setRtc(uint32_t seconds, uint32_t ticks) {
+  hostRtcHigh = seconds >> (32 - RTC_TICK_BITS);
+  hostRtcLow = seconds << RTC_TICK_BITS | ticks;
+}
+
+void setUp() {
+  Event event;
+  while (timerQueue.pop(event));
+  seenCount = 0;
+  onEvent(EVENT_TICK, record);
+  onEvent(EVENT_SECOND, record);
+}
+
+void tearDown() {}
+
+static void testSecondEdgeIsBackDated() {
+  eventsBegin();
+  setRtc(1700000000, 100);
+  hostCycles = 1000000000;
+  eventTimer.callback();
+  dispatchEvents();
+  // The tick 3000 RTC ticks after the next edge
+  setRtc(1700000001, 3000);
+  hostCycles = 1600000000;
+  seenCount = 0;
+  eventTimer.callback();
+  TEST_ASSERT_EQUAL(2, dispatchEvents());
+  TEST_ASSERT_EQUAL(EVENT_SECOND, seen[0].type);
+  TEST_ASSERT_EQUAL(1700000001, seen[0].data);
+  TEST_ASSERT_EQUAL(1600000000 - 3000 * CYCLES_PER_RTC_TICK, seen[0].cycles);
+  TEST_ASSERT_EQUAL(EVENT_TICK, seen[1].type);
+  TEST_ASSERT_EQUAL(1600000000, seen[1].cycles);
+}
+
+static void testSecondPostedOncePerEdge() {
+  setRtc(1700000100, 10);
+  eventTimer.callback();
+  setRtc(1700000100, 400);
+  eventTimer.callback();
+  dispatchEvents();
+  int seconds = 0;
+  for (size_t i = 0; i < seenCount; i++) seconds += seen[i].type == EVENT_SECOND;
+  TEST_ASSERT_EQUAL(1, seconds);
+}
+
+static void testFullQueueCountsDrops() {
+  uint32_t before = metricCounters[COUNTER_EVENT_DROPS];
+  setRtc(1700000200, 0);
+  for (int i = 0; i < 40; i++) eventTimer.callback();
+  // 32 slots: the second edge and 31 ticks fit
+  TEST_ASSERT_EQUAL(before + 9, metricCounters[COUNTER_EVENT_DROPS]);
+  TEST_ASSERT_EQUAL(32, dispatchEvents());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testStressKeepsOrderAndCountsLoss);
+  RUN_TEST(testStressWithRetryLosesNothing);
+  RUN_TEST(testSecondEdgeIsBackDated);
+  RUN_TEST(testSecondPostedOncePerEdge);
+  RUN_TEST(testFullQueueCountsDrops);
+  return UNITY_END();
+}
@@ -0,0 +1,176 @@
+#include <unity.h>
+#include "landertx.cpp"
+
+static CommandHandler creditHandler = nullptr;
+
+bool registerCommand(const char* name, CommandHandler handler, const char*) {
+  if (strcmp(name, "credit") == 0) creditHandler = handler;
+  return true;
+}
+
+// Each class sends its own byte value, so the line shows whose turn it was
+const uint8_t ACK = 0x01;
+const uint8_t ALARM = 'A';
+const uint8_t TELEMETRY = 'T';
+const uint8_t BULK = 'B';
+const uint32_t BYTE_MICROS = 10000000 / 115200;
+
+static HardwareSerial port;
+static uint64_t sentAt[256];
+static uint64_t maxLatency[256];
+static uint32_t onLineCount[256];
+
+static void onLine(uint8_t b, uint64_t micros) {
+  onLineCount[b]++;
+  if (micros - sentAt[b] > maxLatency[b]) maxLatency[b] = micros - sentAt[b];
+}
+
+// An urgent message, pumped straight away as main.cpp does for acks
+static void sendUrgent(TxClass txClass, uint8_t b) {
+  sentAt[b] = hostMicros;
+  TEST_ASSERT_TRUE(landerSend(txClass, &b, 1));
+  landerTxPump();
+}
+
+static void grantCredit(const char* bytes) {
+  char name[] = "credit";
+  char value[16];
+  strcpy(value, bytes);
+  char* argv[] = {name, value};
+  creditHandler(Serial, 2, argv);
+}
+
+// Loop passes of 500 us that only pump
+static void idle(uint32_t micros) {
+  for (uint64_t end = hostMicros + micros; hostMicros < end;) {
+    hostMicros += 500;
+    landerTxPump();
+  }
+}
+
+void setUp() {
+  for (int c = 0; c < TX_CLASS_COUNT; c++) {
+    rings[c].head = rings[c].tail = 0;
+    rings[c].bytesSent = rings[c].bytesQueued = rings[c].drops = 0;
+  }
+  creditMode = false;
+  credit = 0;
+  port = HardwareSerial();
+  port.onLine = onLine;
+  landerTxBegin(port);
+  if (!creditHandler) registerLanderTxCommands();
+  memset(sentAt, 0, sizeof(sentAt));
+  memset(maxLatency, 0, sizeof(maxLatency));
+  memset(onLineCount, 0, sizeof(onLineCount));
+}
+
+void tearDown() {}
+
+static void testAckLatencyBoundedUnderFullTelemetryAndBulkLoad() {
+  uint8_t frame[120];
+  memset(frame, TELEMETRY, 60);
+  char reply[120];
+  memset(reply, BULK, sizeof(reply) - 1);
+  reply[sizeof(reply) - 1] = 0;
+  // Ten seconds of a 60 byte telemetry frame every 10 ms, half the line,
+  // and replies as fast as the loop can queue them for the rest, with an
+  // ack every 50 ms
+  uint64_t nextFrame = hostMicros, nextAck = hostMicros;
+  for (uint64_t end = hostMicros + 10000000; hostMicros < end;) {
+    if (hostMicros >= nextFrame) {
+      landerSend(TX_TELEMETRY, frame, 60);
+      nextFrame += 10000;
+    }
+    landerReplies.print(reply);
+    if (hostMicros >= nextAck) {
+      sendUrgent(TX_ACK, ACK);
+      nextAck += 50000;
+    }
+    hostMicros += 500;
+    landerTxPump();
+  }
+  idle(100000);
+  TEST_ASSERT_GREATER_THAN(150, onLineCount[ACK]);
+  // Behind at most the lower class bytes allowed in the UART
+  TEST_ASSERT_LESS_OR_EQUAL((LANDER_TX_LOW_PRIORITY_DEPTH + 2) * BYTE_MICROS, maxLatency[ACK]);
+  TEST_ASSERT_EQUAL(0, rings[TX_ACK].drops);
+  // Telemetry all goes ahead of bulk, and bulk fills the rest of the line
+  TEST_ASSERT_EQUAL(0, rings[TX_TELEMETRY].drops);
+  TEST_ASSERT_EQUAL(rings[TX_TELEMETRY].bytesQueued, onLineCount[TELEMETRY]);
+  TEST_ASSERT_GREATER_THAN(0, rings[TX_BULK].drops);
+  TEST_ASSERT_GREATER_THAN(10 * 11520 * 9 / 10, onLineCount[TELEMETRY] + onLineCount[BULK] + onLineCount[ACK]);
+  TEST_ASSERT_GREATER_THAN(10 * 11520 / 3, onLineCount[BULK]);
+}
+
+static void testAlarmGoesAheadOfTelemetryAndBulk() {
+  static uint8_t backlog[2000];
+  memset(backlog, TELEMETRY, sizeof(backlog));
+  TEST_ASSERT_TRUE(landerSend(TX_TELEMETRY, backlog, sizeof(backlog)));
+  memset(backlog, BULK, sizeof(backlog));
+  TEST_ASSERT_TRUE(landerSend(TX_BULK, backlog, sizeof(backlog)));
+  idle(20000);
+  sendUrgent(TX_ALARM, ALARM);
+  idle(20000);
+  sendUrgent(TX_ACK, ACK);
+  idle(1000000);
+  port.flush();
+  TEST_ASSERT_EQUAL(1, onLineCount[ALARM]);
+  TEST_ASSERT_LESS_OR_EQUAL((LANDER_TX_LOW_PRIORITY_DEPTH + 2) * BYTE_MICROS + 500, maxLatency[ALARM]);
+  TEST_ASSERT_LESS_OR_EQUAL((LANDER_TX_LOW_PRIORITY_DEPTH + 2) * BYTE_MICROS, maxLatency[ACK]);
+  TEST_ASSERT_EQUAL(2000, onLineCount[TELEMETRY]);
+  TEST_ASSERT_EQUAL(2000, onLineCount[BULK]);
+}
+
+static void testCreditLimitsTelemetryAndBulkButNotAcksOrAlarms() {
+  grantCredit("100");
+  uint8_t frame[80];
+  memset(frame, TELEMETRY, sizeof(frame));
+  TEST_ASSERT_TRUE(landerSend(TX_TELEMETRY, frame, sizeof(frame)));
+  char reply[300];
+  memset(reply, BULK, sizeof(reply));
+  TEST_ASSERT_EQUAL(sizeof(reply), landerReplies.write((const uint8_t*)reply, sizeof(reply)));
+  idle(100000);
+  TEST_ASSERT_EQUAL(80, onLineCount[TELEMETRY]);
+  TEST_ASSERT_EQUAL(20, onLineCount[BULK]);
+  sendUrgent(TX_ACK, ACK);
+  sendUrgent(TX_ALARM, ALARM);
+  idle(10000);
+  TEST_ASSERT_EQUAL(1, onLineCount[ACK]);
+  TEST_ASSERT_EQUAL(1, onLineCount[ALARM]);
+  grantCredit("50");
+  idle(100000);
+  TEST_ASSERT_EQUAL(70, onLineCount[BULK]);
+  TEST_ASSERT_EQUAL(230, rings[TX_BULK].used());
+}
+
+static void testReplyThatDoesNotFitIsDroppedWithoutWaiting() {
+  grantCredit("0");
+  static uint8_t dump[10000];
+  memset(dump, BULK, sizeof(dump));
+  uint64_t start = hostMicros;
+  TEST_ASSERT_EQUAL(6000, landerReplies.write(dump, 6000));
+  // Dropped whole, so a binary frame is never cut short
+  TEST_ASSERT_EQUAL(0, landerReplies.write(dump, 4000));
+  TEST_ASSERT_EQUAL(0, landerReplies.write(dump, sizeof(dump)));
+  TEST_ASSERT_EQUAL(2, rings[TX_BULK].drops);
+  TEST_ASSERT_EQUAL(6000, rings[TX_BULK].used());
+  TEST_ASSERT_EQUAL(start, hostMicros);
+}
+
+static void testFullAckRingDropsWholeMessage() {
+  uint8_t burst[sizeof(ackBuffer)];
+  memset(burst, ACK, sizeof(burst));
+  TEST_ASSERT_FALSE(landerSend(TX_ACK, burst, sizeof(burst)));
+  TEST_ASSERT_EQUAL(1, rings[TX_ACK].drops);
+  TEST_ASSERT_EQUAL(0, rings[TX_ACK].used());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testAckLatencyBoundedUnderFullTelemetryAndBulkLoad);
+  RUN_TEST(testAlarmGoesAheadOfTelemetryAndBulk);
+  RUN_TEST(testCreditLimitsTelemetryAndBulkButNotAcksOrAlarms);
+  RUN_TEST(testReplyThatDoesNotFitIsDroppedWithoutWaiting);
+  RUN_TEST(testFullAckRingDropsWholeMessage);
+  return UNITY_END();
+}
@@ -0,0 +1,100 @@
+#include <unity.h>
+#include "leds.cpp"
+
+static bool ledsEnergy = false;
+
+void energySet(EnergyActivity activity, bool on) {
+  if (activity == ENERGY_LEDS) ledsEnergy = on;
+}
+
+// One character per 100 ms slot for a pin, '1' while lit
+static void record(uint8_t pin, char* wave, int slots) {
+  for (int i = 0; i < slots; i++) {
+    if (ledTimer.callback) ledTimer.callback();
+    wave[i] = hostPins[pin] ? '1' : '0';
+  }
+  wave[slots] = 0;
+}
+
+void setUp() {
+  ledsSetEnabled(false);
+  sdFault = false;
+  sensorFault = false;
+  slot = 0;
+  ledsBegin();
+  ledsSetValveState(LED_VALVE_UNKNOWN);
+}
+
+void tearDown() {}
+
+static void testTimerRunsAtSlotRate() {
+  TEST_ASSERT_NOT_NULL(ledTimer.callback);
+  TEST_ASSERT_EQUAL(LED_SLOT_MICROSECONDS, ledTimer.period);
+  TEST_ASSERT_EQUAL(OUTPUT, hostPinModes[RED_LED_PIN]);
+}
+
+static void testHeartbeatBlinksOncePerSecond() {
+  char wave[21];
+  record(HEARTBEAT_LED_PIN, wave, 20);
+  TEST_ASSERT_EQUAL_STRING("10000000001000000000", wave);
+}
+
+static void testSdFaultDoubleBlinksHeartbeat() {
+  ledsSetSdFault(true);
+  char wave[21];
+  record(HEARTBEAT_LED_PIN, wave, 20);
+  TEST_ASSERT_EQUAL_STRING("10100000001010000000", wave);
+}
+
+static void testValvePositionPatterns() {
+  char red[11], green[11];
+  ledsSetValveState(LED_VALVE_TOP);
+  record(RED_LED_PIN, red, 10);
+  TEST_ASSERT_EQUAL_STRING("1000000000", red);
+  ledsSetValveState(LED_VALVE_BOTTOM);
+  record(GREEN_LED_PIN, green, 10);
+  TEST_ASSERT_EQUAL_STRING("1000000000", green);
+  TEST_ASSERT_EQUAL(LOW, hostPins[RED_LED_PIN]);
+}
+
+static void testLowPowerBlinksBothLong() {
+  ledsSetValveState(LED_VALVE_LOW_POWER);
+  char red[11];
+  record(RED_LED_PIN, red, 10);
+  TEST_ASSERT_EQUAL_STRING("1100000000", red);
+  TEST_ASSERT_EQUAL(LOW, hostPins[GREEN_LED_PIN]); // slot 9 is off
+}
+
+static void testSensorFaultOverridesValve() {
+  ledsSetValveState(LED_VALVE_TOP);
+  ledsSetSensorFault(true);
+  char red[11];
+  record(RED_LED_PIN, red, 10);
+  TEST_ASSERT_EQUAL_STRING("1010101010", red);
+}
+
+static void testDisabledHoldsPinsLow() {
+  ledsSetValveState(LED_VALVE_TOP);
+  char red[2];
+  record(RED_LED_PIN, red, 1);
+  TEST_ASSERT_TRUE(ledsEnergy);
+  ledsSetEnabled(false);
+  TEST_ASSERT_NULL(ledTimer.callback);
+  char wave[11];
+  record(RED_LED_PIN, wave, 10);
+  TEST_ASSERT_EQUAL_STRING("0000000000", wave);
+  TEST_ASSERT_EQUAL(LOW, hostPins[HEARTBEAT_LED_PIN]);
+  TEST_ASSERT_FALSE(ledsEnergy);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testTimerRunsAtSlotRate);
+  RUN_TEST(testHeartbeatBlinksOncePerSecond);
+  RUN_TEST(testSdFaultDoubleBlinksHeartbeat);
+  RUN_TEST(testValvePositionPatterns);
+  RUN_TEST(testLowPowerBlinksBothLong);
+  RUN_TEST(testSensorFaultOverridesValve);
+  RUN_TEST(testDisabledHoldsPinsLow);
+  return UNITY_END();
+}
@@ -0,0 +1,241 @@
+#include <unity.h>
+#include <climits>
+#include <random>
+#include "loadshed.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+Config config;
+static int latestMa = 0, latestMv = 0;
+static bool servoMoving = false;
+
+int samplerLatestCurrent() { return latestMa; }
+int samplerLatestVoltage() { return latestMv; }
+uint8_t energyActivity() { return servoMoving ? 1 << ENERGY_SERVO_MOVE : 0; }
+
+// The bench of tools/loadshed_sim.py: a source behind a supply resistance,
+// loaded by the controller, a pump with periodic peaks, SD flushes and the
+// servo's inrush
+struct Supply {
+  double sourceMv = 12200;
+  double ohm = 1.4;
+  double noiseMv = 15;
+  double baseMa = 120;
+  double pumpBaseMa = 150;
+  double pumpPeakMa = 700;
+  uint32_t pumpPeriodMs = 1000;
+  uint32_t pumpPeakMs = 150;
+  double servoInrushMa = 900;
+  uint32_t inrushMs = 120;
+  double servoRunMa = 250;
+  uint32_t servoMs = 800;
+  double sdMa = 120;
+  uint32_t sdMs = 60;
+};
+
+static const int32_t THRESHOLD_MV = 10000;
+static const uint32_t WARMUP_MS = 30000;
+
+struct Trial {
+  int minMv;
+  uint32_t delayMs;
+};
+
+static Supply supply;
+static std::mt19937 rng;
+
+static void resetLoadShed() {
+  meanMa = meanMv = covariance = variance = 0;
+  fitStarted = false;
+  resistanceMohm = LOADSHED_DEFAULT_MOHM;
+  sourceMv = 0;
+  memset(history, 0, sizeof(history));
+  historyHead = 0;
+  periodTicks = 0;
+  pendingPosition = 0;
+  deferring = false;
+  deferSince = 0;
+  moveActive = false;
+  moveMinMv = lastMoveMinMv = worstMoveMinMv = 0;
+  movesDeferred = movesForced = movesRefused = maxDelayMs = workDeferred = 0;
+}
+
+static double pumpMa(uint32_t t, uint32_t phase) {
+  return (t + phase) % supply.pumpPeriodMs < supply.pumpPeakMs ? supply.pumpPeakMa : supply.pumpBaseMa;
+}
+
+// Bus at time t with the servo started at moveStart and an SD flush at
+// sdStart (UINT32_MAX for neither); sets what the sampler would read
+static void busAt(uint32_t t, uint32_t phase, uint32_t moveStart, uint32_t sdStart) {
+  double ma = supply.baseMa + pumpMa(t, phase);
+  if (t >= moveStart && t - moveStart < supply.servoMs) {
+    ma += t - moveStart < supply.inrushMs ? supply.servoInrushMa : supply.servoRunMa;
+  }
+  if (t >= sdStart && t - sdStart < supply.sdMs) ma += supply.sdMa;
+  latestMa = lround(ma);
+  latestMv = lround(supply.sourceMv - ma * supply.ohm + std::normal_distribution<double>(0, supply.noiseMv)(rng));
+  servoMoving = t >= moveStart && t - moveStart < supply.servoMs;
+  hostMicros = (uint64_t)t * 1000;
+}
+
+// One move requested at a random pump phase, with an SD flush due on a
+// once-a-second boundary near it half the time; the minimum bus voltage
+// around the move at 1 ms resolution
+static Trial runTrial(bool controlled) {
+  resetLoadShed();
+  uint32_t phase = rng() % supply.pumpPeriodMs;
+  uint32_t request = WARMUP_MS + rng() % 1000;
+  uint32_t sdDue = UINT32_MAX;
+  if (rng() % 2) sdDue = (request / 1000 + rng() % 2) * 1000;
+
+  uint32_t moveStart = controlled ? UINT32_MAX : request;
+  uint32_t sdStart = controlled ? UINT32_MAX : sdDue;
+  bool pending = controlled;
+  int minMv = INT_MAX;
+  for (uint32_t t = 0; t < request + 4000; t++) {
+    // The warm-up only needs the ticks
+    if (t < request - 1000 && t % EVENT_TICK_MS) continue;
+    busAt(t, phase, moveStart, sdStart);
+    if (t >= request - 1000) minMv = min(minMv, latestMv);
+    if (!controlled || t % EVENT_TICK_MS) continue;
+    loadShedPoll();
+    if (pending && t >= request && loadShedAdmitMove(1500) == LOADSHED_ADMIT) {
+      moveStart = t;
+      pending = false;
+    }
+    if (sdStart == UINT32_MAX && t >= sdDue && t % 1000 == 0 && !loadShedDeferWork()) sdStart = t;
+  }
+  return {minMv, moveStart - request};
+}
+
+static void warmUp(uint32_t phase) {
+  for (uint32_t t = 0; t < WARMUP_MS; t += EVENT_TICK_MS) {
+    busAt(t, phase, UINT32_MAX, UINT32_MAX);
+    loadShedPoll();
+  }
+}
+
+void setUp() {
+  supply = Supply();
+  rng.seed(1);
+  config.thresholdVoltage = THRESHOLD_MV;
+  servoMoving = false;
+  resetLoadShed();
+}
+
+void tearDown() {}
+
+static void testFitFindsTheSupplyAndThePumpPeriod() {
+  warmUp(0);
+  TEST_ASSERT_INT_WITHIN(140, 1400, resistanceMohm);
+  TEST_ASSERT_INT_WITHIN(100, 12200, sourceMv);
+  TEST_ASSERT_EQUAL(supply.pumpPeriodMs / EVENT_TICK_MS, periodTicks);
+}
+
+static void testMoveWaitsOutAPumpPeak() {
+  warmUp(0);
+  // 20 ms before the next peak: the forecast covers it
+  uint32_t t = WARMUP_MS + supply.pumpPeriodMs - 20;
+  busAt(t, 0, UINT32_MAX, UINT32_MAX);
+  loadShedPoll();
+  TEST_ASSERT_LESS_THAN(LOADSHED_SERVO_PEAK_MA, loadShedBudget());
+  TEST_ASSERT_EQUAL(LOADSHED_WAIT, loadShedAdmitMove(1500));
+  TEST_ASSERT_TRUE(loadShedBusy());
+  TEST_ASSERT_EQUAL(LOADSHED_BUSY, loadShedAdmitMove(1200));
+  int position;
+  TEST_ASSERT_TRUE(loadShedPendingMove(position));
+  TEST_ASSERT_EQUAL(1500, position);
+  LoadShedAdmit admit = LOADSHED_WAIT;
+  while (admit == LOADSHED_WAIT) {
+    t += EVENT_TICK_MS;
+    busAt(t, 0, UINT32_MAX, UINT32_MAX);
+    loadShedPoll();
+    admit = loadShedAdmitMove(1500);
+  }
+  TEST_ASSERT_EQUAL(LOADSHED_ADMIT, admit);
+  // Past the peak, well inside the limit
+  TEST_ASSERT_GREATER_OR_EQUAL(supply.pumpPeakMs, t % supply.pumpPeriodMs);
+  TEST_ASSERT_LESS_THAN(LOADSHED_MAX_DELAY_MS, maxDelayMs);
+  TEST_ASSERT_EQUAL(1, movesDeferred);
+  TEST_ASSERT_EQUAL(1, movesRefused);
+  TEST_ASSERT_FALSE(loadShedPendingMove(position));
+}
+
+static void testMoveGoesAheadAfterTheMaximumDelay() {
+  // A supply too soft for the servo at any pump phase
+  supply.ohm = 2.5;
+  warmUp(0);
+  uint32_t t = WARMUP_MS;
+  TEST_ASSERT_EQUAL(LOADSHED_WAIT, loadShedAdmitMove(1500));
+  LoadShedAdmit admit = LOADSHED_WAIT;
+  while (admit == LOADSHED_WAIT) {
+    t += EVENT_TICK_MS;
+    busAt(t, 0, UINT32_MAX, UINT32_MAX);
+    loadShedPoll();
+    admit = loadShedAdmitMove(1500);
+  }
+  TEST_ASSERT_EQUAL(LOADSHED_ADMIT, admit);
+  TEST_ASSERT_EQUAL(1, movesForced);
+  TEST_ASSERT_EQUAL(LOADSHED_MAX_DELAY_MS, maxDelayMs);
+}
+
+static void testCancelDropsTheWaitingMove() {
+  warmUp(0);
+  busAt(WARMUP_MS + supply.pumpPeriodMs - 20, 0, UINT32_MAX, UINT32_MAX);
+  loadShedPoll();
+  TEST_ASSERT_EQUAL(LOADSHED_WAIT, loadShedAdmitMove(1500));
+  TEST_ASSERT_TRUE(loadShedCancelMove());
+  TEST_ASSERT_FALSE(loadShedBusy());
+  TEST_ASSERT_FALSE(loadShedCancelMove());
+}
+
+static void testStiffSupplyAdmitsAtOnce() {
+  supply.ohm = 0.2;
+  for (int i = 0; i < 50; i++) {
+    Trial trial = runTrial(true);
+    // Admitted on the first tick after the request
+    TEST_ASSERT_LESS_THAN(EVENT_TICK_MS, trial.delayMs);
+    TEST_ASSERT_EQUAL(0, movesDeferred);
+  }
+}
+
+static void testSheddingRaisesTheMinimumBusVoltage() {
+  const int trials = 200;
+  int fixedMin = INT_MAX, shedMin = INT_MAX, fixedBelow = 0, shedBelow = 0;
+  uint32_t shedMaxDelay = 0;
+  for (int controlled = 0; controlled < 2; controlled++) {
+    rng.seed(1);
+    for (int i = 0; i < trials; i++) {
+      Trial trial = runTrial(controlled);
+      if (controlled) {
+        shedMin = min(shedMin, trial.minMv);
+        shedBelow += trial.minMv < THRESHOLD_MV;
+        shedMaxDelay = max(shedMaxDelay, trial.delayMs);
+      } else {
+        fixedMin = min(fixedMin, trial.minMv);
+        fixedBelow += trial.minMv < THRESHOLD_MV;
+      }
+    }
+  }
+  printf("minimum bus: fixed %d mV (%d below threshold), shedding %d mV (%d below), max delay %lu ms\n", fixedMin,
+         fixedBelow, shedMin, shedBelow, (unsigned long)shedMaxDelay);
+  // A move on a pump peak, with a flush stacked on it, browns out
+  TEST_ASSERT_LESS_THAN(THRESHOLD_MV, fixedMin);
+  TEST_ASSERT_GREATER_THAN(0, fixedBelow);
+  TEST_ASSERT_GREATER_OR_EQUAL(THRESHOLD_MV, shedMin);
+  TEST_ASSERT_EQUAL(0, shedBelow);
+  TEST_ASSERT_GREATER_THAN(fixedMin + 300, shedMin);
+  // Waiting out a peak, not the maximum delay
+  TEST_ASSERT_LESS_THAN(supply.pumpPeriodMs, shedMaxDelay);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testFitFindsTheSupplyAndThePumpPeriod);
+  RUN_TEST(testMoveWaitsOutAPumpPeak);
+  RUN_TEST(testMoveGoesAheadAfterTheMaximumDelay);
+  RUN_TEST(testCancelDropsTheWaitingMove);
+  RUN_TEST(testStiffSupplyAdmitsAtOnce);
+  RUN_TEST(testSheddingRaisesTheMinimumBusVoltage);
+  return UNITY_END();
+}
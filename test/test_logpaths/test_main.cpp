@@ -0,0 +1,113 @@
+#include <unity.h>
+#include "logging.cpp"
+
+volatile uint32_t metricCounters[COUNTER_COUNT];
+volatile int32_t metricGauges[GAUGE_COUNT];
+volatile uint32_t metricHistograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+
+static time_t clockSeconds;
+
+Timestamp syncedNow() { return {clockSeconds, 0}; }
+void energySet(EnergyActivity, bool) {}
+void ledsSetSdFault(bool) {}
+void scrubTrack(const char*, uint32_t, const void*, size_t) {}
+bool sdPowerWake() { return true; }
+bool stagingAppend(const char*, const char*) { return true; }
+
+const time_t JUNE_1_2025 = 1748779200; // 12:00 UTC
+const uint32_t DAY = 86400;
+// FAT reads a 32-byte entry per step of a directory scan
+const uint32_t MICROS_PER_ENTRY = 2;
+
+void setUp() {
+  SD.reset();
+  SD.lookupMicrosPerEntry = MICROS_PER_ENTRY;
+  sdClose();
+  filename[0] = 0;
+  clockSeconds = JUNE_1_2025;
+}
+
+void tearDown() {}
+
+static void testPathUsesYearAndMonthDirectories() {
+  updateFilename();
+  TEST_ASSERT_EQUAL_STRING("/2025/06/gems_pump_2025-06-01.csv", filename);
+  // Same day of the month, as after a clock step or a month powered off
+  clockSeconds += 30 * DAY;
+  updateFilename();
+  TEST_ASSERT_EQUAL_STRING("/2025/07/gems_pump_2025-07-01.csv", filename);
+}
+
+static void testFirstWriteCreatesDirectoriesAndHeader() {
+  updateFilename();
+  TEST_ASSERT_TRUE(sdWrite(filename, "a\n", 2));
+  TEST_ASSERT_TRUE(SD.exists("/2025/06"));
+  std::vector<uint8_t>* data = SD.contents(filename);
+  TEST_ASSERT_NOT_NULL(data);
+  std::string text(data->begin(), data->end());
+  TEST_ASSERT_EQUAL_STRING((std::string(LOG_HEADER) + "\r\na\n").c_str(), text.c_str());
+}
+
+static void testSameDayWritesReuseTheOpenFile() {
+  updateFilename();
+  sdWrite(filename, "a\n", 2);
+  uint32_t opens = SD.opens;
+  uint64_t scanned = SD.entriesScanned;
+  for (int i = 0; i < 100; i++) sdWrite(filename, "b\n", 2);
+  TEST_ASSERT_EQUAL(opens, SD.opens);
+  TEST_ASSERT_EQUAL(scanned, SD.entriesScanned);
+}
+
+// Virtual time spent in the first write of each day, over `days` days
+static void runDays(int days, bool flat, uint64_t* firstMonth, uint64_t* lastMonth) {
+  *firstMonth = *lastMonth = 0;
+  for (int d = 0; d < days; d++) {
+    updateFilename();
+    char path[48];
+    strlcpy(path, filename, sizeof(path));
+    if (flat) strlcpy(path, strrchr(filename, '/'), sizeof(path));
+    uint64_t start = hostMicros;
+    sdWrite(path, "r\n", 2);
+    uint64_t spent = hostMicros - start;
+    if (d < 30) *firstMonth = max(*firstMonth, spent);
+    if (d >= days - 30) *lastMonth = max(*lastMonth, spent);
+    for (int i = 0; i < 8; i++) sdWrite(path, "r\n", 2);
+    clockSeconds += DAY;
+  }
+}
+
+static void testOpenLatencyStaysFlatOverYears() {
+  // Six years of daily files
+  uint64_t firstMonth, lastMonth;
+  runDays(6 * 365, false, &firstMonth, &lastMonth);
+  // Each lookup scans at most the years, 12 months and 31 days, and an
+  // open makes a handful of lookups
+  TEST_ASSERT_LESS_OR_EQUAL(5 * (7 + 12 + 31) * MICROS_PER_ENTRY, lastMonth);
+  TEST_ASSERT_LESS_OR_EQUAL(2 * firstMonth, lastMonth);
+
+  // The same deployment with every file in the root scans thousands
+  SD.reset();
+  SD.lookupMicrosPerEntry = MICROS_PER_ENTRY;
+  sdClose();
+  clockSeconds = JUNE_1_2025;
+  uint64_t flatFirst, flatLast;
+  runDays(6 * 365, true, &flatFirst, &flatLast);
+  TEST_ASSERT_GREATER_THAN(2000 * MICROS_PER_ENTRY, flatLast);
+  TEST_ASSERT_GREATER_THAN(10 * lastMonth, flatLast);
+}
+
+static void testTimestampFormat() {
+  char text[32];
+  formatTimestamp(text, sizeof(text), {JUNE_1_2025, 250});
+  TEST_ASSERT_EQUAL_STRING("2025-06-01T12:00:00.250Z", text);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testPathUsesYearAndMonthDirectories);
+  RUN_TEST(testFirstWriteCreatesDirectoriesAndHeader);
+  RUN_TEST(testSameDayWritesReuseTheOpenFile);
+  RUN_TEST(testOpenLatencyStaysFlatOverYears);
+  RUN_TEST(testTimestampFormat);
+  return UNITY_END();
+}
@@ -0,0 +1,252 @@
+#include <unity.h>
+#include <LittleFS.h>
+#include <SD.h>
+#include "scrub.cpp"
+#include "crc.cpp"
+
+volatile uint32_t metricCounters[COUNTER_COUNT];
+volatile int32_t metricGauges[GAUGE_COUNT];
+volatile uint32_t metricHistograms[HISTOGRAM_COUNT][METRICS_BUCKETS];
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+void energySet(EnergyActivity, bool) {}
+
+static LittleFS_Program staging;
+static bool stagingReady = true;
+static bool awake = true;
+static std::vector<std::string> events;
+
+FS* stagingFlash() { return stagingReady ? &staging : nullptr; }
+bool stagingSdHealthy() { return !SD.failed; }
+bool sdPowerAwake() { return awake; }
+
+void logEvent(const char* format, ...) {
+  char text[160];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  events.push_back(text);
+}
+
+// Append to an SD log the way logging does, tracking what was written
+static void writeLog(const char* path, const std::string& text) {
+  File file = SD.open(path, FILE_WRITE);
+  TEST_ASSERT_TRUE(file);
+  uint32_t offset = file.size();
+  TEST_ASSERT_EQUAL(text.size(), file.write((const uint8_t*)text.data(), text.size()));
+  file.close();
+  scrubTrack(path, offset, text.data(), text.size());
+}
+
+static std::string lines(const char* prefix, int first, int count) {
+  std::string text;
+  for (int i = first; i < first + count; i++) text += prefix + std::to_string(i) + ",12000,1\n";
+  return text;
+}
+
+static std::string manifest() {
+  std::vector<uint8_t>* data = staging.contents(MANIFEST);
+  return data ? std::string(data->begin(), data->end()) : std::string();
+}
+
+static void runSeconds(uint32_t n) {
+  for (uint32_t i = 0; i < n; i++) {
+    hostMicros += 1000000;
+    scrubStep();
+  }
+}
+
+static void flipBit(const char* path, size_t offset) {
+  std::vector<uint8_t>* data = SD.contents(path);
+  TEST_ASSERT_NOT_NULL(data);
+  (*data)[offset] ^= 0x10;
+}
+
+// Module state lost on a reset; the flash and card keep their contents
+static void reboot() {
+  if (scrubFile) scrubFile.close();
+  memset(tracked, 0, sizeof(tracked));
+  memset(trackedUse, 0, sizeof(trackedUse));
+  trackedWrites = 0;
+  checking = {};
+  checked = cursor = cursorOffset = nextOffset = passStart = 0;
+  passDone = suspended = false;
+  segmentsVerified = failures = passes = passFailures = 0;
+  passReads = passMicros = passMaxMicros = lastPassAverage = lastPassMax = 0;
+  scrubBegin();
+}
+
+void setUp() {
+  SD.reset();
+  SD.readMicros = nullptr;
+  staging.reset();
+  stagingReady = true;
+  awake = true;
+  events.clear();
+  memset((void*)metricCounters, 0, sizeof(metricCounters));
+  hostMicros = 0;
+  reboot();
+}
+
+void tearDown() {}
+
+// Two logs appended in turn, then a third file evicting the older slot
+static void writeThreeFiles() {
+  for (int i = 0; i < 10; i++) {
+    writeLog("/a.csv", lines("a", i * 100, 100));
+    writeLog("/a.bin", lines("b", i * 100, 100));
+  }
+  writeLog("/c.csv", lines("c", 0, 100));
+  writeLog("/c.bin", lines("d", 0, 100));
+}
+
+static void testSegmentsSealWhenWritingMovesOn() {
+  writeThreeFiles();
+  char line[80];
+  uint16_t crc = crc16(lines("a", 0, 1000).data(), lines("a", 0, 1000).size());
+  snprintf(line, sizeof(line), "/a.csv 0 %u %04x\n", (unsigned)lines("a", 0, 1000).size(), crc);
+  std::string expected = line;
+  crc = crc16(lines("b", 0, 1000).data(), lines("b", 0, 1000).size());
+  snprintf(line, sizeof(line), "/a.bin 0 %u %04x\n", (unsigned)lines("b", 0, 1000).size(), crc);
+  expected += line;
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), manifest().c_str());
+}
+
+static void testAppendAfterResetContinuesTheOpenSegment() {
+  writeLog("/a.csv", lines("a", 0, 100));
+  reboot();
+  writeLog("/a.csv", lines("a", 100, 100));
+  writeLog("/b.csv", lines("b", 0, 10));
+  writeLog("/c.csv", lines("c", 0, 10));
+  ScrubSegment segment;
+  TEST_ASSERT_TRUE(parseSegment(manifest().c_str(), segment));
+  TEST_ASSERT_EQUAL_STRING("/a.csv", segment.path);
+  TEST_ASSERT_EQUAL(lines("a", 0, 200).size(), segment.length);
+  TEST_ASSERT_EQUAL_HEX16(crc16(lines("a", 0, 200).data(), segment.length), segment.crc);
+}
+
+static void testCleanPassVerifiesEverySegmentQuietly() {
+  writeThreeFiles();
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(2, segmentsVerified);
+  TEST_ASSERT_EQUAL(1, passes);
+  TEST_ASSERT_EQUAL(0, failures);
+  TEST_ASSERT_EQUAL(0, metricCounters[COUNTER_SCRUB_FAILURES]);
+  TEST_ASSERT_EQUAL(0, events.size());
+}
+
+static void testBitRotIsReportedOnce() {
+  writeThreeFiles();
+  flipBit("/a.bin", 5000);
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(1, segmentsVerified);
+  TEST_ASSERT_EQUAL(1, failures);
+  TEST_ASSERT_EQUAL(1, metricCounters[COUNTER_SCRUB_FAILURES]);
+  TEST_ASSERT_EQUAL(2, events.size());
+  TEST_ASSERT_EQUAL_STRING("Scrub /a.bin@0: CRC mismatch", events[0].c_str());
+  TEST_ASSERT_EQUAL(0, events[1].find("Scrub pass 1: 2 segments, 1 failures"));
+}
+
+static void testTruncatedAndMissingFilesFail() {
+  writeThreeFiles();
+  SD.contents("/a.csv")->resize(100);
+  SD.remove("/a.bin");
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(2, failures);
+  TEST_ASSERT_EQUAL(2, metricCounters[COUNTER_SCRUB_FAILURES]);
+  TEST_ASSERT_EQUAL_STRING("Scrub /a.csv@0: truncated", events[0].c_str());
+  TEST_ASSERT_EQUAL_STRING("Scrub /a.bin@0: missing", events[1].c_str());
+}
+
+static void testDamagedManifestLineIsSkipped() {
+  writeThreeFiles();
+  std::vector<uint8_t>* data = staging.contents(MANIFEST);
+  std::string text(data->begin(), data->end());
+  text = "garbage\n" + text.substr(0, text.find('\n') + 1) + "/x.csv 12\n" + text.substr(text.find('\n') + 1);
+  data->assign(text.begin(), text.end());
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(2, segmentsVerified);
+  TEST_ASSERT_EQUAL(0, failures);
+}
+
+static void testReadsStayWithinTheBudget() {
+  writeThreeFiles();
+  size_t total = lines("a", 0, 1000).size() + lines("b", 0, 1000).size();
+  uint32_t steps = 0;
+  while (!passes && steps < 1000) {
+    uint32_t before = passReads;
+    runSeconds(1);
+    if (!passes) TEST_ASSERT_LESS_OR_EQUAL(SCRUB_BYTES_PER_SECOND / SCRUB_READ_SIZE, passReads - before);
+    steps++;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL((total + SCRUB_BYTES_PER_SECOND - 1) / SCRUB_BYTES_PER_SECOND, steps);
+}
+
+static void testNextPassWaitsForTheInterval() {
+  writeThreeFiles();
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(1, passes);
+  flipBit("/a.csv", 10);
+  runSeconds(SCRUB_PASS_INTERVAL - 120);
+  TEST_ASSERT_EQUAL(0, failures);
+  runSeconds(120);
+  TEST_ASSERT_EQUAL(1, failures);
+}
+
+static uint32_t readLatency = 0;
+static uint32_t slowRead(size_t, uint64_t) { return readLatency; }
+
+static void testSlowingReadsShowInThePassLatency() {
+  writeThreeFiles();
+  SD.readMicros = slowRead;
+  readLatency = 800;
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(800, lastPassAverage);
+  readLatency = 5000;
+  runSeconds(SCRUB_PASS_INTERVAL);
+  TEST_ASSERT_EQUAL(2, passes);
+  TEST_ASSERT_EQUAL(5000, lastPassAverage);
+  TEST_ASSERT_EQUAL(5000, lastPassMax);
+  TEST_ASSERT_EQUAL(0, failures);
+}
+
+static void testSuspendResumesWhereItLeftOff() {
+  writeThreeFiles();
+  runSeconds(1);
+  TEST_ASSERT_EQUAL(SCRUB_BYTES_PER_SECOND, checked);
+  scrubSuspend();
+  awake = false;
+  runSeconds(10);
+  TEST_ASSERT_EQUAL(SCRUB_BYTES_PER_SECOND, checked);
+  awake = true;
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(2, segmentsVerified);
+  TEST_ASSERT_EQUAL(0, failures);
+}
+
+static void testFailingCardIsLeftAlone() {
+  writeThreeFiles();
+  SD.failed = true;
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(0, failures);
+  SD.failed = false;
+  runSeconds(60);
+  TEST_ASSERT_EQUAL(2, segmentsVerified);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testSegmentsSealWhenWritingMovesOn);
+  RUN_TEST(testAppendAfterResetContinuesTheOpenSegment);
+  RUN_TEST(testCleanPassVerifiesEverySegmentQuietly);
+  RUN_TEST(testBitRotIsReportedOnce);
+  RUN_TEST(testTruncatedAndMissingFilesFail);
+  RUN_TEST(testDamagedManifestLineIsSkipped);
+  RUN_TEST(testReadsStayWithinTheBudget);
+  RUN_TEST(testNextPassWaitsForTheInterval);
+  RUN_TEST(testSlowingReadsShowInThePassLatency);
+  RUN_TEST(testSuspendResumesWhereItLeftOff);
+  RUN_TEST(testFailingCardIsLeftAlone);
+  return UNITY_END();
+}
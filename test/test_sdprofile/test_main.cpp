@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <random>
+#include "sdprofile.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+static bool shedBusy = false;
+static char lastEvent[256];
+static SdTuning applied = {};
+static int batchesSet = 0;
+
+bool loadShedBusy() { return shedBusy; }
+bool sdPowerWake() { return !SD.failed; }
+
+void logEvent(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(lastEvent, sizeof(lastEvent), format, args);
+  va_end(args);
+}
+
+void stagingSetBatch(uint32_t bytes, uint32_t maxAge) {
+  applied = {bytes, maxAge};
+  batchesSet++;
+}
+
+// A card model: a fixed cost per write, a cost per byte, exponential jitter
+// and an erase stall for each multiple of stallEvery bytes a write crosses
+struct CardModel {
+  uint32_t overheadUs;
+  uint32_t bytesPerUs;
+  uint32_t jitterMeanUs;
+  uint32_t stallEvery;
+  uint32_t stallUs;
+};
+
+static CardModel card;
+static std::mt19937 rng;
+static uint32_t failAfterWrites = 0;
+static uint32_t writes = 0;
+
+static uint32_t cardWriteMicros(size_t bytes, uint64_t offset) {
+  writes++;
+  if (failAfterWrites && writes == failAfterWrites) SD.failed = true;
+  uint32_t us = card.overheadUs + bytes / card.bytesPerUs;
+  if (card.jitterMeanUs) us += std::exponential_distribution<double>(1.0 / card.jitterMeanUs)(rng);
+  if (card.stallEvery) us += card.stallUs * ((offset + bytes) / card.stallEvery - offset / card.stallEvery);
+  return us;
+}
+
+static void profileCard(const CardModel& model) {
+  card = model;
+  TEST_ASSERT_TRUE(sdProfileStart());
+  for (int polls = 0; sdProfileRunning() && polls < 100000; polls++) sdProfilePoll();
+  TEST_ASSERT_FALSE(sdProfileRunning());
+}
+
+void setUp() {
+  SD.reset();
+  SD.writeMicros = cardWriteMicros;
+  rng.seed(1);
+  shedBusy = false;
+  lastEvent[0] = 0;
+  applied = {};
+  batchesSet = 0;
+  failAfterWrites = 0;
+  writes = 0;
+  lastProfile = {};
+  lastTuning = {STAGING_BATCH_BYTES, STAGING_MAX_AGE};
+}
+
+void tearDown() {}
+
+static void testOverheadBoundCardBatchesAtTheThroughputKnee() {
+  // 200 us a write plus 4 bytes/us: 8 kB reaches 90% of the 16 kB rate
+  profileCard({200, 4, 10, 0, 0});
+  TEST_ASSERT_TRUE(lastProfile.valid);
+  TEST_ASSERT_EQUAL(0, lastProfile.stalls);
+  for (uint8_t s = 1; s < SD_PROFILE_SIZE_COUNT; s++) {
+    TEST_ASSERT_GREATER_THAN(lastProfile.sizes[s - 1].kBps, lastProfile.sizes[s].kBps);
+  }
+  TEST_ASSERT_EQUAL(1, batchesSet);
+  TEST_ASSERT_EQUAL(8192, applied.batchBytes);
+  // Fast writes: migrate more often
+  TEST_ASSERT_EQUAL(STAGING_MAX_AGE / 2, applied.maxAge);
+  TEST_ASSERT_FALSE(SD.exists(SCRATCH));
+}
+
+static void testByteBoundCardBatchesSmall() {
+  profileCard({10, 2, 5, 0, 0});
+  TEST_ASSERT_EQUAL(512, applied.batchBytes);
+  TEST_ASSERT_EQUAL(STAGING_MAX_AGE / 2, applied.maxAge);
+}
+
+static void testEraseStallsWidenTheBatchToTheirPeriod() {
+  // The byte-bound card, stalling 50 ms every 8 kB
+  profileCard({10, 2, 5, 8192, 50000});
+  TEST_ASSERT_EQUAL(SD_PROFILE_BYTES / 8192, lastProfile.stalls);
+  TEST_ASSERT_EQUAL(8192, lastProfile.stallPeriod);
+  TEST_ASSERT_GREATER_OR_EQUAL(50000, lastProfile.sizes[0].p99);
+  TEST_ASSERT_EQUAL(8192, applied.batchBytes);
+  TEST_ASSERT_EQUAL(STAGING_MAX_AGE, applied.maxAge);
+}
+
+static void testLongStallsMigrateLessOften() {
+  profileCard({10, 2, 5, 4096, 150000});
+  TEST_ASSERT_EQUAL(4096, lastProfile.stallPeriod);
+  TEST_ASSERT_EQUAL(4096, applied.batchBytes);
+  TEST_ASSERT_EQUAL(STAGING_MAX_AGE * 2, applied.maxAge);
+}
+
+static void testStallsWiderThanTheLargestSizeCapTheBatch() {
+  profileCard({10, 2, 5, 32768, 50000});
+  TEST_ASSERT_EQUAL(32768, lastProfile.stallPeriod);
+  TEST_ASSERT_EQUAL(SD_PROFILE_SIZES[SD_PROFILE_SIZE_COUNT - 1], applied.batchBytes);
+}
+
+static void testPollsStayWithinASlice() {
+  card = {200, 4, 10, 0, 0};
+  TEST_ASSERT_TRUE(sdProfileStart());
+  TEST_ASSERT_FALSE(sdProfileStart());
+  uint32_t longest = 0;
+  while (sdProfileRunning()) {
+    uint64_t start = hostMicros;
+    sdProfilePoll();
+    longest = max(longest, (uint32_t)(hostMicros - start));
+  }
+  // The slice check runs after each write, so one write can overrun it
+  TEST_ASSERT_LESS_OR_EQUAL(SD_PROFILE_SLICE_US + 200 + 16384 / 4 + 200, longest);
+}
+
+static void testLoadShedDefersWrites() {
+  card = {200, 4, 10, 0, 0};
+  TEST_ASSERT_TRUE(sdProfileStart());
+  shedBusy = true;
+  for (int i = 0; i < 10; i++) sdProfilePoll();
+  TEST_ASSERT_EQUAL(0, writes);
+  shedBusy = false;
+  sdProfilePoll();
+  TEST_ASSERT_GREATER_THAN(0, writes);
+  while (sdProfileRunning()) sdProfilePoll();
+  TEST_ASSERT_TRUE(lastProfile.valid);
+}
+
+static void testFailedCardKeepsStagingDefaults() {
+  failAfterWrites = 300;
+  profileCard({200, 4, 10, 0, 0});
+  TEST_ASSERT_FALSE(lastProfile.valid);
+  TEST_ASSERT_EQUAL(0, batchesSet);
+  TEST_ASSERT_EQUAL_STRING("SD profile failed, staging defaults kept", lastEvent);
+}
+
+static void testTuneIsAPureFunctionOfTheProfile() {
+  SdProfile profile = {};
+  SdTuning tuning = sdProfileTune(profile);
+  TEST_ASSERT_EQUAL(STAGING_BATCH_BYTES, tuning.batchBytes);
+  TEST_ASSERT_EQUAL(STAGING_MAX_AGE, tuning.maxAge);
+
+  // Re-derived from the numbers a run logs
+  profileCard({200, 4, 10, 8192, 50000});
+  SdTuning logged = lastTuning;
+  tuning = sdProfileTune(lastProfile);
+  TEST_ASSERT_EQUAL(logged.batchBytes, tuning.batchBytes);
+  TEST_ASSERT_EQUAL(logged.maxAge, tuning.maxAge);
+  char expected[32];
+  snprintf(expected, sizeof(expected), "batch %lu B", (unsigned long)tuning.batchBytes);
+  TEST_ASSERT_NOT_NULL(strstr(lastEvent, expected));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testOverheadBoundCardBatchesAtTheThroughputKnee);
+  RUN_TEST(testByteBoundCardBatchesSmall);
+  RUN_TEST(testEraseStallsWidenTheBatchToTheirPeriod);
+  RUN_TEST(testLongStallsMigrateLessOften);
+  RUN_TEST(testStallsWiderThanTheLargestSizeCapTheBatch);
+  RUN_TEST(testPollsStayWithinASlice);
+  RUN_TEST(testLoadShedDefersWrites);
+  RUN_TEST(testFailedCardKeepsStagingDefaults);
+  RUN_TEST(testTuneIsAPureFunctionOfTheProfile);
+  return UNITY_END();
+}
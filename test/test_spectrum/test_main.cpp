@@ -0,0 +1,97 @@
+#include <unity.h>
+#include "spectrum.cpp"
+
+const uint32_t PERIOD_1KHZ = F_CPU_ACTUAL / 1000;
+
+static SampleBlock block;
+
+static void fillBlock(float hz, float amplitude, float noise) {
+  block.count = SAMPLE_BLOCK_SIZE;
+  block.periodCycles = PERIOD_1KHZ;
+  for (uint16_t i = 0; i < SAMPLE_BLOCK_SIZE; i++) {
+    float n = noise * ((rand() % 2001) - 1000) / 1000.0f;
+    block.current[i] = lroundf(800 + amplitude * sinf(2 * M_PI * hz * (block.seq * SAMPLE_BLOCK_SIZE + i) / 1000) + n);
+  }
+  block.seq++;
+}
+
+void setUp() {
+  srand(3);
+  spectrumBegin();
+  spectrumTake();
+  block.seq = 0;
+}
+
+void tearDown() {}
+
+static void testScalarFftMatchesReferenceDft() {
+  float input[SPECTRUM_SIZE];
+  for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) {
+    input[i] = (rand() % 2001 - 1000) / 10.0f;
+    frame[i] = input[i];
+  }
+  powerSpectrum();
+  float peak = 0;
+  for (uint16_t k = 0; k < BINS; k++) peak = max(peak, power[k]);
+  for (uint16_t k = 0; k < BINS; k++) {
+    double re = 0, im = 0;
+    for (uint16_t i = 0; i < SPECTRUM_SIZE; i++) {
+      double x = input[i] * window[i];
+      re += x * cos(2 * M_PI * k * i / SPECTRUM_SIZE);
+      im -= x * sin(2 * M_PI * k * i / SPECTRUM_SIZE);
+    }
+    TEST_ASSERT_FLOAT_WITHIN(peak * 1e-4, re * re + im * im, power[k]);
+  }
+}
+
+static void testDominantFrequencyFound() {
+  for (int b = 0; b < 8; b++) {
+    fillBlock(123.4f, 40, 5);
+    spectrumAddBlock(block);
+  }
+  SpectrumSummary s = spectrumTake();
+  TEST_ASSERT_EQUAL(8, s.blocks);
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 1000, s.sampleRateHz);
+  // Within a quarter bin (3.9 Hz bins)
+  TEST_ASSERT_FLOAT_WITHIN(1, 123.4, s.dominantHz);
+}
+
+static void testBandPowersSumToRippleVariance() {
+  for (int b = 0; b < 8; b++) {
+    fillBlock(93.75, 30, 0); // bin 24, mid band 1
+    spectrumAddBlock(block);
+  }
+  SpectrumSummary s = spectrumTake();
+  float total = 0;
+  for (uint8_t i = 0; i < SPECTRUM_BANDS; i++) total += s.bandPower[i];
+  TEST_ASSERT_FLOAT_WITHIN(450 * 0.05, 450, total); // 30^2 / 2
+  TEST_ASSERT_GREATER_THAN(0.99 * total, s.bandPower[1]);
+}
+
+static void testRateChangeRestartsAverage() {
+  fillBlock(100, 20, 0);
+  spectrumAddBlock(block);
+  block.periodCycles = PERIOD_1KHZ / 2;
+  spectrumAddBlock(block);
+  block.count = SAMPLE_BLOCK_SIZE / 2; // partial block from the change
+  spectrumAddBlock(block);
+  SpectrumSummary s = spectrumTake();
+  TEST_ASSERT_EQUAL(1, s.blocks);
+  TEST_ASSERT_FLOAT_WITHIN(0.1, 2000, s.sampleRateHz);
+}
+
+static void testEmptyTakeReportsNoData() {
+  SpectrumSummary s = spectrumTake();
+  TEST_ASSERT_EQUAL(0, s.blocks);
+  TEST_ASSERT_EQUAL(0, s.dominantHz);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testScalarFftMatchesReferenceDft);
+  RUN_TEST(testDominantFrequencyFound);
+  RUN_TEST(testBandPowersSumToRippleVariance);
+  RUN_TEST(testRateChangeRestartsAverage);
+  RUN_TEST(testEmptyTakeReportsNoData);
+  return UNITY_END();
+}
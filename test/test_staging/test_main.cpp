@@ -0,0 +1,197 @@
+#include <unity.h>
+#include <SD.h>
+#include "staging.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+static bool gated = false;
+static int restarts = 0;
+
+bool sdWrite(const char* path, const void* data, size_t length, bool) {
+  if (SD.failed) return false;
+  SD.mkdir(FS::parentOf(FS::normalise(path)).c_str());
+  File f = SD.open(path, FILE_WRITE);
+  return f && f.write((const uint8_t*)data, length) == length;
+}
+
+bool sdPowerGated() { return gated; }
+
+bool sdPowerRestart() {
+  restarts++;
+  return !SD.failed;
+}
+
+static std::string sdText(const char* path) {
+  std::vector<uint8_t>* data = SD.contents(path);
+  return data ? std::string(data->begin(), data->end()) : std::string();
+}
+
+static void appendRecords(const char* path, int first, int count, std::string* expected) {
+  for (int i = first; i < first + count; i++) {
+    char line[64];
+    snprintf(line, sizeof(line), "2025-06-01T00:00:00.000Z,12000,%d,1\n", i);
+    TEST_ASSERT_TRUE(stagingAppend(path, line));
+    if (expected) *expected += line;
+  }
+}
+
+static void runSeconds(int seconds) {
+  for (int i = 0; i < seconds; i++) {
+    setTime(now() + 1);
+    stagingMigrate();
+  }
+}
+
+// A reset: module state is lost, the flash contents are not
+static void reboot() {
+  journal.close();
+  flashReady = false;
+  stagedBytes = 0;
+  migrating = false;
+  unflushed = false;
+  batchUsed = 0;
+  sdHealthy = true;
+  stagingBegin();
+}
+
+void setUp() {
+  setTime(1748736000);
+  SD.reset();
+  flash.reset();
+  flash.capacity = STAGING_FLASH_BYTES;
+  gated = false;
+  restarts = 0;
+  stagingSetBatch(STAGING_BATCH_BYTES, STAGING_MAX_AGE);
+  reboot();
+}
+
+void tearDown() {}
+
+static void testRecordsWaitForABatchThenMigrate() {
+  std::string expected;
+  appendRecords("/a.csv", 0, 10, &expected);
+  runSeconds(5);
+  TEST_ASSERT_EQUAL_STRING("", sdText("/a.csv").c_str());
+  runSeconds(STAGING_MAX_AGE);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), sdText("/a.csv").c_str());
+  TEST_ASSERT_FALSE(flash.exists(JOURNAL) && flash.contents(JOURNAL)->size());
+}
+
+static void testOutageKeepsRecordsAndRecoveryDrainsThemOnce() {
+  std::string expectedA, expectedB;
+  SD.failed = true;
+  // A 20 minute outage spanning a change of log file, well over a batch
+  for (int minute = 0; minute < 20; minute++) {
+    appendRecords(minute < 10 ? "/a.csv" : "/b.csv", minute * 120, 120, minute < 10 ? &expectedA : &expectedB);
+    runSeconds(60);
+  }
+  TEST_ASSERT_FALSE(stagingSdHealthy());
+  // Retried once a minute, not every second
+  TEST_ASSERT_INT_WITHIN(2, 20, restarts);
+  TEST_ASSERT_GREATER_THAN(2 * STAGING_MIGRATE_BYTES, stagedBytes);
+
+  SD.failed = false;
+  // Once the retry finds the card, drained a bounded chunk per call until done
+  int calls = 0;
+  for (uint32_t s = 0; stagedBytes && s < STAGING_SD_RETRY + 100; s++) {
+    size_t before = SD.usedSize();
+    runSeconds(1);
+    TEST_ASSERT_LESS_OR_EQUAL(STAGING_MIGRATE_BYTES + 256, SD.usedSize() - before);
+    if (SD.usedSize() != before) calls++;
+  }
+  TEST_ASSERT_TRUE(stagingSdHealthy());
+  TEST_ASSERT_EQUAL(0, stagedBytes);
+  TEST_ASSERT_GREATER_THAN(1, calls);
+  TEST_ASSERT_EQUAL_STRING(expectedA.c_str(), sdText("/a.csv").c_str());
+  TEST_ASSERT_EQUAL_STRING(expectedB.c_str(), sdText("/b.csv").c_str());
+}
+
+static void testResetMidMigrationResumesFromCheckpoint() {
+  std::string expected;
+  SD.failed = true;
+  appendRecords("/a.csv", 0, 2000, &expected);
+  runSeconds(STAGING_MAX_AGE + 1);
+  SD.failed = false;
+  runSeconds(STAGING_SD_RETRY);
+  TEST_ASSERT_TRUE(migrating);
+  reboot();
+  stagingMigrate(true);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), sdText("/a.csv").c_str());
+}
+
+// A reset between removing the journal and its checkpoint, as the removes
+// were once ordered: the checkpoint must not skip into the next journal
+static void testStaleCheckpointIsDropped() {
+  std::string expectedA, expectedB;
+  SD.failed = true;
+  appendRecords("/a.csv", 0, 2000, &expectedA);
+  runSeconds(STAGING_MAX_AGE + 1);
+  SD.failed = false;
+  runSeconds(STAGING_SD_RETRY);
+  TEST_ASSERT_TRUE(migrating);
+  std::vector<uint8_t> checkpoint = *flash.contents(POSITION);
+  stagingMigrate(true);
+  TEST_ASSERT_FALSE(flash.exists(JOURNAL) && flash.contents(JOURNAL)->size());
+  File pos = flash.open(POSITION, FILE_WRITE);
+  pos.write(checkpoint.data(), checkpoint.size());
+  pos.close();
+
+  reboot();
+  TEST_ASSERT_FALSE(flash.exists(POSITION));
+  appendRecords("/b.csv", 0, 200, &expectedB);
+  stagingMigrate(true);
+  TEST_ASSERT_EQUAL_STRING(expectedA.c_str(), sdText("/a.csv").c_str());
+  TEST_ASSERT_EQUAL_STRING(expectedB.c_str(), sdText("/b.csv").c_str());
+}
+
+// A checkpoint at the end of its journal: copied in full, nothing to redo
+static void testCheckpointAtJournalEndClearsIt() {
+  SD.failed = true;
+  appendRecords("/a.csv", 0, 100, nullptr);
+  runSeconds(STAGING_FLUSH_INTERVAL);
+  File pos = flash.open(POSITION, FILE_WRITE);
+  pos.printf("%lu /a.csv\n", (unsigned long)flash.contents(JOURNAL)->size());
+  pos.close();
+  SD.failed = false;
+
+  reboot();
+  TEST_ASSERT_EQUAL(0, stagedBytes);
+  TEST_ASSERT_FALSE(flash.exists(POSITION));
+  std::string expected;
+  appendRecords("/a.csv", 100, 10, &expected);
+  stagingMigrate(true);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), sdText("/a.csv").c_str());
+}
+
+static void testFullJournalEmptiesIntoSd() {
+  flash.capacity = 8192;
+  std::string expected;
+  appendRecords("/a.csv", 0, 500, &expected);
+  stagingMigrate(true);
+  TEST_ASSERT_GREATER_THAN(0, journalFull);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), sdText("/a.csv").c_str());
+}
+
+static void testWithoutFlashGatedCardBatchesInRam() {
+  flash.failed = true;
+  reboot();
+  TEST_ASSERT_NULL(stagingFlash());
+  gated = true;
+  std::string expected;
+  appendRecords("/a.csv", 0, 20, &expected);
+  TEST_ASSERT_EQUAL_STRING("", sdText("/a.csv").c_str());
+  runSeconds(SD_POWER_BATCH_AGE);
+  TEST_ASSERT_EQUAL_STRING(expected.c_str(), sdText("/a.csv").c_str());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testRecordsWaitForABatchThenMigrate);
+  RUN_TEST(testOutageKeepsRecordsAndRecoveryDrainsThemOnce);
+  RUN_TEST(testResetMidMigrationResumesFromCheckpoint);
+  RUN_TEST(testStaleCheckpointIsDropped);
+  RUN_TEST(testCheckpointAtJournalEndClearsIt);
+  RUN_TEST(testFullJournalEmptiesIntoSd);
+  RUN_TEST(testWithoutFlashGatedCardBatchesInRam);
+  return UNITY_END();
+}
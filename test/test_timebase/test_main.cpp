@@ -0,0 +1,119 @@
+#include <unity.h>
+#include "timebase.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+// Virtual oscillators: true time drives an RTC counting whole seconds and a
+// CPU cycle counter running skewPpm fast
+const unsigned long RTC_START = 1700000000;
+const double RTC_TICK = 1.0 / 32768;
+static double trueSeconds;
+static double skewPpm;
+
+static void advanceTo(double t) {
+  trueSeconds = t;
+  double cpuSeconds = t * (1 + skewPpm * 1e-6);
+  hostCycles = (uint32_t)(uint64_t)(cpuSeconds * F_CPU_ACTUAL);
+  hostMicros = (uint64_t)(cpuSeconds * 1e6);
+}
+
+static uint32_t cyclesAt(double t) {
+  return (uint32_t)(uint64_t)(t * (1 + skewPpm * 1e-6) * F_CPU_ACTUAL);
+}
+
+// timebaseBegin() spins on the RTC, so each poll lets 1 us pass
+static unsigned long pollRtc() {
+  advanceTo(trueSeconds + 1e-6);
+  return RTC_START + (unsigned long)trueSeconds;
+}
+
+// The event tick sees each edge up to 10 ms late and back-dates it to within
+// one 32 kHz RTC tick
+static void runSeconds(int seconds) {
+  for (int i = 0; i < seconds; i++) {
+    double edge = floor(trueSeconds) + 1;
+    double latched = edge + (rand() % 32) * RTC_TICK / 32;
+    advanceTo(edge + (rand() % 10) * 1e-3);
+    timebaseEdge(RTC_START + (time_t)edge, cyclesAt(latched));
+  }
+}
+
+static void startClocks(double ppm) {
+  skewPpm = ppm;
+  advanceTo(0.25);
+  Teensy3Clock.source = pollRtc;
+  timebaseBegin();
+}
+
+void setUp() {
+  srand(1);
+}
+
+void tearDown() {}
+
+static void testMillisConversionRoundTrips() {
+  Timestamp ts = timestampFromMillis(1700000000123LL);
+  TEST_ASSERT_EQUAL(1700000000, ts.seconds);
+  TEST_ASSERT_EQUAL(123, ts.millis);
+  TEST_ASSERT_EQUAL_INT64(1700000000123LL, timestampMillis(ts));
+}
+
+static void testDriftEstimateConvergesOnSkew() {
+  startClocks(47);
+  runSeconds(120);
+  // One RTC tick of latch error over the baseline, plus float rounding
+  TEST_ASSERT_FLOAT_WITHIN(RTC_TICK / 120 * 1e6 + 0.2, 47, timebaseDriftPpm());
+  TEST_ASSERT_GREATER_OR_EQUAL(100, timebaseBaselineSeconds());
+}
+
+static void testInterpolatedMillisStayWithinOne() {
+  startClocks(-120);
+  runSeconds(30);
+  for (int i = 0; i < 200; i++) {
+    runSeconds(1);
+    double t = trueSeconds + (rand() % 980) / 1000.0 + 0.0005;
+    advanceTo(t);
+    Timestamp ts = timebaseNow();
+    int64_t expected = (int64_t)floor(t * 1000) + (int64_t)RTC_START * 1000;
+    TEST_ASSERT_INT_WITHIN(1, expected, timestampMillis(ts));
+  }
+}
+
+static void testMillisHoldAtEndOfSecond() {
+  startClocks(200);
+  runSeconds(15);
+  // Past the second but before the edge is latched
+  advanceTo(floor(trueSeconds) + 1.004);
+  Timestamp ts = timebaseNow();
+  TEST_ASSERT_EQUAL(RTC_START + (unsigned long)trueSeconds - 1, ts.seconds);
+  TEST_ASSERT_EQUAL(999, ts.millis);
+}
+
+static void testStaleLatchFallsBackToRtc() {
+  startClocks(0);
+  runSeconds(5);
+  advanceTo(trueSeconds + 6);
+  Timestamp ts = timebaseNow();
+  TEST_ASSERT_EQUAL(0, ts.millis);
+  TEST_ASSERT_UINT32_WITHIN(1, RTC_START + (unsigned long)trueSeconds, ts.seconds);
+}
+
+static void testSteppedRtcRestartsBaseline() {
+  startClocks(30);
+  runSeconds(20);
+  TEST_ASSERT_GREATER_THAN(0, timebaseBaselineSeconds());
+  // An RTC edge 50 s early looks like a step
+  timebaseEdge(RTC_START + (time_t)trueSeconds - 50, hostCycles);
+  TEST_ASSERT_EQUAL(0, timebaseBaselineSeconds());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testMillisConversionRoundTrips);
+  RUN_TEST(testDriftEstimateConvergesOnSkew);
+  RUN_TEST(testInterpolatedMillisStayWithinOne);
+  RUN_TEST(testMillisHoldAtEndOfSecond);
+  RUN_TEST(testStaleLatchFallsBackToRtc);
+  RUN_TEST(testSteppedRtcRestartsBaseline);
+  return UNITY_END();
+}
@@ -0,0 +1,315 @@
+#include <unity.h>
+#include <SD.h>
+#include <random>
+#include <vector>
+#include "tslog.cpp"
+#include "crc.cpp"
+
+bool registerCommand(const char*, CommandHandler, const char*) { return true; }
+
+char filename[48];
+static bool gated = false, awake = true, shedBusy = false;
+
+bool sdPowerGated() { return gated; }
+bool sdPowerAwake() { return awake; }
+bool loadShedBusy() { return shedBusy; }
+
+bool sdWrite(const char* path, const void* data, size_t length, bool) {
+  SD.mkdir(FS::parentOf(FS::normalise(path)).c_str());
+  File file = SD.open(path, FILE_WRITE);
+  return file && file.write((const uint8_t*)data, length) == length;
+}
+
+// Decoder for the block format in tslog.h, as tools/tslog_decode.py reads it
+struct Reader {
+  const uint8_t* data;
+  size_t pos;
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+      uint8_t b = data[pos++];
+      value |= (uint64_t)(b & 0x7F) << shift;
+      if (b < 0x80) return value;
+    }
+  }
+  int64_t zz() {
+    uint64_t v = varint();
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  }
+};
+
+// Appends the block's records; false if it does not decode
+static bool decodeBlock(const uint8_t* data, size_t size, size_t& pos, std::vector<TsRecord>& records) {
+  if (size - pos < 9 || data[pos] != 'G' || data[pos + 1] != 'T' || data[pos + 2] != TSLOG_VERSION) return false;
+  uint16_t count = data[pos + 3] | data[pos + 4] << 8;
+  uint16_t streamLength = data[pos + 5] | data[pos + 6] << 8;
+  Reader r = {data, pos + 7};
+  size_t first = records.size();
+  int64_t delta = 0;
+  for (uint16_t i = 0; i < count; i++) {
+    TsRecord record = {};
+    if (i == 0) {
+      record.millis = r.varint();
+      record.voltage = r.zz();
+      record.current = r.zz();
+    } else {
+      const TsRecord& last = records.back();
+      delta += r.zz();
+      record.millis = last.millis + delta;
+      record.voltage = last.voltage + r.zz();
+      record.current = last.current + r.zz();
+    }
+    record.currentMin = record.current - r.zz();
+    record.currentMax = record.current + r.zz();
+    int64_t ripple = r.zz() + (i ? lroundf(records.back().rippleHz * 10) : 0);
+    record.rippleHz = ripple / 10.0f;
+    records.push_back(record);
+  }
+  if (r.pos != pos + 7 + streamLength) return false;
+  for (size_t i = first; i < records.size();) {
+    int32_t valve = r.zz();
+    uint64_t run = r.varint();
+    for (size_t j = 0; j < run && i < records.size(); j++) records[i++].valve = valve;
+  }
+  uint16_t crc = data[r.pos] | data[r.pos + 1] << 8;
+  if (crc != crc16(data + pos, r.pos - pos)) return false;
+  pos = r.pos + 2;
+  return true;
+}
+
+static std::vector<TsRecord> decodeFile(const std::vector<uint8_t>& data, int* bad = nullptr) {
+  std::vector<TsRecord> records;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    std::vector<TsRecord> block;
+    if (decodeBlock(data.data(), data.size(), pos, block)) {
+      records.insert(records.end(), block.begin(), block.end());
+      continue;
+    }
+    if (bad) (*bad)++;
+    // Resynchronise on the next block magic
+    size_t next = pos + 1;
+    while (next + 1 < data.size() && !(data[next] == 'G' && data[next + 1] == 'T')) next++;
+    pos = next + 1 < data.size() ? next : data.size();
+  }
+  return records;
+}
+
+static void assertSameRecord(const TsRecord& expected, const TsRecord& actual) {
+  TEST_ASSERT_TRUE(expected.millis == actual.millis);
+  TEST_ASSERT_EQUAL(expected.voltage, actual.voltage);
+  TEST_ASSERT_EQUAL(expected.current, actual.current);
+  TEST_ASSERT_EQUAL(expected.currentMin, actual.currentMin);
+  TEST_ASSERT_EQUAL(expected.currentMax, actual.currentMax);
+  TEST_ASSERT_EQUAL(expected.valve, actual.valve);
+  TEST_ASSERT_EQUAL(lroundf(expected.rippleHz * 10), lroundf(actual.rippleHz * 10));
+}
+
+// A day of 10 s power records as the logger sees them: a slowly sagging
+// supply, a few valve moves, ripple in 0.1 Hz steps
+static std::vector<TsRecord> fieldDay(uint32_t seed, int count = 8640) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0, 3);
+  std::vector<TsRecord> records;
+  int64_t t = 1748736000000LL;
+  double voltage = 12400;
+  int32_t valve = 1000;
+  for (int i = 0; i < count; i++) {
+    t += 10000 + (rng() % 5 == 0 ? (int)(rng() % 3) - 1 : 0);
+    voltage -= 0.02;
+    if (rng() % 720 == 0) valve = valve == 1000 ? 2000 : 1000;
+    int32_t current = 180 + (valve == 2000 ? 40 : 0) + lround(noise(rng));
+    TsRecord record = {};
+    record.millis = t;
+    record.voltage = lround(voltage + noise(rng));
+    record.current = current;
+    record.currentMin = current - 2 - rng() % 4;
+    record.currentMax = current + 2 + rng() % 4;
+    record.valve = valve;
+    record.rippleHz = (1200 + (int)(rng() % 5) - 2) / 10.0f;
+    records.push_back(record);
+  }
+  return records;
+}
+
+void setUp() {
+  SD.reset();
+  strlcpy(filename, "/2025/06/gems_pump_2025-06-01.csv", sizeof(filename));
+  gated = shedBusy = false;
+  awake = true;
+  tsEncoderReset(encoder);
+  blockPath[0] = 0;
+  pendingCount = 0;
+  records = blocks = bytesWritten = writeFailures = 0;
+}
+
+void tearDown() {}
+
+static void testVarintAndZigzagEdges() {
+  TEST_ASSERT_TRUE(zigzag(0) == 0);
+  TEST_ASSERT_TRUE(zigzag(-1) == 1);
+  TEST_ASSERT_TRUE(zigzag(1) == 2);
+  TEST_ASSERT_TRUE(zigzag(INT64_MAX) == UINT64_MAX - 1);
+  TEST_ASSERT_TRUE(zigzag(INT64_MIN) == UINT64_MAX);
+  const uint64_t values[] = {0, 0x7F, 0x80, 0x3FFF, 0x4000, UINT32_MAX, UINT64_MAX};
+  const size_t lengths[] = {1, 1, 2, 2, 3, 5, 10};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    uint8_t buffer[10];
+    size_t pos = 0;
+    putVarint(buffer, pos, values[i]);
+    TEST_ASSERT_EQUAL(lengths[i], pos);
+    Reader r = {buffer, 0};
+    TEST_ASSERT_TRUE(r.varint() == values[i]);
+  }
+}
+
+static void testBlockRoundTripsExtremes() {
+  std::vector<TsRecord> input;
+  const int32_t extremes[] = {0, INT32_MAX, INT32_MIN, -1, 1, INT32_MIN, INT32_MAX};
+  const size_t count = sizeof(extremes) / sizeof(extremes[0]);
+  int64_t t = 0;
+  for (size_t i = 0; i < count; i++) {
+    t += i * i * 1000003LL;
+    TsRecord record = {};
+    record.millis = t;
+    record.voltage = extremes[i];
+    record.current = extremes[count - 1 - i];
+    record.currentMin = INT32_MIN;
+    record.currentMax = INT32_MAX;
+    record.valve = extremes[i];
+    record.rippleHz = i % 2 ? 0.0f : 250.0f;
+    input.push_back(record);
+  }
+  tsEncoderReset(encoder);
+  for (const TsRecord& record : input) TEST_ASSERT_TRUE(tsEncoderAdd(encoder, record));
+  size_t length = tsEncoderFinish(encoder);
+  std::vector<uint8_t> data(encoder.block, encoder.block + length);
+  std::vector<TsRecord> output = decodeFile(data);
+  TEST_ASSERT_EQUAL(input.size(), output.size());
+  for (size_t i = 0; i < input.size(); i++) assertSameRecord(input[i], output[i]);
+}
+
+static void testFullBlocksStayWithinTheBlockSize() {
+  std::vector<TsRecord> input = fieldDay(1);
+  tsEncoderReset(encoder);
+  std::vector<uint8_t> data;
+  size_t largest = 0;
+  for (const TsRecord& record : input) {
+    if (tsEncoderAdd(encoder, record)) continue;
+    size_t length = tsEncoderFinish(encoder);
+    largest = max(largest, length);
+    data.insert(data.end(), encoder.block, encoder.block + length);
+    tsEncoderReset(encoder);
+    TEST_ASSERT_TRUE(tsEncoderAdd(encoder, record));
+  }
+  size_t length = tsEncoderFinish(encoder);
+  data.insert(data.end(), encoder.block, encoder.block + length);
+  TEST_ASSERT_LESS_OR_EQUAL(TSLOG_BLOCK_SIZE, largest);
+  // Nearly full when closed: the reserve is for the worst case record
+  TEST_ASSERT_GREATER_THAN(TSLOG_BLOCK_SIZE - MAX_RECORD_SIZE - 2 * MAX_RUN_SIZE - 2 - 20, largest);
+  std::vector<TsRecord> output = decodeFile(data);
+  TEST_ASSERT_EQUAL(input.size(), output.size());
+  for (size_t i = 0; i < input.size(); i++) assertSameRecord(input[i], output[i]);
+}
+
+static void testValveChurnEndsTheBlockBeforeTheRunsOverflow() {
+  tsEncoderReset(encoder);
+  std::vector<TsRecord> input;
+  for (int i = 0;; i++) {
+    TsRecord record = {};
+    record.millis = 1000 * i;
+    record.valve = i % 2 ? 1000 : 2000;
+    if (!tsEncoderAdd(encoder, record)) break;
+    input.push_back(record);
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(encoder.runs), encoder.runsLength);
+  }
+  size_t length = tsEncoderFinish(encoder);
+  std::vector<uint8_t> data(encoder.block, encoder.block + length);
+  std::vector<TsRecord> output = decodeFile(data);
+  TEST_ASSERT_EQUAL(input.size(), output.size());
+  for (size_t i = 0; i < input.size(); i++) TEST_ASSERT_EQUAL(input[i].valve, output[i].valve);
+}
+
+static void testCorruptBlockIsSkipped() {
+  std::vector<TsRecord> input = fieldDay(2, 400);
+  for (const TsRecord& record : input) tsLogAppend(record);
+  tsLogFlush();
+  std::vector<uint8_t>* data = SD.contents("/2025/06/gems_pump_2025-06-01.gts");
+  TEST_ASSERT_NOT_NULL(data);
+  TEST_ASSERT_GREATER_THAN(2, blocks);
+  std::vector<uint8_t> damaged = *data;
+  damaged[20] ^= 0x04;
+  int bad = 0;
+  std::vector<TsRecord> output = decodeFile(damaged, &bad);
+  TEST_ASSERT_EQUAL(1, bad);
+  TEST_ASSERT_LESS_THAN(input.size(), output.size());
+  TEST_ASSERT_GREATER_THAN(input.size() / 2, output.size());
+  assertSameRecord(input.back(), output.back());
+}
+
+static void testFieldDayIsSeveralTimesSmallerThanCsv() {
+  std::vector<TsRecord> input = fieldDay(3);
+  size_t csv = 0;
+  for (const TsRecord& r : input) {
+    char line[128];
+    csv += snprintf(line, sizeof(line), "2025-06-01T00:00:00.000Z,%ld,%ld,%ld,%.1f,%ld,%ld\r\n", (long)r.voltage,
+                    (long)r.current, (long)r.valve, r.rippleHz, (long)r.currentMin, (long)r.currentMax);
+  }
+  for (const TsRecord& record : input) tsLogAppend(record);
+  tsLogFlush();
+  TEST_ASSERT_EQUAL(input.size(), records);
+  TEST_ASSERT_EQUAL(0, writeFailures);
+  // About 6 bytes a record against 55 of CSV
+  TEST_ASSERT_LESS_THAN(csv / 6, bytesWritten);
+  std::vector<TsRecord> output = decodeFile(*SD.contents("/2025/06/gems_pump_2025-06-01.gts"));
+  TEST_ASSERT_EQUAL(input.size(), output.size());
+}
+
+static void testDayRolloverClosesTheBlock() {
+  std::vector<TsRecord> input = fieldDay(4, 20);
+  for (int i = 0; i < 10; i++) tsLogAppend(input[i]);
+  strlcpy(filename, "/2025/06/gems_pump_2025-06-02.csv", sizeof(filename));
+  for (int i = 10; i < 20; i++) tsLogAppend(input[i]);
+  tsLogFlush();
+  TEST_ASSERT_EQUAL(10, decodeFile(*SD.contents("/2025/06/gems_pump_2025-06-01.gts")).size());
+  std::vector<TsRecord> second = decodeFile(*SD.contents("/2025/06/gems_pump_2025-06-02.gts"));
+  TEST_ASSERT_EQUAL(10, second.size());
+  assertSameRecord(input[10], second[0]);
+}
+
+static void testBlocksWaitWhileTheCardSleepsOrAMoveRuns() {
+  std::vector<TsRecord> input = fieldDay(5, 10);
+  gated = true;
+  awake = false;
+  for (int i = 0; i < 5; i++) tsLogAppend(input[i]);
+  tsLogFlush();
+  TEST_ASSERT_EQUAL(1, pendingCount);
+  tsLogPoll();
+  TEST_ASSERT_EQUAL(1, pendingCount);
+  awake = true;
+  shedBusy = true;
+  tsLogPoll();
+  TEST_ASSERT_EQUAL(1, pendingCount);
+  for (int i = 5; i < 10; i++) tsLogAppend(input[i]);
+  tsLogFlush();
+  TEST_ASSERT_EQUAL(2, pendingCount);
+  shedBusy = false;
+  tsLogPoll();
+  TEST_ASSERT_EQUAL(0, pendingCount);
+  std::vector<TsRecord> output = decodeFile(*SD.contents("/2025/06/gems_pump_2025-06-01.gts"));
+  TEST_ASSERT_EQUAL(10, output.size());
+  for (int i = 0; i < 10; i++) assertSameRecord(input[i], output[i]);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(testVarintAndZigzagEdges);
+  RUN_TEST(testBlockRoundTripsExtremes);
+  RUN_TEST(testFullBlocksStayWithinTheBlockSize);
+  RUN_TEST(testValveChurnEndsTheBlockBeforeTheRunsOverflow);
+  RUN_TEST(testCorruptBlockIsSkipped);
+  RUN_TEST(testFieldDayIsSeveralTimesSmallerThanCsv);
+  RUN_TEST(testDayRolloverClosesTheBlock);
+  RUN_TEST(testBlocksWaitWhileTheCardSleepsOrAMoveRuns);
+  return UNITY_END();
+}
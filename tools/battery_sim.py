@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""
+Simulate a GEMS pump deployment on battery, with and without power tiers.
+
+Discharges a battery model (the resting voltage table and internal
+resistance from src/battery.h, with an adjustable true capacity) under a
+load model of the firmware, once at the fixed configured rates and once
+with the state-of-charge estimator and tiers of src/battery.cpp choosing
+the rates. Prints the runtime of each, how many power records were logged
+and when each tier was entered.
+
+    python3 tools/battery_sim.py
+    python3 tools/battery_sim.py --capacity-mah 17000 --assumed-mah 20000 --base-ma 70
+
+The load figures are defaults; measure the real ones with "$energy".
+A deployment ends when the charge is gone or the loaded bus voltage falls
+below threshold_voltage.
+"""
+
+import argparse
+import random
+
+# Must match src/battery.h and src/battery.cpp
+TIERS = [  # name, below percent, log multiplier, rate divisor, leds
+    ("normal", 101, 1, 1, True),
+    ("save", 50, 2, 2, True),
+    ("low", 25, 4, 4, False),
+    ("critical", 10, 8, 10, False),
+]
+RESTING = [(11310, 0), (11510, 10), (11660, 20), (11810, 30), (11960, 40), (12100, 50),
+           (12240, 60), (12370, 70), (12500, 80), (12620, 90), (12730, 100)]
+RESISTANCE_MOHM = 40
+VOLTAGE_TRUST_SECONDS = 3600
+AVERAGE_SECONDS = 600
+HYSTERESIS = 5
+
+
+def soc_from_voltage(ocv):
+    if ocv <= RESTING[0][0]:
+        return 0.0
+    for (lo_mv, lo_p), (hi_mv, hi_p) in zip(RESTING, RESTING[1:]):
+        if ocv < hi_mv:
+            return lo_p + (ocv - lo_mv) * (hi_p - lo_p) / (hi_mv - lo_mv)
+    return 100.0
+
+
+def voltage_from_soc(soc):
+    for (lo_mv, lo_p), (hi_mv, hi_p) in zip(RESTING, RESTING[1:]):
+        if soc <= hi_p:
+            return lo_mv + (soc - lo_p) * (hi_mv - lo_mv) / (hi_p - lo_p)
+    return RESTING[-1][0]
+
+
+class Estimator:
+    """src/battery.cpp batteryUpdate()"""
+
+    def __init__(self, assumed_mah, mv, ma):
+        self.assumed_mah = assumed_mah
+        self.average_ma = ma
+        self.soc = soc_from_voltage(mv + ma * RESISTANCE_MOHM / 1000.0)
+        self.tier = 0
+
+    def update(self, seconds, drawn_mas, mv):
+        ma = drawn_mas / seconds
+        self.average_ma += (ma - self.average_ma) * min(seconds / AVERAGE_SECONDS, 1.0)
+        self.soc -= drawn_mas / 3600.0 / self.assumed_mah * 100
+        estimate = soc_from_voltage(mv + ma * RESISTANCE_MOHM / 1000.0)
+        self.soc += (estimate - self.soc) * min(seconds / VOLTAGE_TRUST_SECONDS, 1.0)
+        self.soc = max(0.0, min(100.0, self.soc))
+        target = self.tier
+        while target + 1 < len(TIERS) and self.soc < TIERS[target + 1][1]:
+            target += 1
+        while target > 0 and self.soc >= TIERS[target][1] + HYSTERESIS:
+            target -= 1
+        changed = target != self.tier
+        self.tier = target
+        return changed
+
+
+def load_ma(args, rate_hz, log_interval, leds):
+    """Average current at the given settings"""
+    ma = args.base_ma + args.hold_ma + args.ma_per_khz * rate_hz / 1000.0
+    ma += args.log_mas / log_interval + args.servo_mas / args.valve_interval
+    if leds:
+        ma += args.led_ma
+    return ma
+
+
+def run(args, tiered):
+    rng = random.Random(args.seed)
+    step = args.step
+    charge_mas = args.capacity_mah * args.start_percent / 100.0 * 3600
+    full_mas = args.capacity_mah * 3600.0
+    ma = load_ma(args, args.rate_hz, args.log_interval, True)
+    estimator = Estimator(args.assumed_mah, voltage_from_soc(args.start_percent) - ma * RESISTANCE_MOHM / 1000.0, ma)
+    seconds = 0
+    records = 0.0
+    tiers = []
+    while charge_mas > 0:
+        name, _, log_mult, rate_div, leds = TIERS[estimator.tier if tiered else 0]
+        rate = max(args.rate_hz // rate_div, 10)
+        interval = args.log_interval * log_mult
+        ma = load_ma(args, rate, interval, leds)
+        soc = 100.0 * charge_mas / full_mas
+        mv = voltage_from_soc(soc) - ma * RESISTANCE_MOHM / 1000.0 + rng.gauss(0, args.noise_mv)
+        if mv < args.threshold_mv:
+            break
+        charge_mas -= ma * step
+        records += step / interval
+        seconds += step
+        if tiered and estimator.update(step, ma * step, mv):
+            tiers.append((seconds / 3600.0, TIERS[estimator.tier][0], estimator.soc, soc))
+    return seconds / 3600.0, int(records), tiers
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--capacity-mah", type=float, default=20000, help="true battery capacity")
+    parser.add_argument("--assumed-mah", type=float, help="battery_mah setting (default: the true capacity)")
+    parser.add_argument("--start-percent", type=float, default=100)
+    parser.add_argument("--threshold-mv", type=float, default=10000, help="threshold_voltage")
+    parser.add_argument("--log-interval", type=int, default=10, help="log_interval, s")
+    parser.add_argument("--rate-hz", type=int, default=1000, help="sample_rate_hz")
+    parser.add_argument("--valve-interval", type=float, default=450, help="valve_change_interval, s")
+    parser.add_argument("--base-ma", type=float, default=95, help="CPU, INA260 and idle SD card")
+    parser.add_argument("--ma-per-khz", type=float, default=20, help="extra current per kHz of sampling")
+    parser.add_argument("--led-ma", type=float, default=3, help="average LED current while enabled")
+    parser.add_argument("--log-mas", type=float, default=4, help="charge per log record (SD write)")
+    parser.add_argument("--servo-mas", type=float, default=300, help="charge per valve move")
+    parser.add_argument("--hold-ma", type=float, default=8, help="servo holding current")
+    parser.add_argument("--noise-mv", type=float, default=20, help="bus voltage noise")
+    parser.add_argument("--step", type=int, default=10, help="simulation step, s")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    if args.assumed_mah is None:
+        args.assumed_mah = args.capacity_mah
+
+    fixed_hours, fixed_records, _ = run(args, False)
+    tiered_hours, tiered_records, tiers = run(args, True)
+    print("fixed:  %7.1f h, %d records" % (fixed_hours, fixed_records))
+    print("tiered: %7.1f h, %d records" % (tiered_hours, tiered_records))
+    print("gain:   %+7.1f h (%+.1f%%)" % (tiered_hours - fixed_hours, 100.0 * (tiered_hours / fixed_hours - 1)))
+    for hours, name, estimated, actual in tiers:
+        print("  %7.1f h  %-8s estimated %5.1f%%, actual %5.1f%%" % (hours, name, estimated, actual))
+
+
+if __name__ == "__main__":
+    main()
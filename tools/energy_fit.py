@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""
+Fit per-subsystem energy from a GEMS pump "$energy record" capture.
+
+Reads the "E,<mA>,<bits>" lines printed by "$energy record <n>" (other
+lines are ignored) and fits current = base + sum(cost_k * x_k) over the
+activity bits, the same model src/energy.cpp solves on the device, so the
+two can be compared. Also prints the mean current for each activity pattern.
+
+    python3 tools/energy_fit.py capture.txt
+    python3 tools/energy_fit.py --port /dev/ttyACM0 --samples 60000   # needs pyserial
+"""
+
+import argparse
+import sys
+
+# Must match EnergyActivity in src/energy.h
+NAMES = ["sd", "servo_move", "servo_hold", "leds", "i2c"]
+I2C = NAMES.index("i2c")
+I2C_BASE_TRANSACTIONS = 2
+MIN_SAMPLES = 100
+
+
+def parse(lines):
+    voltage = None
+    samples = []
+    for line in lines:
+        parts = line.strip().split(",")
+        if len(parts) != 3 or parts[0] != "E":
+            continue
+        if parts[1] == "voltage_mv":
+            voltage = float(parts[2])
+        else:
+            try:
+                samples.append((int(parts[1]), int(parts[2])))
+            except ValueError:
+                pass
+    return voltage, samples
+
+
+def regressor(pattern, k):
+    if k == 0:
+        return 1.0
+    bit = (pattern >> (k - 1)) & 1
+    return I2C_BASE_TRANSACTIONS + bit if k - 1 == I2C else float(bit)
+
+
+def solve(a, b):
+    n = len(b)
+    for col in range(n):
+        pivot = max(range(col, n), key=lambda r: abs(a[r][col]))
+        if abs(a[pivot][col]) < 1e-12:
+            return None
+        a[col], a[pivot] = a[pivot], a[col]
+        b[col], b[pivot] = b[pivot], b[col]
+        for row in range(n):
+            if row != col:
+                f = a[row][col] / a[col][col]
+                a[row] = [x - f * y for x, y in zip(a[row], a[col])]
+                b[row] -= f * b[col]
+    return [b[k] / a[k][k] for k in range(n)]
+
+
+def fit(samples):
+    counts, sums = {}, {}
+    for current, pattern in samples:
+        counts[pattern] = counts.get(pattern, 0) + 1
+        sums[pattern] = sums.get(pattern, 0) + current
+    total = len(samples)
+    on = [sum(c for p, c in counts.items() if p >> a & 1) for a in range(len(NAMES))]
+    state = ["fitted" if MIN_SAMPLES <= on[a] <= total - MIN_SAMPLES
+             else "not seen" if on[a] < MIN_SAMPLES else "always on, in base" for a in range(len(NAMES))]
+    terms = [0] + [a + 1 for a in range(len(NAMES)) if state[a] == "fitted"]
+
+    xtx = [[sum(regressor(p, i) * regressor(p, j) * c for p, c in counts.items()) for j in terms] for i in terms]
+    xty = [sum(regressor(p, i) * sums[p] for p in counts) for i in terms]
+    beta = solve(xtx, xty)
+    if beta is None:
+        sys.exit("singular fit; activities always change together")
+    cost = dict(zip(terms, beta))
+    duty = [on[a] / total + (I2C_BASE_TRANSACTIONS if a == I2C else 0) for a in range(len(NAMES))]
+    return counts, sums, cost, duty, state
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("file", nargs="?", help="capture file (default stdin)")
+    parser.add_argument("--port", help="serial port to record from")
+    parser.add_argument("--samples", type=int, default=60000, help="samples to record with --port")
+    parser.add_argument("--voltage", type=float, help="bus voltage in mV if the capture has none")
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        lines = []
+        with serial.Serial(args.port, 115200, timeout=5) as s:
+            s.write(b"$energy record %d\n" % args.samples)
+            for raw in s:
+                line = raw.decode("ascii", "replace")
+                if line.startswith("E,end"):
+                    break
+                lines.append(line)
+    elif args.file:
+        with open(args.file) as f:
+            lines = f.readlines()
+    else:
+        lines = sys.stdin.readlines()
+
+    voltage, samples = parse(lines)
+    voltage = args.voltage or voltage
+    if len(samples) < 1000:
+        sys.exit("not enough samples (%d)" % len(samples))
+    if voltage is None:
+        sys.exit("no bus voltage in the capture; pass --voltage")
+    counts, sums, cost, duty, state = fit(samples)
+
+    def joules(ma, x=1.0):
+        return ma / 1000.0 * voltage / 1000.0 * x * 86400.0
+
+    mean = sum(sums.values()) / len(samples)
+    print("samples=%d voltage=%.0fmV mean=%.1fmA measured=%.0fJ/day" % (len(samples), voltage, mean, joules(mean)))
+    total = joules(cost[0])
+    for a, name in enumerate(NAMES):
+        if state[a] != "fitted":
+            print("%-10s %s" % (name, state[a]))
+            continue
+        j = joules(cost[a + 1], duty[a])
+        total += j
+        print("%-10s cost=%.1fmA duty=%.4f %.1fJ/day" % (name, cost[a + 1], duty[a], j))
+    print("%-10s %.1fmA %.0fJ/day" % ("base", cost[0], joules(cost[0])))
+    print("%-10s %.0fJ/day" % ("modelled", total))
+
+    print("patterns:")
+    for p in sorted(counts):
+        active = "+".join(NAMES[a] for a in range(len(NAMES)) if p >> a & 1) or "idle"
+        print("  %-40s %8d samples %7.1fmA" % (active, counts[p], sums[p] / counts[p]))
+
+
+if __name__ == "__main__":
+    main()
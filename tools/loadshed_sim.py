@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Simulate valve moves on a soft supply, with and without load shedding.
+
+The bus is a source voltage behind a supply resistance, loaded by the
+controller's base current, a pump with periodic current peaks, SD flushes
+on the once-a-second work and the servo's inrush. Each trial requests a
+move at a random pump phase, sometimes with an SD flush due close by, and
+records the minimum bus voltage at 1 ms resolution. The controlled run
+uses the supply fit, budget and deferral rules of src/loadshed.cpp.
+
+    python3 tools/loadshed_sim.py
+    python3 tools/loadshed_sim.py --supply-ohm 2.0 --pump-peak-ma 900 --trials 2000
+"""
+
+import argparse
+import random
+
+# Must match src/loadshed.h and src/energy.h
+SERVO_PEAK_MA = 800
+MARGIN_MV = 300
+MAX_DELAY_MS = 2000
+DEFAULT_MOHM = 500
+MAX_MOHM = 5000
+FIT_TICKS = 1000
+MIN_CURRENT_VARIANCE = 400
+INRUSH_MS = 150
+HISTORY_TICKS = 256
+MIN_PERIOD_TICKS = 20
+PERIODIC_RATIO = 0.5
+MOVE_WINDOW_MS = 1000
+TICK_MS = 10
+INRUSH_TICKS = (INRUSH_MS + TICK_MS - 1) // TICK_MS
+
+
+class Controller:
+    """src/loadshed.cpp loadShedPoll() and loadShedBudget()"""
+
+    def __init__(self, threshold_mv):
+        self.threshold_mv = threshold_mv
+        self.started = False
+        self.mean_ma = self.mean_mv = self.covariance = self.variance = 0.0
+        self.resistance = DEFAULT_MOHM
+        self.source_mv = 0.0
+        self.history = []  # newest last
+        self.ticks = 0
+        self.period = 0
+
+    def find_period(self):
+        h = self.history[::-1]  # h[k] is k ticks ago
+        n = len(h)
+        best = best_lag = None
+        total = 0.0
+        for lag in range(MIN_PERIOD_TICKS, n // 2 + 1):
+            difference = sum(abs(h[k] - h[k + lag]) for k in range(n - lag)) / (n - lag)
+            total += difference
+            if best is None or difference < best:
+                best, best_lag = difference, lag
+        average = total / (n // 2 - MIN_PERIOD_TICKS + 1)
+        return best_lag if best < PERIODIC_RATIO * average else 0
+
+    def forecast(self, ma):
+        if not self.period:
+            return ma
+        return max([ma] + [self.history[-1 - (self.period - k)] for k in range(1, INRUSH_TICKS + 1)])
+
+    def poll(self, ma, mv):
+        self.history = (self.history + [int(ma)])[-HISTORY_TICKS:]
+        self.ticks += 1
+        if self.ticks >= HISTORY_TICKS and self.ticks % (1000 // TICK_MS) == 0:
+            self.period = self.find_period()
+        if not self.started:
+            self.mean_ma, self.mean_mv, self.started = ma, mv, True
+        a = 1.0 / FIT_TICKS
+        self.mean_ma += a * (ma - self.mean_ma)
+        self.mean_mv += a * (mv - self.mean_mv)
+        self.covariance += a * ((ma - self.mean_ma) * (mv - self.mean_mv) - self.covariance)
+        self.variance += a * ((ma - self.mean_ma) ** 2 - self.variance)
+        if self.variance >= MIN_CURRENT_VARIANCE:
+            self.resistance = max(1, min(MAX_MOHM, int(-self.covariance / self.variance * 1000)))
+        self.source_mv = self.mean_mv + self.mean_ma * self.resistance / 1000.0
+
+    def budget(self, ma):
+        return (self.source_mv - self.threshold_mv - MARGIN_MV) * 1000.0 / self.resistance - self.forecast(ma)
+
+
+def servo_ma(args, since_start):
+    if since_start < 0 or since_start >= args.servo_ms:
+        return 0.0
+    return args.servo_inrush_ma if since_start < args.inrush_ms else args.servo_run_ma
+
+
+def trial(args, rng, controlled):
+    phase = rng.uniform(0, args.pump_period_ms)
+    warmup = 30000
+    request = warmup + rng.randrange(0, 1000)
+    # SD flush on a once-a-second boundary near the request, some of the time
+    sd_due = None
+    if rng.random() < args.sd_probability:
+        sd_due = (request // 1000 + rng.choice([0, 1])) * 1000
+
+    def pump_ma(t):
+        return args.pump_peak_ma if (t + phase) % args.pump_period_ms < args.pump_peak_duration_ms else args.pump_base_ma
+
+    def load(t, move_start, sd_start):
+        ma = args.base_ma + pump_ma(t)
+        if move_start is not None:
+            ma += servo_ma(args, t - move_start)
+        if sd_start is not None and 0 <= t - sd_start < args.sd_ms:
+            ma += args.sd_ma
+        return ma
+
+    def bus(ma):
+        return args.source_mv - ma * args.supply_ohm + rng.gauss(0, args.noise_mv)
+
+    controller = Controller(args.threshold_mv)
+    move_start = None if controlled else request
+    sd_start = None if controlled else sd_due
+    pending = controlled
+    min_mv = float("inf")
+    for t in range(0, request + 4000):
+        # Warm-up only needs the controller's ticks
+        if t < request - 1000 and t % TICK_MS:
+            continue
+        ma = load(t, move_start, sd_start)
+        mv = bus(ma)
+        if t >= request - 1000:
+            min_mv = min(min_mv, mv)
+        if not controlled or t % TICK_MS:
+            continue
+        controller.poll(ma, mv)
+        if pending and t >= request:
+            if controller.budget(ma) >= SERVO_PEAK_MA or t - request >= MAX_DELAY_MS:
+                move_start, pending = t, False
+        # The once-a-second SD work waits while a move runs or waits
+        if sd_due is not None and sd_start is None and t >= sd_due and t % 1000 == 0:
+            busy = (t >= request and pending) or (move_start is not None and t - move_start < MOVE_WINDOW_MS)
+            if not busy:
+                sd_start = t
+    delay = (move_start - request) if move_start is not None else MAX_DELAY_MS
+    return min_mv, delay
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(p / 100.0 * len(values)))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--trials", type=int, default=500)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--source-mv", type=float, default=12200)
+    parser.add_argument("--supply-ohm", type=float, default=1.4, help="cable and source resistance")
+    parser.add_argument("--threshold-mv", type=float, default=10000, help="threshold_voltage")
+    parser.add_argument("--noise-mv", type=float, default=15)
+    parser.add_argument("--base-ma", type=float, default=120, help="controller and sensors")
+    parser.add_argument("--pump-base-ma", type=float, default=150)
+    parser.add_argument("--pump-peak-ma", type=float, default=700)
+    parser.add_argument("--pump-period-ms", type=float, default=1000)
+    parser.add_argument("--pump-peak-duration-ms", type=float, default=150)
+    parser.add_argument("--servo-inrush-ma", type=float, default=900)
+    parser.add_argument("--inrush-ms", type=int, default=120)
+    parser.add_argument("--servo-run-ma", type=float, default=250)
+    parser.add_argument("--servo-ms", type=int, default=800)
+    parser.add_argument("--sd-ma", type=float, default=120)
+    parser.add_argument("--sd-ms", type=int, default=60)
+    parser.add_argument("--sd-probability", type=float, default=0.5, help="share of moves with a flush due nearby")
+    args = parser.parse_args()
+
+    print("%-10s %9s %9s %9s %9s %10s %10s" % ("", "min mV", "p1 mV", "p50 mV", "<thresh", "mean delay", "max delay"))
+    for controlled in (False, True):
+        rng = random.Random(args.seed)
+        results = [trial(args, rng, controlled) for _ in range(args.trials)]
+        minima = [r[0] for r in results]
+        delays = [r[1] for r in results]
+        below = sum(1 for m in minima if m < args.threshold_mv)
+        print("%-10s %9.0f %9.0f %9.0f %8.1f%% %8.0fms %8.0fms" % (
+            "shedding" if controlled else "fixed", min(minima), percentile(minima, 1), percentile(minima, 50),
+            100.0 * below / len(minima), sum(delays) / len(delays), max(delays)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""
+Decode and pretty-print metrics frames from the GEMS pump controller.
+
+Reads raw bytes from a file (or stdin), e.g. a capture of the serial port
+after sending "$metrics", finds every frame and prints it.
+
+    python3 tools/metrics_decode.py capture.bin
+    python3 tools/metrics_decode.py --port /dev/ttyACM0   # needs pyserial
+"""
+
+import argparse
+import struct
+import sys
+
+# Must match the enums in src/metrics.h for each frame version
+NAMES = {
+    1: {
+        "counters": ["i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+                     "valve_moves", "log_records", "commands"],
+        "gauges": ["bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water"],
+        "histograms": ["loop_us", "sd_write_us"],
+    },
+    2: {
+        "counters": ["i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+                     "valve_moves", "log_records", "commands"],
+        "gauges": ["bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water"],
+        "histograms": ["loop_us", "sd_write_us", "cmd_queue_us", "cmd_actuate_us", "cmd_ack_us"],
+    },
+    3: {
+        "counters": ["i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+                     "valve_moves", "log_records", "commands", "scrub_failures"],
+        "gauges": ["bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water"],
+        "histograms": ["loop_us", "sd_write_us", "cmd_queue_us", "cmd_actuate_us", "cmd_ack_us",
+                       "scrub_read_us"],
+    },
+    4: {
+        "counters": ["i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+                     "valve_moves", "log_records", "commands", "scrub_failures"],
+        "gauges": ["bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water"],
+        "histograms": ["loop_us", "sd_write_us", "cmd_queue_us", "cmd_actuate_us", "cmd_ack_us",
+                       "scrub_read_us", "sd_wake_us"],
+    },
+    5: {
+        "counters": ["i2c_errors", "sd_open_failures", "low_power_homings", "skipped_moves",
+                     "valve_moves", "log_records", "commands", "scrub_failures", "event_drops"],
+        "gauges": ["bus_voltage_mv", "current_ma", "loop_max_us", "stack_high_water"],
+        "histograms": ["loop_us", "sd_write_us", "cmd_queue_us", "cmd_actuate_us", "cmd_ack_us",
+                       "scrub_read_us", "sd_wake_us"],
+    },
+}
+
+
+def crc16(data, crc=0xFFFF):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def frames(data):
+    i = 0
+    while True:
+        i = data.find(b"\xa5\x5aM", i)
+        if i < 0 or i + 6 > len(data):
+            return
+        version = data[i + 3]
+        (length,) = struct.unpack_from("<H", data, i + 4)
+        end = i + 6 + length + 2
+        if end > len(data):
+            return
+        (crc,) = struct.unpack_from("<H", data, end - 2)
+        if crc16(data[i + 2:end - 2]) == crc:
+            yield version, data[i + 6:end - 2]
+            i = end
+        else:
+            i += 1
+
+
+def bucket_label(n):
+    if n == 0:
+        return "0"
+    return "%d-%d" % (1 << (n - 1), (1 << n) - 1)
+
+
+def decode(version, payload):
+    names = NAMES.get(version)
+    uptime, nc, ng, nh, nb = struct.unpack_from("<IBBBB", payload, 0)
+    pos = 8
+    counters = struct.unpack_from("<%dI" % nc, payload, pos)
+    pos += 4 * nc
+    gauges = struct.unpack_from("<%di" % ng, payload, pos)
+    pos += 4 * ng
+    histograms = []
+    for _ in range(nh):
+        histograms.append(struct.unpack_from("<%dI" % nb, payload, pos))
+        pos += 4 * nb
+
+    def name(kind, i):
+        return names[kind][i] if names and i < len(names[kind]) else "%s[%d]" % (kind, i)
+
+    print("metrics v%d, uptime %.1f s" % (version, uptime / 1000.0))
+    for i, v in enumerate(counters):
+        print("  %-20s %10d" % (name("counters", i), v))
+    for i, v in enumerate(gauges):
+        print("  %-20s %10d" % (name("gauges", i), v))
+    for i, buckets in enumerate(histograms):
+        total = sum(buckets)
+        print("  %-20s %10d samples" % (name("histograms", i), total))
+        for b, count in enumerate(buckets):
+            if count:
+                print("    %-16s %10d  %5.1f%%" % (bucket_label(b), count, 100.0 * count / total))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("file", nargs="?", help="capture file (default stdin)")
+    parser.add_argument("--port", help="serial port to query with $metrics")
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        with serial.Serial(args.port, 115200, timeout=1) as s:
+            s.write(b"$metrics\n")
+            data = s.read(4096)
+    elif args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    found = False
+    for version, payload in frames(data):
+        decode(version, payload)
+        found = True
+    if not found:
+        sys.exit("no metrics frames found")
+
+
+if __name__ == "__main__":
+    main()
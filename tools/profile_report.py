@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""
+Turn a GEMS pump profiler dump into a per-function profile.
+
+Reads raw bytes from a file (or stdin), e.g. a capture of the serial port
+after sending "$prof dump", and maps every sampled PC to a function with
+the symbol table of the firmware ELF (via nm from the ARM toolchain).
+
+    python3 tools/profile_report.py --elf .pio/build/teensy41/firmware.elf capture.bin
+    python3 tools/profile_report.py --elf firmware.elf --port /dev/ttyACM0   # needs pyserial
+    python3 tools/profile_report.py --elf firmware.elf --lines capture.bin   # hottest lines too
+"""
+
+import argparse
+import bisect
+import shutil
+import struct
+import subprocess
+import sys
+
+from metrics_decode import crc16
+
+
+def frames(data):
+    i = 0
+    while True:
+        i = data.find(b"\xa5\x5aP", i)
+        if i < 0 or i + 6 > len(data):
+            return
+        version = data[i + 3]
+        (length,) = struct.unpack_from("<H", data, i + 4)
+        end = i + 6 + length + 2
+        if end <= len(data):
+            (crc,) = struct.unpack_from("<H", data, end - 2)
+            if crc == crc16(data[i + 2:end - 2]):
+                yield version, data[i + 6:end - 2]
+                i = end
+                continue
+        i += 1
+
+
+def find_tool(name, given):
+    if given:
+        return given
+    for candidate in ("arm-none-eabi-" + name, name):
+        if shutil.which(candidate):
+            return candidate
+    sys.exit("%s not found; pass --%s" % (name, name))
+
+
+def load_symbols(elf, nm):
+    """Sorted (start, end, name) for every sized code symbol."""
+    out = subprocess.run([nm, "-C", "-S", "-n", "--defined-only", elf], capture_output=True, text=True,
+                         check=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) < 4 or parts[2] not in "tTwW":
+            continue
+        start, size = int(parts[0], 16), int(parts[1], 16)
+        if size:
+            symbols.append((start, start + size, parts[3]))
+    symbols.sort()
+    return symbols
+
+
+def symbolize(symbols, starts, pc):
+    pc &= ~1
+    i = bisect.bisect_right(starts, pc) - 1
+    if i >= 0 and pc < symbols[i][1]:
+        return symbols[i][2]
+    return "?? 0x%08x" % pc
+
+
+def region(pc):
+    if pc < 0x00080000:
+        return "ITCM"
+    if 0x60000000 <= pc < 0x61000000:
+        return "FLASH"
+    return "other"
+
+
+def report(payload, symbols, addr2line, elf, top):
+    rate, duration, samples, dropped, overhead, count = struct.unpack_from("<IIIIIH", payload, 0)
+    pcs = [struct.unpack_from("<II", payload, 22 + 8 * i) for i in range(count)]
+    starts = [s[0] for s in symbols]
+
+    print("%d samples at %d Hz over %.1f s, %d dropped (table full), overhead %.3f%%"
+          % (samples, rate, duration / 1000.0, dropped, overhead / 10000.0))
+    functions = {}
+    regions = {}
+    for pc, n in pcs:
+        name = symbolize(symbols, starts, pc)
+        functions[name] = functions.get(name, 0) + n
+        regions[region(pc)] = regions.get(region(pc), 0) + n
+    total = sum(functions.values()) or 1
+    print("  %8s %7s  %s" % ("samples", "share", "function"))
+    for name, n in sorted(functions.items(), key=lambda kv: -kv[1])[:top]:
+        print("  %8d %6.2f%%  %s" % (n, 100.0 * n / total, name))
+    print("by region: " + ", ".join("%s %.1f%%" % (r, 100.0 * n / total) for r, n in sorted(regions.items())))
+
+    if addr2line:
+        hottest = sorted(pcs, key=lambda p: -p[1])[:top]
+        out = subprocess.run([addr2line, "-e", elf, "-C", "-f", "-p"] + ["0x%x" % (pc & ~1) for pc, _ in hottest],
+                             capture_output=True, text=True, check=True).stdout.splitlines()
+        print("hottest PCs:")
+        for (pc, n), where in zip(hottest, out):
+            print("  %8d %6.2f%%  0x%08x %s" % (n, 100.0 * n / total, pc, where))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("file", nargs="?", help="capture file (default stdin)")
+    parser.add_argument("--elf", required=True, help="firmware ELF the dump was taken from")
+    parser.add_argument("--port", help="serial port to query with $prof dump")
+    parser.add_argument("--nm", help="nm to use (default arm-none-eabi-nm)")
+    parser.add_argument("--addr2line", help="addr2line to use with --lines")
+    parser.add_argument("--lines", action="store_true", help="also resolve the hottest PCs to source lines")
+    parser.add_argument("--top", type=int, default=30, help="rows to print")
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        with serial.Serial(args.port, 115200, timeout=2) as s:
+            s.write(b"$prof dump\n")
+            data = s.read(8192)
+    elif args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    symbols = load_symbols(args.elf, find_tool("nm", args.nm))
+    addr2line = find_tool("addr2line", args.addr2line) if args.lines else None
+    found = False
+    for version, payload in frames(data):
+        if version != 1:
+            print("skipping profile frame version %d" % version, file=sys.stderr)
+            continue
+        report(payload, symbols, addr2line, args.elf, args.top)
+        found = True
+    if not found:
+        sys.exit("no profile frames found")
+
+
+if __name__ == "__main__":
+    main()
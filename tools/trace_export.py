@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+"""
+Convert a GEMS pump trace dump to Chrome trace JSON.
+
+Reads raw bytes from a file (or stdin), e.g. a capture of the serial port
+after sending "$trace dump", and writes JSON for chrome://tracing or
+https://ui.perfetto.dev. The loop, each ISR and the sampler's I2C traffic
+get their own rows.
+
+    python3 tools/trace_export.py capture.bin > trace.json
+    python3 tools/trace_export.py --port /dev/ttyACM0 -o trace.json   # needs pyserial
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+from metrics_decode import crc16
+
+# Must match TraceCode in src/trace.h for each frame version
+CODES = {
+    1: ["loop", "task", "wait", "event", "command", "sd_write", "valve", "schedule",
+        "isr_events", "isr_sampler", "isr_alert", "i2c"],
+}
+# LoopTask in src/sysinfo.h, EventType in src/events.h, MoveResult in src/main.cpp
+TASKS = ["time", "commands", "low_power_check", "valve", "filename", "log_power", "metrics", "samples",
+         "staging", "scrub", "battery"]
+EVENTS = ["tick", "second", "power_alert"]
+MOVES = ["done", "locked_out", "low_power", "deferred", "busy"]
+I2C = ["current", "current_voltage"]
+
+# Row per code; ISRs nest inside whatever they interrupted, so they get their own
+THREADS = {"isr_events": (2, "event timer ISR"), "isr_alert": (3, "alert ISR"),
+           "isr_sampler": (4, "sampler ISR"), "i2c": (5, "INA260 transfer")}
+LOOP_THREAD = (1, "loop")
+
+
+def frames(data):
+    i = 0
+    while True:
+        i = data.find(b"\xa5\x5aT", i)
+        if i < 0 or i + 6 > len(data):
+            return
+        version = data[i + 3]
+        (length,) = struct.unpack_from("<H", data, i + 4)
+        end = i + 6 + length + 2
+        if end <= len(data):
+            (crc,) = struct.unpack_from("<H", data, end - 2)
+            if crc == crc16(data[i + 2:end - 2]):
+                yield version, data[i + 6:end - 2]
+                i = end
+                continue
+        i += 1
+
+
+def label(name, arg):
+    if name == "task":
+        return TASKS[arg] if arg < len(TASKS) else "task[%d]" % arg
+    table = {"event": EVENTS, "valve": MOVES, "i2c": I2C}.get(name)
+    if table is not None:
+        return "%s %s" % (name, table[arg] if arg < len(table) else arg)
+    if name == "command":
+        return "command %d" % arg
+    if name == "schedule":
+        return "schedule id %d" % arg
+    return name
+
+
+def read_dump(data):
+    """Records of the newest complete dump, oldest first."""
+    chunks = {}
+    cpu_hz = version = None
+    for v, payload in frames(data):
+        hz, chunk, count, first = struct.unpack_from("<IHHI", payload, 0)
+        if chunk == 0:
+            chunks = {}
+        version, cpu_hz = v, hz
+        chunks[chunk] = (count, payload[12:])
+    if not chunks:
+        sys.exit("no trace frames found")
+    count = next(iter(chunks.values()))[0]
+    missing = [c for c in range(count) if c not in chunks]
+    if missing:
+        print("missing trace chunks %s" % missing, file=sys.stderr)
+    body = b"".join(chunks[c][1] for c in range(count) if c in chunks)
+    records = [struct.unpack_from("<IBBH", body, i) for i in range(0, len(body) - 7, 8)]
+    return version, cpu_hz, records
+
+
+def export(version, cpu_hz, records):
+    names = CODES.get(version)
+    if names is None:
+        sys.exit("unknown trace version %d" % version)
+    events = []
+    for tid, name in {LOOP_THREAD} | set(THREADS.values()):
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid, "args": {"name": name}})
+
+    # Unwrap the 32-bit cycle counter, then order by time: an ISR that fires
+    # between a record's slot and its timestamp lands slightly out of order
+    timed = []
+    elapsed = 0
+    previous = records[0][0] if records else 0
+    for record in records:
+        delta = (record[0] - previous) & 0xFFFFFFFF
+        if delta >= 0x80000000:
+            delta -= 0x100000000
+        elapsed += delta
+        previous = record[0]
+        timed.append((elapsed, record))
+    timed.sort(key=lambda t: t[0])
+
+    open_spans = {}
+    for elapsed, (cycles, code, phase, arg) in timed:
+        name = names[code] if code < len(names) else "code%d" % code
+        tid = THREADS.get(name, LOOP_THREAD)[0]
+        event = {"name": label(name, arg), "cat": name, "pid": 0, "tid": tid,
+                 "ts": elapsed * 1e6 / cpu_hz, "args": {"arg": arg}}
+        phase = chr(phase)
+        key = (tid, name)
+        if phase == "B":
+            open_spans[key] = open_spans.get(key, 0) + 1
+        elif phase == "E":
+            # The ring may start inside a span; drop ends without a begin
+            if not open_spans.get(key):
+                continue
+            open_spans[key] -= 1
+        elif phase == "i":
+            event["s"] = "t"
+        event["ph"] = phase
+        events.append(event)
+    return {"traceEvents": events, "displayTimeUnit": "ns",
+            "otherData": {"cpu_hz": cpu_hz, "records": len(records)}}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("file", nargs="?", help="capture file (default stdin)")
+    parser.add_argument("--port", help="serial port to query with $trace dump")
+    parser.add_argument("-o", "--output", help="JSON file (default stdout)")
+    args = parser.parse_args()
+
+    if args.port:
+        import serial
+        with serial.Serial(args.port, 115200, timeout=2) as s:
+            s.write(b"$trace dump\n")
+            data = s.read(64 * 1024)
+    elif args.file:
+        with open(args.file, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    trace = export(*read_dump(data))
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
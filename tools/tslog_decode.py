@@ -0,0 +1,290 @@
+#!/usr/bin/env python3
+"""
+Decode GEMS pump binary time-series logs (.gts) to CSV, or benchmark the encoding.
+
+Block format is documented in src/tslog.h. Blocks with a bad CRC are
+skipped and reported on stderr; the rest of the file still decodes.
+
+    python3 tools/tslog_decode.py gems_pump_2024-05-01.gts > out.csv
+    python3 tools/tslog_decode.py --bench field/*.csv
+
+--bench encodes the power records of field CSVs with the same scheme and
+compares the size with zlib, bz2 and lzma on the same columns as CSV, both
+over the whole file and per block (the same records per independently
+decodable chunk, which is what the logger can afford).
+"""
+
+import argparse
+import bz2
+import datetime
+import lzma
+import struct
+import sys
+import zlib
+
+VERSION = 1
+BLOCK_SIZE = 512
+COLUMNS = "timestamp,voltage,current,valve_position,ripple_hz,current_min,current_max"
+
+
+def crc16(data, crc=0xFFFF):
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def zigzag(v):
+    return (v << 1) ^ (v >> 63)
+
+
+class Reader:
+    def __init__(self, data, pos=0):
+        self.data = data
+        self.pos = pos
+
+    def byte(self):
+        b = self.data[self.pos]
+        self.pos += 1
+        return b
+
+    def varint(self):
+        value = shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if b < 0x80:
+                return value
+
+    def zz(self):
+        return unzigzag(self.varint())
+
+
+def decode_block(data, pos):
+    """Returns (records, next position) or raises ValueError."""
+    if data[pos:pos + 2] != b"GT":
+        raise ValueError("no block magic")
+    version, count, stream_length = struct.unpack_from("<BHH", data, pos + 2)
+    if version != VERSION:
+        raise ValueError("unknown version %d" % version)
+    r = Reader(data, pos + 7)
+    records = []
+    millis = delta = voltage = current = 0
+    ripple = 0
+    for i in range(count):
+        if i == 0:
+            millis = r.varint()
+            voltage = r.zz()
+            current = r.zz()
+        else:
+            delta += r.zz()
+            millis += delta
+            voltage += r.zz()
+            current += r.zz()
+        low = current - r.zz()
+        high = current + r.zz()
+        ripple += r.zz()
+        records.append([millis, voltage, current, None, ripple / 10.0, low, high])
+    if r.pos != pos + 7 + stream_length:
+        raise ValueError("stream length mismatch")
+    i = 0
+    while i < count:
+        valve = r.zz()
+        run = r.varint()
+        for record in records[i:i + run]:
+            record[3] = valve
+        i += run
+    (crc,) = struct.unpack_from("<H", data, r.pos)
+    if crc != crc16(data[pos:r.pos]):
+        raise ValueError("CRC mismatch")
+    return records, r.pos + 2
+
+
+def decode_file(data):
+    pos = 0
+    while pos < len(data):
+        try:
+            records, pos = decode_block(data, pos)
+        except (ValueError, IndexError, struct.error) as e:
+            print("block at %d: %s" % (pos, e), file=sys.stderr)
+            # Resynchronise on the next block magic
+            pos = data.find(b"GT", pos + 1)
+            if pos < 0:
+                return
+            continue
+        yield from records
+
+
+def format_time(millis):
+    t = datetime.datetime.fromtimestamp(millis // 1000, datetime.timezone.utc)
+    return t.strftime("%Y-%m-%dT%H:%M:%S") + ".%03dZ" % (millis % 1000)
+
+
+def format_record(r):
+    return "%s,%d,%d,%d,%.1f,%d,%d" % (format_time(r[0]), r[1], r[2], r[3], r[4], r[5], r[6])
+
+
+class Encoder:
+    """Python twin of the firmware encoder, for benchmarking."""
+
+    MAX_RECORD = 10 + 5 * 5
+    MAX_RUN = 10
+
+    def __init__(self):
+        self.blocks = []
+        self.reset()
+
+    def reset(self):
+        self.stream = bytearray()
+        self.runs = bytearray()
+        self.count = 0
+        self.previous = None
+        self.previous_delta = 0
+        self.run = None
+
+    @staticmethod
+    def varint(out, v):
+        while v >= 0x80:
+            out.append((v & 0x7F) | 0x80)
+            v >>= 7
+        out.append(v)
+
+    def add(self, r):
+        used = 7 + len(self.stream) + len(self.runs)
+        if used + self.MAX_RECORD + 2 * self.MAX_RUN + 2 > BLOCK_SIZE \
+                or len(self.runs) + 2 * self.MAX_RUN > 64 or self.count == 0xFFFF:
+            self.finish()
+        millis, voltage, current, valve, ripple, low, high = r
+        ripple = int(round(ripple * 10))
+        out = self.stream
+        p = self.previous
+        if not self.count:
+            self.varint(out, millis)
+            self.varint(out, zigzag(voltage))
+            self.varint(out, zigzag(current))
+        else:
+            delta = millis - p[0]
+            self.varint(out, zigzag(delta - self.previous_delta))
+            self.varint(out, zigzag(voltage - p[1]))
+            self.varint(out, zigzag(current - p[2]))
+            self.previous_delta = delta
+        self.varint(out, zigzag(current - low))
+        self.varint(out, zigzag(high - current))
+        self.varint(out, zigzag(ripple - p[4] if self.count else ripple))
+        if self.count and valve == self.run[0]:
+            self.run[1] += 1
+        else:
+            if self.count:
+                self.flush_run()
+            self.run = [valve, 1]
+        self.previous = (millis, voltage, current, valve, ripple, low, high)
+        self.count += 1
+
+    def flush_run(self):
+        self.varint(self.runs, zigzag(self.run[0]))
+        self.varint(self.runs, self.run[1])
+
+    def finish(self):
+        if not self.count:
+            return
+        self.flush_run()
+        block = b"GT" + struct.pack("<BHH", VERSION, self.count, len(self.stream)) + self.stream + self.runs
+        self.blocks.append(block + struct.pack("<H", crc16(block)))
+        self.reset()
+
+
+def parse_time(text):
+    text = text.rstrip("Z")
+    for fmt in ("%Y-%m-%dT%H:%M:%S.%f", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M:%S"):
+        try:
+            t = datetime.datetime.strptime(text, fmt).replace(tzinfo=datetime.timezone.utc)
+            return int(round(t.timestamp() * 1000))
+        except ValueError:
+            pass
+    return None
+
+
+def read_field_csv(path):
+    """Power records from a daily CSV; event lines and the header are skipped."""
+    records = []
+    with open(path) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            if len(fields) < 4:
+                continue
+            millis = parse_time(fields[0])
+            if millis is None:
+                continue
+            try:
+                voltage, current, valve = int(fields[1]), int(fields[2]), int(fields[3])
+                ripple = float(fields[4]) if len(fields) > 4 and fields[4] else 0.0
+                low = int(fields[6]) if len(fields) > 7 else current
+                high = int(fields[7]) if len(fields) > 7 else current
+            except ValueError:
+                continue
+            records.append((millis, voltage, current, valve, ripple, low, high))
+    return records
+
+
+def bench(paths):
+    records = []
+    for path in paths:
+        records += read_field_csv(path)
+    if not records:
+        sys.exit("no power records found")
+
+    encoder = Encoder()
+    for r in records:
+        encoder.add(r)
+    encoder.finish()
+    binary = b"".join(encoder.blocks)
+
+    decoded = list(decode_file(binary))
+    expected = [format_record(r) for r in records]
+    if [format_record(r) for r in decoded] != expected:
+        sys.exit("round trip mismatch")
+
+    csv = ("\n".join([COLUMNS] + expected) + "\n").encode()
+    chunks, i = [], 0
+    for block in encoder.blocks:
+        count = struct.unpack_from("<H", block, 3)[0]
+        chunks.append(("\n".join(expected[i:i + count]) + "\n").encode())
+        i += count
+    sizes = [("csv", len(csv)),
+             ("zlib -9", len(zlib.compress(csv, 9))),
+             ("bz2 -9", len(bz2.compress(csv, 9))),
+             ("lzma -9", len(lzma.compress(csv, preset=9))),
+             ("zlib/blk", sum(len(zlib.compress(c, 9)) for c in chunks)),
+             ("lzma/blk", sum(len(lzma.compress(c, preset=9)) for c in chunks)),
+             ("gts", len(binary))]
+    print("%d records, %d blocks" % (len(records), len(encoder.blocks)))
+    print("  %-10s %10s %8s %8s" % ("format", "bytes", "B/rec", "ratio"))
+    for name, size in sizes:
+        print("  %-10s %10d %8.2f %7.1fx" % (name, size, size / len(records), len(csv) / size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("files", nargs="+", help=".gts files, or CSVs with --bench")
+    parser.add_argument("--bench", action="store_true", help="benchmark the encoding on field CSVs")
+    args = parser.parse_args()
+
+    if args.bench:
+        bench(args.files)
+        return
+    print(COLUMNS)
+    for path in args.files:
+        with open(path, "rb") as f:
+            for record in decode_file(f.read()):
+                print(format_record(record))
+
+
+if __name__ == "__main__":
+    main()